@@ -2,32 +2,57 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+
+#include <wx/ffile.h>
+#include <wx/stopwatch.h>
 
 #include "editor.h"
+#include "fileio.h"
+#include "gproc/footprint.h"
 #include "gproc/lexer.h"
 #include "gproc/parser.h"
+#include "gproc/pool.h"
 
-#define LEX_COMMENT       9  // ( ) - comments
+#define LEX_COMMENT       9  // ( ) ; - comments
 #define LEX_NUMOP_1      10  // G - g-words
 #define LEX_NUMOP_2      11  // X Y Z U V W P Q R A B C - dimension words
 #define LEX_NUMOP_3      12  // I J K - interpolation lead words
 #define LEX_NUMOP_4      13  // E F - feed rate
 #define LEX_NUMOP_5      14  // S - spindle speed
-#define LEX_NUMOP_6      15  // D T - tool function
-#define LEX_NUMOP_7      16  // M - misc function
-#define LEX_PNUMBER      17  // N - pgm. number
+#define LEX_NUMOP_6      15  // D T H - tool function
+#define LEX_NUMOP_7      16  // M L - misc function
+#define LEX_PNUMBER      17  // N O - pgm. number
+#define STYLE_COLLISION  18  // annotations of collisions
 
 #define STC_FOLDMARGIN    2
 
+#define MARK_CHANGED      0
+#define MARK_INSERTED     1
+#define MARK_DELETED      2
+#define MARK_COLLISION    3
+
 #define USE_LEXER         1
 #define USE_PARSER        1
 
 wxDEFINE_EVENT(STC_STATUS_CHANGED, wxCommandEvent);
 
+// milliseconds of edits gathered before they are written to the journal
+static const int JOURNAL_INTERVAL = 2000;
+// larger edits wait for the next parse of the whole text
+static const int MAX_FOLLOW_LINES = 256;
+
 
 Editor::Editor(wxWindow* parent)
-        : wxStyledTextCtrl(parent), modified_(false)
+        : wxStyledTextCtrl(parent), modified_(false), dialect_(Dialect::RS274),
+          foreground_(true), edit_serial_(0),
+          save_serial_(0), save_queue_(std::make_shared<SaveQueue>()),
+          journal_(new Journal), journal_timer_(this), keep_journal_(false),
+          parse_generation_(0), parsed_generation_(0),
+          alive_(std::make_shared<bool>(true)),
+          parsed_(false), follows_(false), first_line_(0), ascii_(true), match_(0)
 {
     SetLexer(wxSTC_LEX_CONTAINER);
 
@@ -61,10 +86,23 @@ Editor::Editor(wxWindow* parent)
 
     MarkerEnableHighlight(true);
 
+    MarkerDefine(MARK_CHANGED, wxSTC_MARK_BACKGROUND);
+    MarkerSetBackground(MARK_CHANGED, wxColour(255, 244, 204));
+    MarkerDefine(MARK_INSERTED, wxSTC_MARK_BACKGROUND);
+    MarkerSetBackground(MARK_INSERTED, wxColour(221, 244, 221));
+    MarkerDefine(MARK_DELETED, wxSTC_MARK_ARROW);
+    MarkerSetForeground(MARK_DELETED, wxColour(215, 58, 73));
+    MarkerSetBackground(MARK_DELETED, wxColour(215, 58, 73));
+    MarkerDefine(MARK_COLLISION, wxSTC_MARK_CIRCLE);
+    MarkerSetForeground(MARK_COLLISION, wxColour(215, 58, 73));
+    MarkerSetBackground(MARK_COLLISION, wxColour(215, 58, 73));
+    AnnotationSetVisible(wxSTC_ANNOTATION_BOXED);
+
     SetMarginSensitive(STC_FOLDMARGIN, true);
     Bind(wxEVT_STC_MARGINCLICK, &Editor::OnMarginClick, this);
     Bind(wxEVT_STC_MODIFIED, &Editor::OnModified, this);
     Bind(wxEVT_STC_STYLENEEDED, &Editor::OnStyleNeeded, this);
+    Bind(wxEVT_TIMER, &Editor::OnJournalTimer, this, journal_timer_.GetId());
 
     SetScrollWidth(1);
     SetScrollWidthTracking(true);
@@ -83,6 +121,9 @@ Editor::Editor(wxWindow* parent)
     StyleSetForeground(wxSTC_STYLE_DEFAULT, wxColour(35, 36, 38));
     StyleSetSize(wxSTC_STYLE_DEFAULT, 12);
 
+    StyleSetForeground(STYLE_COLLISION, wxColour(165, 29, 45));
+    StyleSetBackground(STYLE_COLLISION, wxColour(255, 235, 233));
+
     StyleSetForeground(wxSTC_STYLE_LINENUMBER, "grey");
     StyleSetBackground(wxSTC_STYLE_LINENUMBER, wxColour(228, 228, 228));
 }
@@ -96,7 +137,9 @@ void Editor::DoSetStyling(unsigned fromPos, unsigned toPos, wxString &text) {
     SetStyling(toPos - fromPos, 0);
 
 #if USE_LEXER
-    Lexer lexer(text.ToStdWstring());
+    // the range as handed in, and the copy the lexer works on
+    FootprintHold hold(Footprint::StyleText, (text.length() + 1) * sizeof(wxChar) * 2);
+    Lexer lexer(text.ToStdWstring(), Dialect::grammar_of(dialect_).macros);
     int numop;
     unsigned start, length;
     for (Token::Token t = lexer.next();
@@ -145,15 +188,18 @@ void Editor::DoSetStyling(unsigned fromPos, unsigned toPos, wxString &text) {
             numop = LEX_NUMOP_5;
         }
         else if (t.type == Token::D ||
-                 t.type == Token::T)
+                 t.type == Token::T ||
+                 t.type == Token::H)
         {
             numop = LEX_NUMOP_6;
         }
-        else if (t.type == Token::M)
+        else if (t.type == Token::M ||
+                 t.type == Token::L)
         {
             numop = LEX_NUMOP_7;
         }
-        else if (t.type == Token::N)
+        else if (t.type == Token::N ||
+                 t.type == Token::O)
         {
             numop = LEX_PNUMBER;
         }
@@ -179,24 +225,551 @@ void Editor::DoSetStyling(unsigned fromPos, unsigned toPos, wxString &text) {
 
 #if USE_PARSER
     if (!modified_) return;
+    Reparse();
+#endif
+}
+
+void Editor::SetDialect(Dialect::Kind dialect)
+{
+    dialect_ = dialect;
+    follows_ = false;
+    Reparse();
+}
+
+void Editor::SetForeground(bool foreground)
+{
+    foreground_ = foreground;
+    // resubmit a pending background parse at the right priority
+    if (foreground_ && parsed_generation_ != parse_generation_)
+    {
+        Reparse();
+    }
+}
+
+bool Editor::IsProgramCurrent()
+{
+    return parsed_ && !modified_ && parsed_generation_ == parse_generation_;
+}
+
+Editor::MemoryUsage Editor::GetMemoryUsage()
+{
+    MemoryUsage usage;
+    // a byte of text and one of style per char, line starts and states
+    usage.text = (size_t) GetLength() * 2 + (size_t) GetLineCount() * 4 * sizeof(int);
+    usage.program = program_ ? program_->memory_usage() : 0;
+    usage.index = index_.memory_usage();
+    usage.toolpath = toolpath_ ? toolpath_->memory_usage() : 0;
+    usage.analyses = (calls_ ? calls_->memory_usage() : 0) +
+                     (layers_ ? layers_->memory_usage() : 0) +
+                     (speeds_ ? speeds_->memory_usage() : 0) +
+                     (ranges_ ? ranges_->memory_usage() : 0);
+    return usage;
+}
+
+void Editor::Reparse()
+{
+    auto text = std::make_shared<std::wstring>(GetText().ToStdWstring());
+    // UTF-8 buffer positions match char indices only for plain ASCII
+    ascii_ = text->length() == (size_t)GetLength();
+    modified_ = false;
+
+    auto generation = ++parse_generation_;
+    auto serial = edit_serial_;
+    auto dialect = dialect_;
+    std::weak_ptr<bool> alive = alive_;
+    WorkPool::shared().submit([=]() {
+        FootprintHold hold(Footprint::ParseText, (text->capacity() + 1) * sizeof(wchar_t));
+        auto result = std::make_shared<ParseResult>();
+        try {
+            auto program = parse_program(dialect, *text, &result->index);
+            result->toolpath = std::make_shared<const Toolpath>(program);
+            result->calls = std::make_shared<const CallGraph>(program, dialect);
+            result->layers = std::make_shared<const LayerIndex>(program);
+            // analyses that only look at words share a single walk
+            auto speeds = std::make_shared<SpeedPass>();
+            auto ranges = std::make_shared<RangePass>();
+            AnalysisPipeline pipeline;
+            pipeline.add(speeds.get());
+            pipeline.add(ranges.get());
+            pipeline.run(program);
+            result->speeds = speeds;
+            result->ranges = ranges;
+            result->program = std::make_shared<const ProgramSnapshot>(std::move(program), serial);
+        }
+        catch (PosException& e)
+        {
+            result->error = e;
+        }
+        if (!wxTheApp) return;
+        wxTheApp->CallAfter([=]() {
+            if (alive.expired()) return;
+            OnParsed(generation, *result);
+        });
+    }, foreground_ ? WorkPool::Foreground : WorkPool::Background);
+}
+
+void Editor::OnParsed(unsigned generation, ParseResult& result)
+{
+    // a newer parse is on its way
+    if (generation != parse_generation_) return;
+    parsed_generation_ = generation;
+
+    if (result.error)
+    {
+        parsed_ = false;
+        follows_ = false;
+        auto position = PositionFromIndex(result.error->position());
+        auto line = LineFromPosition(position);
+        auto column = position - PositionFromLine(line);
+        status_ = std::to_string(line+1) + ":" + std::to_string(column) + ": " + result.error->what();
+    }
+    else
+    {
+        program_ = std::move(result.program);
+        // edits made since were not parsed into it, the next parse has them
+        follows_ = !modified_ && program_->size() > 0;
+        if (follows_) first_line_ = LineFromPosition(PositionFromIndex(program_->start(0)));
+        index_ = std::move(result.index);
+        toolpath_ = std::move(result.toolpath);
+        calls_ = std::move(result.calls);
+        layers_ = std::move(result.layers);
+        speeds_ = std::move(result.speeds);
+        ranges_ = std::move(result.ranges);
+        parsed_ = true;
+        status_ = "Compiles fine";
+        if (layers_->size())
+        {
+            auto seconds = (unsigned) layers_->total_time();
+            status_ << ", " << layers_->size() << " layers, "
+                    << wxString::Format("%.2f m filament, %u:%02u h",
+                                        layers_->total_extruded() / 1000,
+                                        seconds / 3600, seconds / 60 % 60);
+        }
+        // calls are checked across the whole program, only the first problem shows
+        auto& problems = calls_->problems();
+        if (!problems.empty())
+        {
+            status_ = std::to_string(LineFromBlock(problems[0].block) + 1) + ": " + problems[0].message;
+        }
+    }
 
     wxCommandEvent event(STC_STATUS_CHANGED);
-    try {
-        /* we need to keep this ref alive for the duration of the scope */
-        auto text = GetText();
-        Parser parser(text.ToStdWstring());
-        parser.parse();
-        event.SetString("Compiles fine");
+    event.SetEventObject(this);
+    event.SetString(status_);
+    wxPostEvent(this, event);
+}
+
+Editor::~Editor()
+{
+    journal_timer_.Stop();
+    // closing a document means its changes were saved or given up
+    if (!keep_journal_) journal_->Discard();
+}
+
+bool Editor::DoLoadFile(const wxString& path, int fileType)
+{
+    // the loaded text is the journal's new base, not an edit
+    auto journal = std::move(journal_);
+    bool ret;
+    if (IsGzipFile(path))
+    {
+        ret = LoadGzipFile(path);
+        gzip_path_ = ret ? path : wxString();
     }
-    catch (ParserException e)
+    else
     {
-        auto line = LineFromPosition(e.position());
-        auto column = e.position() - PositionFromLine(line);
-        event.SetString(std::to_string(line+1) + ":" + std::to_string(column) + ": " + e.what());
+        ret = wxStyledTextCtrl::DoLoadFile(path, fileType);
+        gzip_path_ = wxEmptyString;
+        if (!ret) status_ = _T("Cannot read the file");
     }
-    wxPostEvent(GetParent(), event);
-    modified_ = false;
-#endif
+    journal_ = std::move(journal);
+    if (ret && journal_) journal_->Reset(path, GetLength());
+    return ret;
+}
+
+bool Editor::LoadGzipFile(const wxString& path)
+{
+    ClearAll();
+    SetUndoCollection(false);
+    // inflated UTF-8 goes straight into the buffer while the next chunk inflates
+    auto error = ReadGzipFile(path, [this](const char* data, size_t length) {
+        AppendTextRaw(data, length);
+    });
+    // half a file must not pass for the whole of it
+    if (!error.empty()) ClearAll();
+    SetUndoCollection(true);
+    EmptyUndoBuffer();
+    SetSavePoint();
+
+    if (error.empty()) return true;
+    status_ = wxString::FromUTF8(error.c_str());
+    return false;
+}
+
+void Editor::ResetJournal()
+{
+    journal_->Reset(path_, GetLength());
+}
+
+void Editor::KeepJournal()
+{
+    if (!GetModify()) return;
+    journal_->Flush(true);
+    keep_journal_ = true;
+}
+
+bool Editor::Recover(const wxString& journalPath, wxString* error)
+{
+    // replaying must not journal the replayed edits a second time
+    auto journal = std::move(journal_);
+    wxString path;
+    if (!Journal::Replay(journalPath, this, &path, error))
+    {
+        journal_ = std::move(journal);
+        return false;
+    }
+    journal_.reset(Journal::Resume(journalPath, path));
+    journal->Discard();
+    EmptyUndoBuffer();
+    SetPath(path);
+    return true;
+}
+
+void Editor::OnJournalTimer(wxTimerEvent& WXUNUSED(event))
+{
+    journal_->Flush();
+    journal_->MaybeCheckpoint(this);
+}
+
+void Editor::SaveAsync(const wxString& path, SaveCallback done, bool wait/* = false */)
+{
+    // snapshot straight out of the Scintilla buffer, a single copy
+    auto data = std::make_shared<std::string>(GetCharacterPointer(), GetLength());
+    bool gzip = path.Lower().EndsWith(".gz") || path == gzip_path_;
+    auto serial = edit_serial_;
+    auto order = ++save_serial_;
+    auto queue = save_queue_;
+    std::weak_ptr<bool> alive = alive_;
+
+    auto finish = [=](const std::string& error) {
+        if (alive.expired()) return;
+        // a save point on newer text would hide unsaved changes
+        if (error.empty() && serial == edit_serial_)
+        {
+            SetSavePoint();
+            journal_->Reset(path, GetLength());
+        }
+        else if (error.empty())
+        {
+            // the saved file is not the base of the newer edits
+            journal_->Reset(path, GetLength());
+            journal_->Checkpoint(this);
+        }
+        done(wxString::FromUTF8(error.c_str()));
+    };
+    auto write = [=]() {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        // a newer snapshot already made it to disk
+        if (order < queue->written) return std::string();
+        queue->written = order;
+        FootprintHold hold(Footprint::FileText, data->capacity());
+        if (gzip)
+        {
+            auto compressed = GzipCompress(data->data(), data->length());
+            return WriteFileAtomic(path, compressed.data(), compressed.length());
+        }
+        return WriteFileAtomic(path, data->data(), data->length());
+    };
+
+    if (wait)
+    {
+        finish(write());
+        return;
+    }
+    WorkPool::shared().submit([=]() {
+        auto error = write();
+        if (!wxTheApp) return;
+        wxTheApp->CallAfter([=]() { finish(error); });
+    }, WorkPool::Foreground);
+}
+
+int Editor::ApplyTransform(const Transform& transform)
+{
+    // edits are computed against the parsed text, it must be current
+    if (!IsProgramCurrent()) return -1;
+
+    // added lines end the way the first one does
+    auto line = GetLine(0);
+    auto eol = line.EndsWith("\r\n") ? L"\r\n" : line.EndsWith("\r") ? L"\r" : L"\n";
+    auto edits = transform.apply(program_->program(), 3, eol);
+    if (edits.empty()) return 0;
+
+    // map char indices to buffer positions in one forward sweep
+    std::vector<int> positions(edits.size());
+    int position = 0;
+    unsigned index = 0;
+    for (size_t i = 0; i < edits.size(); ++i)
+    {
+        position = ascii_ ? edits[i].start :
+            PositionRelative(position, edits[i].start - index);
+        index = edits[i].start;
+        positions[i] = position;
+    }
+
+    // apply back to front so pending positions stay valid, the program
+    // catches up with the next parse rather than with every edit
+    follows_ = false;
+    BeginUndoAction();
+    for (size_t i = edits.size(); i-- > 0;)
+    {
+        auto end = ascii_ ? positions[i] + edits[i].length :
+            PositionRelative(positions[i], edits[i].length);
+        SetTargetRange(positions[i], end);
+        ReplaceTarget(edits[i].text);
+    }
+    EndUndoAction();
+    return edits.size();
+}
+
+bool Editor::Reformat(const Serializer::Options& options)
+{
+    if (!IsProgramCurrent()) return false;
+
+    ReplaceProgram(program_->program(), options);
+    return true;
+}
+
+void Editor::ReplaceProgram(const Program& program, const Serializer::Options& options)
+{
+    auto text = Serializer(options).write(program);
+    follows_ = false;
+    BeginUndoAction();
+    SetTargetRange(0, GetLength());
+    ReplaceTargetRaw(text.data(), text.length());
+    EndUndoAction();
+}
+
+unsigned Editor::FindBlocks(const wxString& query)
+{
+    matches_ = index_.query(query.ToStdWstring());
+    match_ = 0;
+    if (!matches_.empty())
+    {
+        GotoBlock(matches_[match_]);
+    }
+    return matches_.size();
+}
+
+bool Editor::FindNext(bool forward/* = true */)
+{
+    if (matches_.empty()) return false;
+
+    if (forward)
+    {
+        match_ = (match_ + 1) % matches_.size();
+    }
+    else
+    {
+        match_ = (match_ + matches_.size() - 1) % matches_.size();
+    }
+    GotoBlock(matches_[match_]);
+    return true;
+}
+
+void Editor::GotoBlock(unsigned index)
+{
+    if (!program_ || index >= program_->size()) return;
+
+    auto start = PositionFromIndex(program_->start(index));
+    auto end = PositionFromIndex(program_->start(index) + program_->length(index));
+    EnsureVisible(LineFromPosition(start));
+    SetSelection(start, end);
+    EnsureCaretVisible();
+}
+
+bool Editor::GotoLayer(unsigned layer)
+{
+    if (!parsed_ || layer >= layers_->size()) return false;
+    GotoBlock(layers_->first_block(layer));
+    return true;
+}
+
+void Editor::CompareAsync(const wxString& path, CompareCallback done)
+{
+    // later edits make new versions, this one stays as it is
+    auto program = program_;
+    auto dialect = dialect_;
+    std::weak_ptr<bool> alive = alive_;
+    WorkPool::shared().submit([=]() {
+        std::string text;
+        wxString error;
+        if (IsGzipFile(path))
+        {
+            error = ReadGzipFile(path, [&](const char* data, size_t length) {
+                text.append(data, length);
+            });
+        }
+        else
+        {
+            wxFFile file(path, "rb");
+            auto length = file.IsOpened() ? file.Length() : wxFileOffset(-1);
+            if (length >= 0) text.resize((size_t) length);
+            if (length < 0 || file.Read(&text[0], text.length()) != text.length())
+            {
+                error = _T("Cannot read the file");
+            }
+        }
+
+        std::shared_ptr<BlockDiff> diff;
+        // the file as read, and twice as wide text for the parser
+        FootprintHold hold(Footprint::FileText, text.capacity() + text.length() * 2 * sizeof(wchar_t));
+        if (error == wxEmptyString)
+        {
+            try {
+                auto other = parse_program(dialect, wxString::FromUTF8(text.data(), text.length()).ToStdWstring());
+                diff = std::make_shared<BlockDiff>(other, program->program());
+            }
+            catch (PosException& e)
+            {
+                error << e.position() << ": " << e.what();
+            }
+        }
+        if (!wxTheApp) return;
+        wxTheApp->CallAfter([=]() {
+            if (alive.expired()) return;
+            if (!diff)
+            {
+                done(error);
+                return;
+            }
+            // blocks of an older program no longer fit the text
+            if (program != program_)
+            {
+                done(_T("Program changed while it was compared"));
+                return;
+            }
+            ShowDiff(*diff);
+            wxString msg;
+            msg << diff->count(BlockDiff::Changed) << " changed, "
+                << diff->count(BlockDiff::Inserted) << " inserted, "
+                << diff->count(BlockDiff::Deleted) << " deleted blocks";
+            done(msg);
+        });
+    }, WorkPool::Foreground);
+}
+
+void Editor::CheckCollisionsAsync(const CollisionCheck::Setup& setup, CheckCallback done)
+{
+    auto toolpath = GetToolpath();
+    if (!toolpath)
+    {
+        done(_T("Program must compile before it can be checked"));
+        return;
+    }
+    std::weak_ptr<bool> alive = alive_;
+    WorkPool::shared().submit([=]() {
+        wxStopWatch watch;
+        CollisionCheck check(*toolpath);
+        auto hits = std::make_shared<std::vector<CollisionCheck::Hit>>(check.run(setup));
+        auto time = watch.Time();
+        if (!wxTheApp) return;
+        wxTheApp->CallAfter([=]() {
+            if (alive.expired()) return;
+            // blocks of an older program no longer fit the text
+            if (toolpath != toolpath_)
+            {
+                done(_T("Program changed while it was checked"));
+                return;
+            }
+            ShowCollisions(setup, *hits);
+            wxString msg;
+            if (hits->empty()) msg << "No collisions";
+            else msg << hits->size() << " collisions";
+            msg << " in " << toolpath->size() << " moves, " << time << " ms";
+            done(msg);
+        });
+    }, WorkPool::Foreground);
+}
+
+void Editor::ShowCollisions(const CollisionCheck::Setup& setup,
+                            const std::vector<CollisionCheck::Hit>& hits)
+{
+    const char* axes[] = { "X", "Y", "Z" };
+    const char* motions[] = { "Rapid", "Feed", "Arc" };
+    AnnotationClearAll();
+    MarkerDeleteAll(MARK_COLLISION);
+
+    // F3 walks through the collisions
+    matches_.clear();
+    match_ = 0;
+    std::map<int, wxString> notes;
+    for (auto& hit : hits)
+    {
+        auto line = LineFromBlock(hit.block);
+        if (line < 0) continue;
+        wxString msg;
+        if (hit.kind == CollisionCheck::Hit::Travel)
+        {
+            msg << axes[hit.what] << " leaves the travel ("
+                << setup.travel.min[hit.what] << " to " << setup.travel.max[hit.what] << ")";
+        }
+        else
+        {
+            msg << motions[hit.motion] << " into " << setup.fixtures[hit.what].name;
+        }
+        auto& note = notes[line];
+        if (note.Find(msg) != wxNOT_FOUND) continue;
+        if (!note.empty()) note << "\n";
+        note << msg;
+        matches_.push_back(hit.block);
+    }
+    for (auto& note : notes)
+    {
+        AnnotationSetText(note.first, note.second);
+        AnnotationSetStyle(note.first, STYLE_COLLISION);
+        MarkerAdd(note.first, MARK_COLLISION);
+    }
+    std::sort(matches_.begin(), matches_.end());
+    matches_.erase(std::unique(matches_.begin(), matches_.end()), matches_.end());
+    if (!matches_.empty()) GotoBlock(matches_[0]);
+}
+
+void Editor::ShowDiff(const BlockDiff& diff)
+{
+    MarkerDeleteAll(MARK_CHANGED);
+    MarkerDeleteAll(MARK_INSERTED);
+    MarkerDeleteAll(MARK_DELETED);
+
+    // F3 walks through the differences
+    matches_.clear();
+    match_ = 0;
+    for (auto& change : diff.changes())
+    {
+        int marker = change.kind == BlockDiff::Changed ? MARK_CHANGED
+                   : change.kind == BlockDiff::Inserted ? MARK_INSERTED : MARK_DELETED;
+        // deleted blocks are marked where they used to be
+        auto line = change.new_block < program_->size()
+                  ? LineFromBlock(change.new_block) : GetLineCount() - 1;
+        if (line < 0) continue;
+        MarkerAdd(line, marker);
+        if (matches_.empty() || matches_.back() != change.new_block)
+        {
+            matches_.push_back(change.new_block);
+        }
+    }
+    if (!matches_.empty()) GotoBlock(matches_[0]);
+}
+
+int Editor::LineFromBlock(unsigned index)
+{
+    if (!program_ || index >= program_->size()) return -1;
+    return LineFromPosition(PositionFromIndex(program_->start(index)));
+}
+
+unsigned Editor::PositionFromIndex(unsigned index)
+{
+    if (ascii_) return index;
+    return PositionRelative(0, index);
 }
 
 void Editor::OnMarginClick(wxStyledTextEvent& event) {
@@ -213,13 +786,74 @@ void Editor::OnMarginClick(wxStyledTextEvent& event) {
 
 void Editor::OnModified(wxStyledTextEvent& event) {
     int type = event.GetModificationType();
-    if (type & (wxSTC_MOD_INSERTTEXT || wxSTC_MOD_DELETETEXT ||
-                wxSTC_PERFORMED_UNDO || wxSTC_PERFORMED_REDO))
+    if (type & (wxSTC_MOD_INSERTTEXT | wxSTC_MOD_DELETETEXT))
     {
         modified_ = true;
+        ++edit_serial_;
+        FollowEdit(event);
+        if (!journal_) return;
+        if (type & wxSTC_MOD_INSERTTEXT)
+        {
+            auto text = event.GetText().utf8_str();
+            journal_->Insert(event.GetPosition(), text.data(), text.length());
+        }
+        else
+        {
+            journal_->Delete(event.GetPosition(), event.GetLength());
+        }
+        if (!journal_timer_.IsRunning())
+        {
+            journal_timer_.StartOnce(JOURNAL_INTERVAL);
+        }
     }
 }
 
+void Editor::FollowEdit(wxStyledTextEvent& event)
+{
+    if (!follows_) return;
+    follows_ = false;
+
+    // undoing a transform replays each of its edits, leave those to a parse
+    int type = event.GetModificationType();
+    if (type & wxSTC_MULTISTEPUNDOREDO) return;
+    // char indices only match buffer positions for plain ASCII
+    if (!ascii_ || !program_->macros().empty()) return;
+    if (type & wxSTC_MOD_INSERTTEXT)
+    {
+        auto text = event.GetText();
+        if (text.utf8_str().length() != text.length()) return;
+    }
+
+    // lines [first, oldEnd) of blocks gave way to lines [first, newEnd)
+    int line = LineFromPosition(event.GetPosition());
+    int first = line - first_line_;
+    int added = event.GetLinesAdded();
+    int oldEnd = first + 1 + std::max(-added, 0);
+    int newEnd = first + 1 + std::max(added, 0);
+    if (first < 0 || oldEnd > (int) program_->size() || newEnd - first > MAX_FOLLOW_LINES) return;
+
+    int from = PositionFromLine(line);
+    int lastLine = line + newEnd - first - 1;
+    int to = lastLine + 1 < GetLineCount() ? PositionFromLine(lastLine + 1) : GetLength();
+    auto text = GetTextRange(from, to).ToStdWstring();
+    if (text.empty() || text.back() != L'\n') text += L'\n';
+
+    std::vector<Block> blocks;
+    try {
+        blocks = parse_blocks(dialect_, text, from);
+    }
+    catch (PosException&)
+    {
+        // the parse of the whole text reports it
+        return;
+    }
+    if ((int) blocks.size() != newEnd - first) return;
+
+    int shift = (type & wxSTC_MOD_INSERTTEXT) ? event.GetLength() : -event.GetLength();
+    program_ = program_->replace(first, oldEnd, std::move(blocks), shift, edit_serial_);
+    follows_ = true;
+}
+
 void Editor::OnStyleNeeded(wxStyledTextEvent& event) {
     // restyle the whole modified line otherwise we'll be lacking context
     unsigned startLine = LineFromPosition(GetEndStyled());
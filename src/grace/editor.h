@@ -4,22 +4,169 @@
 
 #pragma once
 
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+
 #include <wx/wx.h>
 
 #include <wx/stc/stc.h>
 
+#include "journal.h"
+#include "gproc/calls.h"
+#include "gproc/collision.h"
+#include "gproc/dialect.h"
+#include "gproc/diff.h"
+#include "gproc/index.h"
+#include "gproc/layers.h"
+#include "gproc/pipeline.h"
+#include "gproc/serializer.h"
+#include "gproc/snapshot.h"
+#include "gproc/toolpath.h"
+#include "gproc/transform.h"
+#include "gproc/types.h"
+
 wxDECLARE_EVENT(STC_STATUS_CHANGED, wxCommandEvent);
 
 class Editor : public wxStyledTextCtrl {
 public:
     Editor(wxWindow* parent);
+    ~Editor();
+    int ApplyTransform(const Transform& transform);
+    bool Reformat(const Serializer::Options& options);
+    // replaces the text with a program, as a single undo step
+    void ReplaceProgram(const Program& program,
+                        const Serializer::Options& options = Serializer::Options());
+    unsigned FindBlocks(const wxString& query);
+    bool FindNext(bool forward = true);
+    void GotoBlock(unsigned index);
+    bool GotoLayer(unsigned layer);
+    Dialect::Kind GetDialect() { return dialect_; }
+    void SetDialect(Dialect::Kind dialect);
+    // documents in the visible tab get their jobs scheduled first
+    void SetForeground(bool foreground);
+    wxString GetPath() { return path_; }
+    void SetPath(const wxString& path) { path_ = path; }
+    wxString GetStatus() { return status_; }
+    // done gets an empty string on success, an error message otherwise
+    using SaveCallback = std::function<void(const wxString& error)>;
+    void SaveAsync(const wxString& path, SaveCallback done, bool wait = false);
+    // restarts the journal against the current path, after the text was replaced
+    void ResetJournal();
+    // writes out the journal and keeps it for the next session to recover
+    void KeepJournal();
+    // loads the document left behind in a journal
+    bool Recover(const wxString& journalPath, wxString* error);
+    // compares the program with the file at path and marks what changed,
+    // done gets a summary or an error message
+    using CompareCallback = std::function<void(const wxString& status)>;
+    void CompareAsync(const wxString& path, CompareCallback done);
+    // checks the motion against the machine and annotates the blocks that
+    // collide, done gets a summary
+    using CheckCallback = std::function<void(const wxString& status)>;
+    void CheckCollisionsAsync(const CollisionCheck::Setup& setup, CheckCallback done);
+    int LineFromBlock(unsigned index);
+    // last program that compiled, kept up with edits of whole lines, or
+    // nullptr; other threads may hold on to it
+    std::shared_ptr<const ProgramSnapshot> GetProgram() { return parsed_ ? program_ : nullptr; }
+    // motion of the last program that compiled, or nullptr
+    std::shared_ptr<const Toolpath> GetToolpath() { return parsed_ ? toolpath_ : nullptr; }
+    // subprograms of the last program that compiled, or nullptr
+    std::shared_ptr<const CallGraph> GetCallGraph() { return parsed_ ? calls_ : nullptr; }
+    // layers of the last program that compiled, or nullptr
+    std::shared_ptr<const LayerIndex> GetLayers() { return parsed_ ? layers_ : nullptr; }
+    // S words of the last program that compiled, or nullptr
+    std::shared_ptr<const SpeedPass> GetSpeeds() { return parsed_ ? speeds_ : nullptr; }
+    // values programmed per letter in the last program that compiled, or nullptr
+    std::shared_ptr<const RangePass> GetRanges() { return parsed_ ? ranges_ : nullptr; }
+    // whether the last program that compiled matches the text
+    bool IsProgramCurrent();
+    // heap bytes the document holds, by what holds them
+    struct MemoryUsage {
+        // text and styles in Scintilla and its line table, estimated from
+        // their lengths; undo history is not counted
+        size_t text;
+        size_t program;
+        size_t index;
+        size_t toolpath;
+        // subprograms, layers, speeds and ranges
+        size_t analyses;
+        size_t total() const { return text + program + index + toolpath + analyses; }
+    };
+    MemoryUsage GetMemoryUsage();
+    unsigned PositionFromIndex(unsigned index);
 
 private:
+    struct ParseResult {
+        std::shared_ptr<const ProgramSnapshot> program;
+        WordIndex index;
+        std::shared_ptr<const Toolpath> toolpath;
+        std::shared_ptr<const CallGraph> calls;
+        std::shared_ptr<const LayerIndex> layers;
+        std::shared_ptr<const SpeedPass> speeds;
+        std::shared_ptr<const RangePass> ranges;
+        std::optional<PosException> error;
+    };
+    //
     void DoSetFoldLevels(unsigned fromPos, int startLevel, wxString& text);
     void DoSetStyling(unsigned fromPos, unsigned toPos, wxString &text);
+    bool DoLoadFile(const wxString& path, int fileType) wxOVERRIDE;
+    bool LoadGzipFile(const wxString& path);
+    void OnJournalTimer(wxTimerEvent& event);
     void OnMarginClick(wxStyledTextEvent& event);
     void OnModified(wxStyledTextEvent& event);
+    void OnParsed(unsigned generation, ParseResult& result);
     void OnStyleNeeded(wxStyledTextEvent& event);
+    void Reparse();
+    void FollowEdit(wxStyledTextEvent& event);
+    void ShowCollisions(const CollisionCheck::Setup& setup,
+                        const std::vector<CollisionCheck::Hit>& hits);
+    void ShowDiff(const BlockDiff& diff);
 
     bool modified_;
+    Dialect::Kind dialect_;
+    bool foreground_;
+    wxString path_;
+    wxString status_;
+    // file the text was inflated from, saved back compressed
+    wxString gzip_path_;
+    // bumped on every change to the text, tells saves whether they are current
+    unsigned edit_serial_;
+    // orders the writes of overlapping saves, the newest snapshot wins
+    struct SaveQueue {
+        std::mutex mutex;
+        unsigned written = 0;
+    };
+    unsigned save_serial_;
+    std::shared_ptr<SaveQueue> save_queue_;
+
+    // unsaved edits, batched to disk on a timer
+    std::unique_ptr<Journal> journal_;
+    wxTimer journal_timer_;
+    bool keep_journal_;
+
+    // parses run on the shared pool, only the latest one is kept
+    unsigned parse_generation_;
+    unsigned parsed_generation_;
+    // lets pool jobs find out whether the editor is gone
+    std::shared_ptr<bool> alive_;
+
+    // last program that parsed successfully, and its word index
+    bool parsed_;
+    std::shared_ptr<const ProgramSnapshot> program_;
+    // whether program_ matches the text, so edits can be parsed into it,
+    // and the line of its first block
+    bool follows_;
+    int first_line_;
+    WordIndex index_;
+    std::shared_ptr<const Toolpath> toolpath_;
+    std::shared_ptr<const CallGraph> calls_;
+    std::shared_ptr<const LayerIndex> layers_;
+    std::shared_ptr<const SpeedPass> speeds_;
+    std::shared_ptr<const RangePass> ranges_;
+    bool ascii_;
+
+    std::vector<unsigned> matches_;
+    size_t match_;
 };
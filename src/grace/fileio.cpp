@@ -0,0 +1,240 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <wx/mstream.h>
+#include <wx/wfstream.h>
+#include <wx/zstream.h>
+
+#include "fileio.h"
+
+// keeps concurrent saves of the same file off each other's temp file
+static std::atomic<unsigned> temp_serial { 0 };
+
+#ifdef _WIN32
+
+static std::string LastError(const char* what)
+{
+    return std::string(what) + " failed, error " + std::to_string(GetLastError());
+}
+
+std::string WriteFileAtomic(const wxString& path, const char* data, size_t length)
+{
+    std::wstring target = path.ToStdWstring();
+    std::wstring temp = target + L".grace~" + std::to_wstring(temp_serial++);
+
+    HANDLE file = CreateFileW(temp.c_str(), GENERIC_WRITE, 0, NULL,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return LastError("CreateFile");
+
+    std::string error;
+    while (length > 0 && error.empty())
+    {
+        // WriteFile takes a DWORD, anything up to 1 GB goes in one call
+        DWORD chunk = (DWORD) std::min<size_t>(length, 1u << 30);
+        DWORD written = 0;
+        if (!WriteFile(file, data, chunk, &written, NULL))
+        {
+            error = LastError("WriteFile");
+        }
+        data += written;
+        length -= written;
+    }
+    if (error.empty() && !FlushFileBuffers(file))
+    {
+        error = LastError("FlushFileBuffers");
+    }
+    CloseHandle(file);
+
+    if (error.empty() &&
+        !MoveFileExW(temp.c_str(), target.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        error = LastError("MoveFileEx");
+    }
+    if (!error.empty())
+    {
+        DeleteFileW(temp.c_str());
+    }
+    return error;
+}
+
+#else
+
+static std::string LastError(const char* what)
+{
+    return std::string(what) + " failed: " + std::strerror(errno);
+}
+
+std::string WriteFileAtomic(const wxString& path, const char* data, size_t length)
+{
+    std::string target(path.fn_str());
+    std::string temp = target + ".grace~" + std::to_string(temp_serial++);
+
+    // keep the permissions of the file we replace
+    mode_t mode = 0666;
+    struct stat st;
+    if (stat(target.c_str(), &st) == 0)
+    {
+        mode = st.st_mode & 07777;
+    }
+
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd < 0) return LastError("open");
+
+    std::string error;
+    while (length > 0 && error.empty())
+    {
+        auto written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno != EINTR) error = LastError("write");
+            continue;
+        }
+        data += written;
+        length -= written;
+    }
+    if (error.empty() && fsync(fd) != 0)
+    {
+        error = LastError("fsync");
+    }
+    close(fd);
+
+    if (error.empty() && rename(temp.c_str(), target.c_str()) != 0)
+    {
+        error = LastError("rename");
+    }
+    if (!error.empty())
+    {
+        unlink(temp.c_str());
+        return error;
+    }
+
+    // make the rename itself durable
+    std::string dir = target;
+    int dirfd = open(dirname(&dir[0]), O_RDONLY | O_CLOEXEC);
+    if (dirfd >= 0)
+    {
+        fsync(dirfd);
+        close(dirfd);
+    }
+    return error;
+}
+
+#endif
+
+/* */
+
+// decompressed bytes handed over at a time, and how many may wait
+static const size_t GZIP_CHUNK = 1 << 20;
+static const size_t GZIP_QUEUE = 4;
+
+bool IsGzipFile(const wxString& path)
+{
+    wxFileInputStream input(path);
+    unsigned char magic[2] = {0, 0};
+    return input.IsOk() && input.Read(magic, 2).LastRead() == 2 &&
+           magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+std::string ReadGzipFile(const wxString& path,
+                         const std::function<void(const char* data, size_t length)>& sink)
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::string> chunks;
+    bool done = false;
+    bool cancelled = false;
+    std::string error;
+
+    std::thread reader([&]() {
+        wxFileInputStream file(path);
+        wxZlibInputStream input(file, wxZLIB_GZIP);
+        std::string local_error;
+        if (!file.IsOk()) local_error = "Cannot open the file";
+
+        while (local_error.empty())
+        {
+            std::string chunk(GZIP_CHUNK, '\0');
+            input.Read(&chunk[0], chunk.size());
+            chunk.resize(input.LastRead());
+            if (input.GetLastError() != wxSTREAM_NO_ERROR &&
+                input.GetLastError() != wxSTREAM_EOF)
+            {
+                local_error = "Corrupt gzip stream";
+            }
+            bool last = chunk.size() == 0 || input.Eof();
+
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return chunks.size() < GZIP_QUEUE || cancelled; });
+            if (cancelled) return;
+            if (!chunk.empty()) chunks.emplace_back(std::move(chunk));
+            changed.notify_all();
+            if (last) break;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        error = local_error;
+        done = true;
+        changed.notify_all();
+    });
+
+    for (;;)
+    {
+        std::string chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return !chunks.empty() || done; });
+            if (chunks.empty()) break;
+            chunk = std::move(chunks.front());
+            chunks.pop_front();
+            changed.notify_all();
+        }
+        try {
+            sink(chunk.data(), chunk.size());
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                cancelled = true;
+                changed.notify_all();
+            }
+            reader.join();
+            throw;
+        }
+    }
+    reader.join();
+    return error;
+}
+
+std::string GzipCompress(const char* data, size_t length)
+{
+    wxMemoryOutputStream memory;
+    {
+        wxZlibOutputStream output(memory, wxZ_DEFAULT_COMPRESSION, wxZLIB_GZIP);
+        output.Write(data, length);
+        output.Close();
+    }
+    std::string compressed(memory.GetLength(), '\0');
+    memory.CopyTo(&compressed[0], compressed.size());
+    return compressed;
+}
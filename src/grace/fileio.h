@@ -0,0 +1,36 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <wx/string.h>
+
+/* Replaces the file at path with data, or leaves it untouched.
+ *
+ * The data goes to a temporary file next to the original in a single
+ * write, is flushed to disk and then renamed over the original, so a crash
+ * at any point leaves either the old or the new contents. Safe to call from
+ * any thread. Returns an empty string on success, an error message
+ * otherwise.
+ */
+std::string WriteFileAtomic(const wxString& path, const char* data, size_t length);
+
+// whether the file starts like a gzip stream
+bool IsGzipFile(const wxString& path);
+
+/* Decompresses a gzip file, passing its contents to sink in order.
+ *
+ * Reading and inflating run on a thread of their own, a few chunks ahead
+ * of sink, so the caller consumes text while the next chunk is being
+ * decompressed. Returns an empty string on success, an error message
+ * otherwise.
+ */
+std::string ReadGzipFile(const wxString& path,
+                         const std::function<void(const char* data, size_t length)>& sink);
+
+// gzip stream of data, for saving documents that were loaded compressed
+std::string GzipCompress(const char* data, size_t length);
@@ -0,0 +1,135 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cmath>
+
+#include "arc.h"
+
+// first, second and linear axis of each plane, right-handed
+static const unsigned PLANE_AXES[][3] = { {0, 1, 2}, {2, 0, 1}, {1, 2, 0} };
+
+static const double TWO_PI = 6.283185307179586;
+// past this many chords an arc is more likely a typo than a part
+static const unsigned MAX_CHORDS = 1 << 16;
+
+ArcLinearizer::ArcLinearizer(float tolerance)
+    : tolerance_(tolerance)
+{
+}
+
+void ArcLinearizer::add_(const float* start, const float* end, double ca, double cb,
+                         Plane plane, bool clockwise)
+{
+    auto axes = PLANE_AXES[plane];
+    for (unsigned k = 0; k < 3; ++k)
+    {
+        start_[k].push_back(start[axes[k]]);
+        end_[k].push_back(end[axes[k]]);
+    }
+    center_[0].push_back(ca);
+    center_[1].push_back(cb);
+    planes_.push_back(plane);
+    clockwise_.push_back(clockwise);
+}
+
+void ArcLinearizer::add_center(const float* start, const float* end, const float* offset,
+                               Plane plane, bool clockwise)
+{
+    auto axes = PLANE_AXES[plane];
+    add_(start, end, (double)start[axes[0]] + offset[axes[0]],
+         (double)start[axes[1]] + offset[axes[1]], plane, clockwise);
+}
+
+void ArcLinearizer::add_radius(const float* start, const float* end, float radius,
+                               Plane plane, bool clockwise)
+{
+    auto axes = PLANE_AXES[plane];
+    double x = end[axes[0]] - start[axes[0]];
+    double y = end[axes[1]] - start[axes[1]];
+    double d = std::hypot(x, y);
+
+    // center on the perpendicular bisector of the chord, to the right of
+    // it for G2 with a positive radius
+    double h = 0;
+    if (d > 0)
+    {
+        // a radius too small for the chord makes a half circle
+        h = -std::sqrt(std::max(4.0 * radius * radius - d * d, 0.0)) / d;
+    }
+    if (!clockwise) h = -h;
+    if (radius < 0) h = -h;
+    add_(start, end, start[axes[0]] + 0.5 * (x - y * h),
+         start[axes[1]] + 0.5 * (y + x * h), plane, clockwise);
+}
+
+void ArcLinearizer::prepare()
+{
+    auto count = size();
+    sweep_.resize(count);
+    chords_.resize(count);
+    cos_.resize(count);
+    sin_.resize(count);
+
+    auto sa = start_[0].data(), sb = start_[1].data();
+    auto ea = end_[0].data(), eb = end_[1].data();
+    auto ca = center_[0].data(), cb = center_[1].data();
+    auto cw = clockwise_.data();
+    auto sweep = sweep_.data();
+    double tolerance = tolerance_;
+
+    // keep these loops free of branches so they vectorize
+    for (size_t i = 0; i < count; ++i)
+    {
+        double ra = sa[i] - ca[i], rb = sb[i] - cb[i];
+        double ta = ea[i] - ca[i], tb = eb[i] - cb[i];
+        double angle = std::atan2(ra * tb - rb * ta, ra * ta + rb * tb);
+        // clockwise sweeps are in [-2pi, 0), counterclockwise in (0, 2pi],
+        // so an arc ending where it starts is a full circle
+        double ccw = angle + TWO_PI * (angle <= 1e-9);
+        double clw = angle - TWO_PI * (angle >= -1e-9);
+        sweep[i] = cw[i] * clw + (1 - cw[i]) * ccw;
+
+        double radius = std::sqrt(ra * ra + rb * rb);
+        // never more than half a turn per chord
+        double c = std::max(1 - tolerance / std::max(radius, 1e-9), 0.0);
+        double step = 2 * std::acos(c);
+        double chords = std::ceil(std::abs(sweep[i]) / std::max(step, 1e-9));
+        chords_[i] = (unsigned)std::clamp(chords, 1.0, (double)MAX_CHORDS);
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        double step = sweep[i] / chords_[i];
+        cos_[i] = std::cos(step);
+        sin_[i] = std::sin(step);
+    }
+}
+
+void ArcLinearizer::emit(size_t arc, float* x, float* y, float* z) const
+{
+    float* out[3] = { x, y, z };
+    auto axes = PLANE_AXES[planes_[arc]];
+    auto a = out[axes[0]], b = out[axes[1]], l = out[axes[2]];
+
+    auto n = chords_[arc];
+    double ca = center_[0][arc], cb = center_[1][arc];
+    double ra = start_[0][arc] - ca, rb = start_[1][arc] - cb;
+    double c = cos_[arc], s = sin_[arc];
+    double sl = start_[2][arc];
+    double dl = ((double)end_[2][arc] - sl) / n;
+
+    for (unsigned i = 1; i < n; ++i)
+    {
+        double r = ra * c - rb * s;
+        rb = ra * s + rb * c;
+        ra = r;
+        a[i - 1] = ca + ra;
+        b[i - 1] = cb + rb;
+        l[i - 1] = sl + dl * i;
+    }
+    // land exactly on the programmed end point
+    a[n - 1] = end_[0][arc];
+    b[n - 1] = end_[1][arc];
+    l[n - 1] = end_[2][arc];
+}
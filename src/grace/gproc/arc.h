@@ -0,0 +1,57 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/* Splits G2/G3 arcs into chords that stay within a chordal tolerance.
+ *
+ * Arcs are queued into flat arrays in the coordinates of their plane,
+ * first and second axis plus the linear (helical) one. prepare() then
+ * works out the sweep, radius and chord count of all of them in loops
+ * without branches, so the trig vectorizes across arcs. Chords come from
+ * rotating the radius by a fixed step, one sin/cos pair per arc:
+ *
+ *   sagitta = r * (1 - cos(step / 2)) <= tolerance
+ */
+class ArcLinearizer {
+public:
+    enum Plane {
+        XY,     // G17
+        ZX,     // G18
+        YZ,     // G19
+    };
+    //
+    ArcLinearizer(float tolerance);
+    // center given as an offset from start, like I/J/K
+    void add_center(const float* start, const float* end, const float* offset,
+                    Plane plane, bool clockwise);
+    // negative radius for arcs over half a turn, like R
+    void add_radius(const float* start, const float* end, float radius,
+                    Plane plane, bool clockwise);
+    void prepare();
+    size_t size() const { return planes_.size(); }
+    unsigned chords(size_t arc) const { return chords_[arc]; }
+    // writes the end of every chord, the last one being the end of the arc
+    void emit(size_t arc, float* x, float* y, float* z) const;
+
+private:
+    void add_(const float* start, const float* end, double ca, double cb,
+              Plane plane, bool clockwise);
+
+    float tolerance_;
+    std::vector<uint8_t> planes_;
+    std::vector<float> clockwise_;
+    // start, end and center in plane coordinates
+    std::vector<float> start_[3];
+    std::vector<float> end_[3];
+    std::vector<double> center_[2];
+    // filled in by prepare
+    std::vector<double> sweep_;
+    std::vector<unsigned> chords_;
+    std::vector<double> cos_;
+    std::vector<double> sin_;
+};
@@ -0,0 +1,491 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cmath>
+
+#include "arcfit.h"
+#include "pool.h"
+
+static constexpr double PI = 3.14159265358979323846;
+// longest arc tried, bounds the work per point
+static constexpr size_t MAX_SEGMENTS = 256;
+// segments of a run fitted together, the unit of parallel work
+static constexpr size_t PIECE = 4096;
+// how unevenly filament may be spread along the segments of an arc
+static constexpr double E_TOLERANCE = 0.05;
+// a single segment turning further than this is not part of a curve
+static constexpr double MAX_STEP = PI / 4;
+
+static double round_to(double value, int precision)
+{
+    auto scale = std::pow(10.0, precision);
+    return std::round(value * scale) / scale;
+}
+
+static bool is_motion(float g)
+{
+    return g == 0 || g == 1 || g == 2 || g == 3 || (g >= 80 && g <= 89 && g == std::trunc(g));
+}
+
+// non-modal codes whose axis words are not a move
+static bool takes_axes(float g)
+{
+    return g == 10 || g == 28 || g == 30 || g == 92;
+}
+
+/* */
+
+ArcFitter::ArcFitter(const Program& program, Options options) :
+    program_(program),
+    options_(options)
+{
+    // jumps and loops make the order of the text meaningless
+    if (!program.macros.empty()) return;
+    options_.min_segments = std::max(options_.min_segments, 2u);
+    scan_();
+
+    // long runs are cut into pieces, arcs don't cross them
+    struct Job {
+        const Run* run;
+        size_t first;
+        size_t end;
+    };
+    std::vector<Job> jobs;
+    for (auto& run : runs_)
+    {
+        auto last = run.first_point + (run.end - run.first);
+        for (auto first = run.first_point; first < last; first += PIECE)
+        {
+            jobs.push_back(Job { &run, first, std::min(first + PIECE, last) });
+        }
+    }
+    std::vector<std::vector<Arc>> arcs(jobs.size());
+    std::vector<std::vector<ArcEnd>> ends(jobs.size());
+
+    WorkPool::shared().parallel_for(jobs.size(), [&](size_t j) {
+        fit_(*jobs[j].run, jobs[j].first, jobs[j].end, arcs[j], ends[j]);
+    });
+
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        arcs_.insert(arcs_.end(), arcs[j].begin(), arcs[j].end());
+        ends_.insert(ends_.end(), ends[j].begin(), ends[j].end());
+    }
+}
+
+void ArcFitter::scan_()
+{
+    // starts in G0, G17, G90, G71, G94 with absolute E; the
+    // position is unknown until the program sets it
+    double position[3] = { NAN, NAN, NAN };
+    double e_position = NAN;
+    unsigned motion = 0;
+    bool absolute = true;
+    bool relative_e = false;
+    bool xy_plane = true;
+    bool inverse_time = false;
+    float units = 1;
+    float feed = NAN;
+    bool local = false;
+
+    bool open = false;
+    Run run;
+    auto close = [&]() {
+        if (!open) return;
+        open = false;
+        if (run.end - run.first >= options_.min_segments)
+        {
+            runs_.push_back(run);
+        }
+        else
+        {
+            auto count = run.first_point;
+            x_.resize(count);
+            y_.resize(count);
+            e_.resize(count);
+            e_word_.resize(count);
+        }
+    };
+    auto add_point = [&](double e, double e_word) {
+        x_.push_back(position[0]);
+        y_.push_back(position[1]);
+        e_.push_back(e);
+        e_word_.push_back(e_word);
+    };
+
+    auto& blocks = program_.blocks;
+    for (unsigned i = 0; i < blocks.size(); ++i)
+    {
+        auto& block = blocks[i];
+
+        // what the block does, and whether it is a plain G1 segment
+        bool segment = !block.statement;
+        bool moves = true;
+        bool forget = false;
+        bool sets = false;
+        auto newMotion = motion;
+        std::optional<float> axes[3];
+        std::optional<float> feedWord;
+        std::optional<float> eWord;
+        for (auto& w : block.data_words)
+        {
+            if (w.expression != NO_EXPRESSION) segment = false;
+            switch (w.kind)
+            {
+                case Token::G:
+                {
+                    auto g = w.value;
+                    if (g != 1) segment = false;
+                    if (is_motion(g)) newMotion = (unsigned) g;
+                    else if (g == 17) xy_plane = true;
+                    else if (g == 18 || g == 19) xy_plane = false;
+                    else if (g == 90) absolute = true, relative_e = false;
+                    else if (g == 91) absolute = false, relative_e = true;
+                    else if (g == 93) inverse_time = true;
+                    else if (g == 94 || g == 95) inverse_time = false;
+                    else if (g == 20 || g == 70 || g == 21 || g == 71)
+                    {
+                        float to = g == 20 || g == 70 ? 25.4f : 1;
+                        if (to != units) forget = true;
+                        units = to;
+                    }
+                    else if (g == 92) sets = true;
+                    else if (g == 4 || g == 10) moves = false;
+                    // offsets, compensation, modes that don't move the
+                    // tool elsewhere
+                    else if (!(g == 40 || g == 41 || g == 42 || g == 43 || g == 49 ||
+                               g == 61 || g == 64 || g == 96 || g == 97 || g == 98 || g == 99))
+                    {
+                        // reference returns, machine and work coordinates
+                        forget = true;
+                    }
+                    break;
+                }
+                case Token::X:
+                case Token::Y:
+                case Token::Z:
+                    axes[w.kind - Token::X] = w.value;
+                    break;
+                case Token::F:
+                    feedWord = w.value;
+                    break;
+                case Token::E:
+                    eWord = w.value;
+                    break;
+                case Token::M:
+                    if (w.value == 82) relative_e = false;
+                    else if (w.value == 83) relative_e = true;
+                    segment = false;
+                    break;
+                default:
+                    segment = false;
+                    break;
+            }
+        }
+        motion = newMotion;
+
+        // incremental moves only need where they start from relative to
+        // each other, absolute ones can't go on from there
+        if (!absolute && !forget && !sets)
+        {
+            for (auto& p : position)
+            {
+                if (std::isnan(p)) p = 0, local = true;
+            }
+        }
+        else if (absolute && local && moves && !forget && !sets)
+        {
+            for (unsigned k = 0; k < 3; ++k)
+            {
+                if (!axes[k]) position[k] = NAN;
+            }
+            local = false;
+        }
+        double before[3] = { position[0], position[1], position[2] };
+        double e = 0, e_word = NAN;
+        if (forget)
+        {
+            position[0] = position[1] = position[2] = NAN;
+            local = false;
+        }
+        else if (sets)
+        {
+            for (unsigned k = 0; k < 3; ++k)
+            {
+                if (axes[k]) position[k] = *axes[k];
+            }
+            if (eWord) e_position = *eWord;
+        }
+        else if (moves)
+        {
+            for (unsigned k = 0; k < 3; ++k)
+            {
+                if (axes[k]) position[k] = absolute ? *axes[k] : position[k] + *axes[k];
+            }
+            // cycles come back up to a height of their own
+            if (motion >= 80) position[2] = NAN;
+            if (eWord)
+            {
+                e_word = *eWord;
+                e = relative_e ? e_word : e_word - e_position;
+                e_position = relative_e ? e_position + e_word : e_word;
+            }
+        }
+        auto feedBefore = feed;
+        if (feedWord) feed = *feedWord;
+
+        segment = segment && moves && !forget && !sets && motion == 1 &&
+                  xy_plane && !inverse_time && (axes[0] || axes[1]) &&
+                  !std::isnan(before[0]) && !std::isnan(before[1]) &&
+                  !std::isnan(position[0]) && !std::isnan(position[1]) &&
+                  !std::isnan(e);
+        // a Z word is fine as long as it stays where it is
+        if (axes[2] && position[2] != before[2]) segment = false;
+        if (!segment)
+        {
+            close();
+            continue;
+        }
+
+        // what a merged block would lose can only come with the first one
+        bool first = block.number || !block.comments.empty() ||
+                     (feedWord && *feedWord != feedBefore);
+        if (!open || first || run.absolute != absolute || run.relative_e != relative_e)
+        {
+            close();
+            open = true;
+            run = Run { i, i, x_.size(), options_.tolerance / units,
+                        options_.chord_tolerance / units, absolute, relative_e };
+            x_.push_back(before[0]);
+            y_.push_back(before[1]);
+            e_.push_back(0);
+            e_word_.push_back(NAN);
+        }
+        run.end = i + 1;
+        add_point(e, e_word);
+    }
+    close();
+}
+
+void ArcFitter::fit_(const Run& run, size_t first, size_t end, std::vector<Arc>& arcs,
+                     std::vector<ArcEnd>& ends) const
+{
+    size_t least = options_.min_segments;
+    Arc arc, tried;
+    for (auto a = first; a + least <= end;)
+    {
+        auto limit = std::min(MAX_SEGMENTS, end - a);
+        if (!fits_(run, a, a + least, arc))
+        {
+            ++a;
+            continue;
+        }
+        // double while it fits, then bisect between the last fit and the
+        // first miss
+        size_t good = least, bad = limit + 1;
+        for (auto k = least * 2; k <= limit; k *= 2)
+        {
+            if (!fits_(run, a, a + k, tried))
+            {
+                bad = k;
+                break;
+            }
+            good = k, arc = tried;
+        }
+        if (bad == limit + 1 && good < limit)
+        {
+            if (fits_(run, a, a + limit, tried)) good = limit, arc = tried;
+            else bad = limit;
+        }
+        while (bad - good > 1)
+        {
+            auto k = (good + bad) / 2;
+            if (fits_(run, a, a + k, tried)) good = k, arc = tried;
+            else bad = k;
+        }
+
+        auto b = a + good;
+        arc.first = run.first + unsigned(a - run.first_point);
+        arc.end = run.first + unsigned(b - run.first_point);
+        ArcEnd to;
+        if (run.absolute)
+        {
+            to.position[0] = x_[b];
+            to.position[1] = y_[b];
+        }
+        else
+        {
+            to.position[0] = x_[b] - x_[a];
+            to.position[1] = y_[b] - y_[a];
+        }
+        if (run.relative_e)
+        {
+            double sum = 0;
+            bool any = false;
+            for (auto p = a + 1; p <= b; ++p)
+            {
+                sum += e_[p];
+                any |= !std::isnan(e_word_[p]);
+            }
+            if (any) to.e = sum;
+        }
+        else
+        {
+            for (auto p = b; p > a; --p)
+            {
+                if (!std::isnan(e_word_[p]))
+                {
+                    to.e = e_word_[p];
+                    break;
+                }
+            }
+        }
+        arcs.push_back(arc);
+        ends.push_back(to);
+        a = b;
+    }
+}
+
+bool ArcFitter::fits_(const Run& run, size_t first, size_t end, Arc& arc) const
+{
+    // circle through the first, middle and last point
+    auto mid = (first + end) / 2;
+    double x0 = x_[first], y0 = y_[first];
+    double bx = x_[mid] - x0, by = y_[mid] - y0;
+    double cx = x_[end] - x0, cy = y_[end] - y0;
+    double d = 2 * (bx * cy - by * cx);
+    double chord = std::sqrt(cx * cx + cy * cy);
+    auto tolerance = run.tolerance;
+    // points about on a line are better left to G1
+    if (chord == 0 || std::abs(d) / 2 / chord <= tolerance) return false;
+    double b2 = bx * bx + by * by, c2 = cx * cx + cy * cy;
+    double ux = (cy * b2 - by * c2) / d;
+    double uy = (bx * c2 - cx * b2) / d;
+    double r = std::sqrt(ux * ux + uy * uy);
+    bool clockwise = d < 0;
+
+    auto off = [&](double x, double y) {
+        auto dx = x - x0 - ux, dy = y - y0 - uy;
+        return std::abs(std::sqrt(dx * dx + dy * dy) - r);
+    };
+    double sweep = 0, length = 0, extruded = 0;
+    for (auto p = first; p < end; ++p)
+    {
+        auto ax = x_[p] - x0 - ux, ay = y_[p] - y0 - uy;
+        auto qx = x_[p + 1] - x0 - ux, qy = y_[p + 1] - y0 - uy;
+        if (off(x_[p + 1], y_[p + 1]) > tolerance) return false;
+        if (off((x_[p] + x_[p + 1]) / 2, (y_[p] + y_[p + 1]) / 2) > run.chord_tolerance) return false;
+        // every segment turns the same way, and not too far
+        auto step = std::atan2(ax * qy - ay * qx, ax * qx + ay * qy);
+        if (clockwise) step = -step;
+        if (step <= 0 || step > MAX_STEP) return false;
+        sweep += step;
+        length += std::hypot(qx - ax, qy - ay);
+        extruded += e_[p + 1];
+    }
+    if (sweep >= 2 * PI - 1e-3) return false;
+
+    // the arc spreads E evenly along its length
+    auto rate = length > 0 ? extruded / length : 0;
+    for (auto p = first; p < end; ++p)
+    {
+        auto expected = rate * std::hypot(x_[p + 1] - x_[p], y_[p + 1] - y_[p]);
+        if (std::abs(e_[p + 1] - expected) > E_TOLERANCE * std::abs(expected) + 1e-5) return false;
+    }
+
+    arc.clockwise = clockwise;
+    arc.center[0] = ux;
+    arc.center[1] = uy;
+    arc.radius = r;
+    arc.sweep = sweep;
+    return true;
+}
+
+size_t ArcFitter::blocks_after() const
+{
+    auto count = program_.blocks.size();
+    for (auto& arc : arcs_) count -= arc.end - arc.first - 1;
+    return count;
+}
+
+Program ArcFitter::apply() const
+{
+    auto& blocks = program_.blocks;
+    Program result;
+    result.header = program_.header;
+    result.macros = program_.macros;
+    result.blocks.reserve(blocks_after());
+
+    // blocks after an arc moving in the mode it changed
+    bool restore = false;
+    auto copy = [&](unsigned first, unsigned end) {
+        for (auto i = first; i < end; ++i)
+        {
+            auto& words = blocks[i].data_words;
+            if (!restore || words.empty())
+            {
+                result.blocks.push_back(blocks[i]);
+                continue;
+            }
+            // G90/G91 and the like leave the axes to the modal motion,
+            // G92 and the like use them for themselves
+            bool g = false, axis = false;
+            for (auto& w : words)
+            {
+                if (w.kind == Token::G && is_motion(w.value)) restore = false;
+                g |= w.kind == Token::G && (is_motion(w.value) || takes_axes(w.value));
+                axis |= w.kind >= Token::X && w.kind <= Token::C && w.kind != Token::P &&
+                        w.kind != Token::Q && w.kind != Token::R;
+            }
+            result.blocks.push_back(blocks[i]);
+            if (restore && !g && axis)
+            {
+                auto& added = result.blocks.back().data_words;
+                added.insert(std::find_if(added.begin(), added.end(), [](const Word& w) {
+                    return w.kind > Token::G;
+                }), Word(Token::G, 1));
+                restore = false;
+            }
+        }
+    };
+
+    unsigned next = 0;
+    for (size_t a = 0; a < arcs_.size(); ++a)
+    {
+        auto& arc = arcs_[a];
+        auto& to = ends_[a];
+        copy(next, arc.first);
+        next = arc.end;
+
+        auto& from = blocks[arc.first];
+        Block block;
+        block.number = from.number;
+        block.comments = from.comments;
+        auto& words = block.data_words;
+        words.emplace_back(Token::G, arc.clockwise ? 2.0f : 3.0f);
+        words.emplace_back(Token::X, float(to.position[0]));
+        words.emplace_back(Token::Y, float(to.position[1]));
+        auto half = std::abs(arc.sweep - PI) < 0.1;
+        if (options_.radius && !half)
+        {
+            auto r = round_to(arc.radius, options_.precision);
+            words.emplace_back(Token::R, float(arc.sweep > PI ? -r : r));
+        }
+        else
+        {
+            words.emplace_back(Token::I, float(round_to(arc.center[0], options_.precision)));
+            words.emplace_back(Token::J, float(round_to(arc.center[1], options_.precision)));
+        }
+        if (to.e) words.emplace_back(Token::E, float(*to.e));
+        for (auto& w : from.data_words)
+        {
+            if (w.kind == Token::F) words.push_back(w);
+        }
+        result.blocks.push_back(std::move(block));
+        restore = true;
+    }
+    copy(next, (unsigned) blocks.size());
+    return result;
+}
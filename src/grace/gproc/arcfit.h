@@ -0,0 +1,102 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "types.h"
+
+/* Replaces runs of short G1 moves that lie on a circle with G2/G3 arcs.
+ *
+ * A run is a sequence of G1 blocks in the XY plane (G17) at a constant Z,
+ * with nothing but X, Y, F and E words and the same feed. The first block
+ * of a run may carry a block number, comments or a new feed, which then go
+ * with the arc. Runs are cut into pieces of a few thousand segments that
+ * are fitted in parallel. Within a piece arcs are grown greedily from the
+ * first segment, doubling and then bisecting their length, with at most
+ * MAX_SEGMENTS segments each, so the work stays linear.
+ *
+ * An arc goes through the first, middle and last point of its segments.
+ * It replaces them when every point is within the tolerance of it, the
+ * middle of every segment within the chord tolerance, each segment turns
+ * the same way by at most an eighth of a turn and all of them by less than
+ * a full one, and the filament is spread along it as evenly as it was
+ * along the segments. The segments were chords of a curve to begin with,
+ * so they may stray from it further than their ends. The arc keeps the
+ * feed, the end point and the E position, and the next block moving in
+ * the mode the arc changed gets its G1 back.
+ */
+class ArcFitter {
+public:
+    struct Options {
+        // mm, how far the points may be from the arc
+        float tolerance = 0.01f;
+        // mm, how far the middle of a segment may be from the arc
+        float chord_tolerance = 0.05f;
+        // fewer segments are left as they are
+        unsigned min_segments = 4;
+        // R rather than I/J, except for arcs close to half a turn
+        bool radius = false;
+        // decimals of I, J and R
+        int precision = 4;
+    };
+    struct Arc {
+        // blocks [first, end) become one arc
+        unsigned first;
+        unsigned end;
+        bool clockwise;
+        // center as an offset from the start, like I/J, in program units
+        double center[2];
+        double radius;
+        // radians
+        double sweep;
+    };
+    //
+    ArcFitter(const Program& program) : ArcFitter(program, Options()) { }
+    ArcFitter(const Program& program, Options options);
+    const std::vector<Arc>& arcs() const { return arcs_; }
+    size_t blocks_before() const { return program_.blocks.size(); }
+    size_t blocks_after() const;
+    // the program with the arcs in place of their blocks
+    Program apply() const;
+
+private:
+    // consecutive G1 blocks that could become arcs
+    struct Run {
+        // blocks [first, end), and the points before and after each of them
+        // from points_[first_point]
+        unsigned first;
+        unsigned end;
+        size_t first_point;
+        // in program units
+        float tolerance;
+        float chord_tolerance;
+        bool absolute;
+        bool relative_e;
+    };
+    struct ArcEnd {
+        double position[2];
+        // E word of the arc, absent when no block had one
+        std::optional<double> e;
+    };
+    //
+    void scan_();
+    void fit_(const Run& run, size_t first, size_t end, std::vector<Arc>& arcs,
+              std::vector<ArcEnd>& ends) const;
+    bool fits_(const Run& run, size_t first, size_t end, Arc& arc) const;
+
+    const Program& program_;
+    Options options_;
+    std::vector<Run> runs_;
+    // points of all runs, with the E extruded on the way to each point and
+    // the E word that got there, NaN without one
+    std::vector<double> x_;
+    std::vector<double> y_;
+    std::vector<double> e_;
+    std::vector<double> e_word_;
+    std::vector<Arc> arcs_;
+    std::vector<ArcEnd> ends_;
+};
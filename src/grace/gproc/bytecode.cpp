@@ -0,0 +1,118 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cmath>
+
+#include "bytecode.h"
+#include "footprint.h"
+
+static const double DEGREES = 180 / 3.14159265358979323846;
+
+bool MacroCode::emit(Op op, uint32_t operand/* = 0 */)
+{
+    if (operand > MAX_OPERAND) return false;
+    code_.push_back(op | operand << 8);
+    // track the stack the machine has to provide
+    switch (op)
+    {
+        case Const: case Param:
+            max_depth_ = std::max(max_depth_, ++depth_);
+            break;
+        case Add: case Sub: case Mul: case Div: case Mod:
+        case Eq: case Ne: case Gt: case Ge: case Lt: case Le:
+        case And: case Or: case Xor: case Atan2:
+            --depth_;
+            break;
+        case Return:
+            depth_ = 0;
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+bool MacroCode::emit_const(double value)
+{
+    if (constants_.size() > MAX_OPERAND) return false;
+    // not pooled, a lookup per constant would cost more than the doubles
+    constants_.push_back(value);
+    return emit(Const, (uint32_t) constants_.size() - 1);
+}
+
+/* */
+
+MacroMachine::MacroMachine(const MacroCode& code)
+    : code_(code), parameters_(PARAMETERS, 0.0), stack_(code.depth() + 1)
+{
+}
+
+void MacroMachine::reset()
+{
+    std::fill(parameters_.begin(), parameters_.end(), 0.0);
+}
+
+double MacroMachine::eval(uint32_t expression)
+{
+    auto code = code_.code() + expression;
+    auto constants = code_.constants();
+    auto parameters = parameters_.data();
+    auto top = stack_.data() - 1;
+
+    for (;; ++code)
+    {
+        auto operand = *code >> 8;
+        switch ((MacroCode::Op) (*code & 0xFF))
+        {
+            case MacroCode::Const:  *++top = constants[operand]; break;
+            case MacroCode::Param:  *++top = operand < PARAMETERS ? parameters[operand] : 0; break;
+            case MacroCode::ParamAt:
+                *top = *top >= 0 && *top < PARAMETERS ? parameters[(unsigned) *top] : 0;
+                break;
+
+            case MacroCode::Add:    top[-1] += top[0]; --top; break;
+            case MacroCode::Sub:    top[-1] -= top[0]; --top; break;
+            case MacroCode::Mul:    top[-1] *= top[0]; --top; break;
+            case MacroCode::Div:    top[-1] /= top[0]; --top; break;
+            case MacroCode::Mod:    top[-1] = std::fmod(top[-1], top[0]); --top; break;
+            case MacroCode::Neg:    top[0] = -top[0]; break;
+
+            case MacroCode::Eq:     top[-1] = top[-1] == top[0]; --top; break;
+            case MacroCode::Ne:     top[-1] = top[-1] != top[0]; --top; break;
+            case MacroCode::Gt:     top[-1] = top[-1] > top[0]; --top; break;
+            case MacroCode::Ge:     top[-1] = top[-1] >= top[0]; --top; break;
+            case MacroCode::Lt:     top[-1] = top[-1] < top[0]; --top; break;
+            case MacroCode::Le:     top[-1] = top[-1] <= top[0]; --top; break;
+
+            // bitwise on integers, which is logical on 0 and 1
+            case MacroCode::And:    top[-1] = (double) ((int64_t) top[-1] & (int64_t) top[0]); --top; break;
+            case MacroCode::Or:     top[-1] = (double) ((int64_t) top[-1] | (int64_t) top[0]); --top; break;
+            case MacroCode::Xor:    top[-1] = (double) ((int64_t) top[-1] ^ (int64_t) top[0]); --top; break;
+
+            case MacroCode::Sin:    top[0] = std::sin(top[0] / DEGREES); break;
+            case MacroCode::Cos:    top[0] = std::cos(top[0] / DEGREES); break;
+            case MacroCode::Tan:    top[0] = std::tan(top[0] / DEGREES); break;
+            case MacroCode::Asin:   top[0] = std::asin(top[0]) * DEGREES; break;
+            case MacroCode::Acos:   top[0] = std::acos(top[0]) * DEGREES; break;
+            case MacroCode::Atan:   top[0] = std::atan(top[0]) * DEGREES; break;
+            case MacroCode::Atan2:  top[-1] = std::atan2(top[-1], top[0]) * DEGREES; --top; break;
+            case MacroCode::Sqrt:   top[0] = std::sqrt(top[0]); break;
+            case MacroCode::Abs:    top[0] = std::abs(top[0]); break;
+            case MacroCode::Round:  top[0] = std::round(top[0]); break;
+            // FIX drops the fraction, FUP rounds away from zero
+            case MacroCode::Fix:    top[0] = std::trunc(top[0]); break;
+            case MacroCode::Fup:    top[0] = top[0] < 0 ? std::floor(top[0]) : std::ceil(top[0]); break;
+            case MacroCode::Ln:     top[0] = std::log(top[0]); break;
+            case MacroCode::Exp:    top[0] = std::exp(top[0]); break;
+
+            case MacroCode::Return: return *top;
+        }
+    }
+}
+
+size_t MacroCode::memory_usage() const
+{
+    return Footprint::of(code_) + Footprint::of(constants_);
+}
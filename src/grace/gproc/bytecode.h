@@ -0,0 +1,75 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+constexpr uint32_t NO_EXPRESSION = ~0u;
+
+/* Macro expressions of a program, compiled for a stack machine.
+ *
+ * Each instruction is a single word, the opcode in the low byte and its
+ * operand above it: a constant index for Const, a parameter number for
+ * Param. An expression is the offset of its first instruction and runs up
+ * to Return, so X[#1+2.5] becomes Param 1, Const 2.5, Add, Return.
+ * Angles are in degrees, as on Fanuc controls.
+ */
+class MacroCode {
+public:
+    // largest operand the 24 bits above the opcode hold
+    static constexpr uint32_t MAX_OPERAND = (1u << 24) - 1;
+    //
+    enum Op : uint8_t {
+        Const,
+        Param,
+        // parameter numbered by the top of the stack, ##1 or #[#1+1]
+        ParamAt,
+        Add, Sub, Mul, Div, Mod, Neg,
+        Eq, Ne, Gt, Ge, Lt, Le,
+        And, Or, Xor,
+        Sin, Cos, Tan, Asin, Acos, Atan, Atan2,
+        Sqrt, Abs, Round, Fix, Fup, Ln, Exp,
+        Return,
+    };
+    //
+    bool empty() const { return code_.empty(); }
+    // starts a new expression, returns its offset
+    uint32_t begin() const { return (uint32_t) code_.size(); }
+    // false, and nothing emitted, when the operand exceeds MAX_OPERAND
+    bool emit(Op op, uint32_t operand = 0);
+    bool emit_const(double value);
+    const uint32_t* code() const { return code_.data(); }
+    const double* constants() const { return constants_.data(); }
+    size_t size() const { return code_.size(); }
+    // deepest stack any expression needs
+    unsigned depth() const { return max_depth_; }
+    // heap bytes held, see footprint.h
+    size_t memory_usage() const;
+
+private:
+    std::vector<uint32_t> code_;
+    std::vector<double> constants_;
+    unsigned depth_ = 0;
+    unsigned max_depth_ = 0;
+};
+
+/* Evaluates compiled expressions against a set of # parameters. */
+class MacroMachine {
+public:
+    // #0 up to #9999, local, common and system variables alike
+    static constexpr unsigned PARAMETERS = 10000;
+    //
+    MacroMachine(const MacroCode& code);
+    double eval(uint32_t expression);
+    double get(unsigned number) const { return number < PARAMETERS ? parameters_[number] : 0; }
+    void set(unsigned number, double value) { if (number < PARAMETERS) parameters_[number] = value; }
+    void reset();
+
+private:
+    const MacroCode& code_;
+    std::vector<double> parameters_;
+    std::vector<double> stack_;
+};
@@ -0,0 +1,205 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "calls.h"
+#include "footprint.h"
+
+static const Word* find_word(const Block& block, Token::Type kind)
+{
+    for (auto& word : block.data_words)
+    {
+        if (word.kind == kind) return &word;
+    }
+    return nullptr;
+}
+
+static bool has_code(const Block& block, Token::Type kind, float value)
+{
+    for (auto& word : block.data_words)
+    {
+        if (word.kind == kind && word.value == value) return true;
+    }
+    return false;
+}
+
+/* */
+
+CallGraph::CallGraph(const Program& program, Dialect::Kind dialect)
+{
+    auto& blocks = program.blocks;
+    units_.push_back(Unit { 0, 0, NONE, 0, 0, 0 });
+    bool main_started = false;
+
+    for (unsigned i = 0; i < blocks.size(); ++i)
+    {
+        auto& block = blocks[i];
+        if (block.data_words.empty()) continue;
+
+        if (auto o = find_word(block, Token::O))
+        {
+            if (!main_started)
+            {
+                // the main program's own number
+                units_[0].number = (unsigned) o->value;
+            }
+            else
+            {
+                units_.back().last = i;
+                if (units_.back().end == NONE) units_.back().end = i;
+                units_.push_back(Unit { (unsigned) o->value, i, NONE, 0, (unsigned) calls_.size(), 0 });
+            }
+        }
+        main_started = true;
+
+        if (has_code(block, Token::M, 98)) add_call_(block, i, dialect);
+
+        auto& unit = units_.back();
+        bool main = units_.size() == 1;
+        if (unit.end == NONE &&
+            (has_code(block, Token::M, 99) ||
+             (main && (has_code(block, Token::M, 2) || has_code(block, Token::M, 30)))))
+        {
+            unit.end = i + 1;
+        }
+    }
+    units_.back().last = blocks.size();
+    if (units_.back().end == NONE) units_.back().end = blocks.size();
+
+    link_();
+    sort_();
+
+    // callers come before their callees going backwards
+    executions_.assign(units_.size(), 0);
+    executions_[0] = 1;
+    for (auto it = order_.rbegin(); it != order_.rend(); ++it)
+    {
+        auto& unit = units_[*it];
+        for (unsigned c = unit.first_call; c < unit.first_call + unit.call_count; ++c)
+        {
+            auto& call = calls_[c];
+            if (call.callee == NONE || call.recursive || call.block >= unit.end) continue;
+            executions_[call.callee] += executions_[*it] * call.repeat;
+        }
+    }
+}
+
+void CallGraph::add_call_(const Block& block, unsigned index, Dialect::Kind dialect)
+{
+    auto p = find_word(block, Token::P);
+    if (!p)
+    {
+        problems_.push_back(Problem { index, "M98 without P" });
+        return;
+    }
+    auto l = find_word(block, Token::L);
+    auto number = (unsigned) p->value;
+    auto repeat = l ? (unsigned) l->value : 1u;
+    if (dialect == Dialect::Fanuc && !l && number > 9999 && number <= 99999999)
+    {
+        // P<repeat><4-digit number>, leading zeros of the repeat left out
+        repeat = number / 10000;
+        number %= 10000;
+    }
+    calls_.push_back(Call { index, (unsigned) units_.size() - 1, NONE, number, repeat, false });
+    ++units_.back().call_count;
+}
+
+void CallGraph::link_()
+{
+    std::unordered_map<unsigned, unsigned> numbers;
+    for (unsigned u = 0; u < units_.size(); ++u)
+    {
+        if (!numbers.emplace(units_[u].number, u).second)
+        {
+            problems_.push_back(Problem {
+                units_[u].first, "O" + std::to_string(units_[u].number) + " is defined twice" });
+        }
+    }
+    for (auto& call : calls_)
+    {
+        auto it = numbers.find(call.number);
+        if (it == numbers.end())
+        {
+            problems_.push_back(Problem {
+                call.block, "O" + std::to_string(call.number) + " is called but not defined" });
+            continue;
+        }
+        call.callee = it->second;
+    }
+}
+
+void CallGraph::sort_()
+{
+    // iterative depth first search, a call to a unit still on the stack recurses
+    enum State : uint8_t { New, Active, Done };
+    std::vector<State> state(units_.size(), New);
+    std::vector<std::pair<unsigned, unsigned>> stack;
+    order_.reserve(units_.size());
+
+    for (unsigned root = 0; root < units_.size(); ++root)
+    {
+        if (state[root] != New) continue;
+        state[root] = Active;
+        stack.emplace_back(root, units_[root].first_call);
+        while (!stack.empty())
+        {
+            auto& top = stack.back();
+            auto& unit = units_[top.first];
+            if (top.second == unit.first_call + unit.call_count)
+            {
+                state[top.first] = Done;
+                order_.push_back(top.first);
+                stack.pop_back();
+                continue;
+            }
+            auto& call = calls_[top.second++];
+            if (call.callee == NONE) continue;
+            if (state[call.callee] == Active)
+            {
+                call.recursive = true;
+                problems_.push_back(Problem {
+                    call.block, "Call to O" + std::to_string(call.number) + " recurses" });
+            }
+            else if (state[call.callee] == New)
+            {
+                state[call.callee] = Active;
+                stack.emplace_back(call.callee, units_[call.callee].first_call);
+            }
+        }
+    }
+    std::sort(problems_.begin(), problems_.end(),
+              [](const Problem& a, const Problem& b) { return a.block < b.block; });
+}
+
+unsigned CallGraph::unit_of(unsigned block) const
+{
+    auto it = std::upper_bound(units_.begin() + 1, units_.end(), block,
+                               [](unsigned b, const Unit& unit) { return b < unit.first; });
+    return (unsigned) (it - units_.begin()) - 1;
+}
+
+uint64_t CallGraph::block_executions(unsigned block) const
+{
+    auto unit = unit_of(block);
+    return block < units_[unit].end ? executions_[unit] : 0;
+}
+
+uint64_t CallGraph::executed_blocks() const
+{
+    auto sizes = summarize<uint64_t>(
+        [](uint64_t& size, unsigned) { ++size; },
+        [](uint64_t& size, const uint64_t& callee, unsigned repeat) { size += callee * repeat; });
+    return sizes[0];
+}
+
+size_t CallGraph::memory_usage() const
+{
+    auto bytes = Footprint::of(units_) + Footprint::of(calls_) + Footprint::of(problems_) +
+                 Footprint::of(order_) + Footprint::of(executions_);
+    for (auto& problem : problems_) bytes += Footprint::of(problem.message);
+    return bytes;
+}
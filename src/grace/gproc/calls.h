@@ -0,0 +1,112 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dialect.h"
+#include "types.h"
+
+/* Subprograms of a program and the M98 calls between them.
+ *
+ * Every block with an O word starts a subprogram that runs up to its M99,
+ * blocks before the first one (or the first O block itself) are the main
+ * program, which ends at M02/M30. M98 P<n> L<repeat> calls O<n>. On Fanuc
+ * a P with more than four digits holds the repeat count in front of a four
+ * digit program number (P<rrrr><nnnn>), other controls such as Haas take
+ * longer program numbers.
+ *
+ * Nothing is expanded. Units are sorted callees first, so analyses can
+ * summarize each subprogram a single time and reuse the result for every
+ * call (see summarize), or weigh blocks by how often they run (see
+ * executions). Calls that would recurse are flagged and left out of both.
+ */
+class CallGraph {
+public:
+    static constexpr unsigned NONE = ~0u;
+    struct Unit {
+        // O number, 0 for a main program without one
+        unsigned number;
+        // blocks [first, end) run when the unit is called, up to last are its text
+        unsigned first;
+        unsigned end;
+        unsigned last;
+        // calls made by the unit are calls()[first_call .. first_call + call_count)
+        unsigned first_call;
+        unsigned call_count;
+    };
+    struct Call {
+        unsigned block;
+        unsigned caller;
+        // unit called, NONE when no subprogram has the number
+        unsigned callee;
+        unsigned number;
+        unsigned repeat;
+        // part of a cycle, never followed
+        bool recursive;
+    };
+    struct Problem {
+        unsigned block;
+        std::string message;
+    };
+    //
+    CallGraph(const Program& program, Dialect::Kind dialect);
+    // unit 0 is the main program
+    const std::vector<Unit>& units() const { return units_; }
+    const std::vector<Call>& calls() const { return calls_; }
+    const std::vector<Problem>& problems() const { return problems_; }
+    // unit whose text holds the block
+    unsigned unit_of(unsigned block) const;
+    // how often the blocks of a unit run for one run of the main program
+    uint64_t executions(unsigned unit) const { return executions_[unit]; }
+    // how often a block runs, zero past the end of its unit
+    uint64_t block_executions(unsigned block) const;
+    // blocks run for one run of the main program, calls expanded
+    uint64_t executed_blocks() const;
+    size_t memory_usage() const;
+
+    /* Computes a summary per unit, callees before their callers.
+     *
+     * block(summary, index) adds a block of the unit, call(summary, callee,
+     * repeat) adds the finished summary of a callee for a call repeated
+     * that often. Summaries are default constructed.
+     */
+    template <typename Summary, typename BlockFn, typename CallFn>
+    std::vector<Summary> summarize(BlockFn block, CallFn call) const
+    {
+        std::vector<Summary> summaries(units_.size());
+        for (auto u : order_)
+        {
+            auto& unit = units_[u];
+            auto& summary = summaries[u];
+            auto c = unit.first_call, calls_end = c + unit.call_count;
+            for (unsigned b = unit.first; b < unit.end; ++b)
+            {
+                block(summary, b);
+                for (; c < calls_end && calls_[c].block == b; ++c)
+                {
+                    auto& target = calls_[c];
+                    if (target.callee == NONE || target.recursive) continue;
+                    call(summary, (const Summary&) summaries[target.callee], target.repeat);
+                }
+            }
+        }
+        return summaries;
+    }
+
+private:
+    void add_call_(const Block& block, unsigned index, Dialect::Kind dialect);
+    void link_();
+    void sort_();
+
+    std::vector<Unit> units_;
+    std::vector<Call> calls_;
+    std::vector<Problem> problems_;
+    // callees before callers
+    std::vector<unsigned> order_;
+    std::vector<uint64_t> executions_;
+};
@@ -0,0 +1,277 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <new>
+#include <numeric>
+
+#include "capi.h"
+#include "footprint.h"
+#include "lexer.h"
+#include "parser.h"
+
+static_assert(GPROC_DIALECT_MARLIN == (int) Dialect::Marlin, "dialects out of sync");
+
+struct gproc_parser {
+    Dialect::Kind dialect;
+    // last text, widened for the lexer
+    std::wstring text;
+    // byte offset of every character and of the end, empty for ASCII text
+    std::vector<uint32_t> offsets;
+    bool parsed = false;
+    Program program;
+
+    std::vector<gproc_block> blocks;
+    std::vector<gproc_word> words;
+    std::vector<gproc_token> tokens;
+    std::vector<gproc_speed> speeds;
+    std::vector<gproc_diagnostic> diagnostics;
+    std::string message;
+};
+
+static void append_char(gproc_parser* parser, uint32_t c, uint32_t offset)
+{
+    if (sizeof(wchar_t) == 2 && c > 0xFFFF)
+    {
+        c -= 0x10000;
+        parser->text.push_back((wchar_t)(0xD800 + (c >> 10)));
+        parser->text.push_back((wchar_t)(0xDC00 + (c & 0x3FF)));
+        parser->offsets.push_back(offset);
+        parser->offsets.push_back(offset);
+        return;
+    }
+    parser->text.push_back((wchar_t) c);
+    parser->offsets.push_back(offset);
+}
+
+/* Decodes UTF-8 into the parser's buffer, invalid bytes become U+FFFD. */
+static void widen(gproc_parser* parser, const char* text, size_t length)
+{
+    auto bytes = (const unsigned char*) text;
+    parser->offsets.clear();
+
+    // G-code is nearly always ASCII, where characters and bytes are one
+    size_t i = 0;
+    while (i < length && bytes[i] < 0x80) ++i;
+    parser->text.assign(text, text + i);
+    if (i == length) return;
+
+    parser->offsets.resize(i);
+    std::iota(parser->offsets.begin(), parser->offsets.end(), 0);
+    while (i < length)
+    {
+        auto start = (uint32_t) i;
+        uint32_t c = bytes[i++];
+        unsigned follow = 0;
+        if (c < 0x80) follow = 0;
+        else if (c < 0xC0) c = 0xFFFD;
+        else if (c < 0xE0) c &= 0x1F, follow = 1;
+        else if (c < 0xF0) c &= 0x0F, follow = 2;
+        else if (c < 0xF8) c &= 0x07, follow = 3;
+        else c = 0xFFFD;
+        for (; follow; --follow)
+        {
+            if (i == length || (bytes[i] & 0xC0) != 0x80)
+            {
+                c = 0xFFFD;
+                break;
+            }
+            c = (c << 6) | (bytes[i++] & 0x3F);
+        }
+        append_char(parser, c, start);
+    }
+    parser->offsets.push_back((uint32_t) length);
+}
+
+static gproc_span to_span(const gproc_parser* parser, unsigned start, unsigned length)
+{
+    if (parser->offsets.empty()) return { start, length };
+    auto last = (unsigned) parser->offsets.size() - 1;
+    auto end = std::min(start + length, last);
+    start = std::min(start, last);
+    return { parser->offsets[start], parser->offsets[end] - parser->offsets[start] };
+}
+
+static int32_t token_type(Token::Type type)
+{
+    switch (type)
+    {
+        case Token::Comment:        return GPROC_TOKEN_COMMENT;
+        case Token::Number:         return GPROC_TOKEN_NUMBER;
+        case Token::Hash:           return GPROC_TOKEN_HASH;
+        case Token::LeftBracket:    return GPROC_TOKEN_LEFT_BRACKET;
+        case Token::RightBracket:   return GPROC_TOKEN_RIGHT_BRACKET;
+        case Token::Operator:       return GPROC_TOKEN_OPERATOR;
+        case Token::Keyword:        return GPROC_TOKEN_KEYWORD;
+        case Token::AlignmentChar:  return GPROC_TOKEN_ALIGNMENT;
+        case Token::Equal:          return GPROC_TOKEN_EQUAL;
+        case Token::OptBlockSkip:   return GPROC_TOKEN_BLOCK_SKIP;
+        case Token::Percent:        return GPROC_TOKEN_PERCENT;
+        case Token::EndOfBlock:     return GPROC_TOKEN_END_OF_BLOCK;
+        case Token::Unknown:        return GPROC_TOKEN_UNKNOWN;
+        default:                    return TokenType_ToString(type)[0];
+    }
+}
+
+static void reset(gproc_parser* parser)
+{
+    parser->blocks.clear();
+    parser->words.clear();
+    parser->tokens.clear();
+    parser->speeds.clear();
+    parser->diagnostics.clear();
+}
+
+/* Runs fn, turning exceptions into status codes, none may cross into C. */
+template <typename Fn>
+static gproc_status guarded(gproc_parser* parser, Fn fn)
+{
+    try {
+        return fn();
+    }
+    catch (PosException& e)
+    {
+        parser->message = e.what();
+        parser->diagnostics.push_back(gproc_diagnostic {
+            to_span(parser, e.position(), e.length()), parser->message.c_str() });
+        return GPROC_SYNTAX_ERROR;
+    }
+    catch (std::bad_alloc&)
+    {
+        return GPROC_OUT_OF_MEMORY;
+    }
+    catch (...)
+    {
+        return GPROC_INTERNAL_ERROR;
+    }
+}
+
+template <typename T>
+static const T* result(const std::vector<T>& values, size_t* count)
+{
+    if (count) *count = values.size();
+    return values.empty() ? nullptr : values.data();
+}
+
+/* */
+
+uint32_t gproc_version(void)
+{
+    return GPROC_API_VERSION;
+}
+
+gproc_parser* gproc_parser_new(gproc_dialect dialect)
+{
+    if (dialect < GPROC_DIALECT_RS274 || dialect > GPROC_DIALECT_MARLIN) return nullptr;
+    auto parser = new (std::nothrow) gproc_parser;
+    if (parser) parser->dialect = (Dialect::Kind) dialect;
+    return parser;
+}
+
+void gproc_parser_free(gproc_parser* parser)
+{
+    delete parser;
+}
+
+gproc_status gproc_parse(gproc_parser* parser, const char* text, size_t length)
+{
+    if (!parser || (!text && length) || length > UINT32_MAX) return GPROC_INVALID_ARGUMENT;
+    reset(parser);
+    parser->parsed = false;
+    parser->program.blocks.clear();
+
+    return guarded(parser, [&]() {
+        widen(parser, text, length);
+        parser->program = parse_program(parser->dialect, parser->text);
+        parser->parsed = true;
+
+        auto& blocks = parser->program.blocks;
+        parser->blocks.reserve(blocks.size());
+        for (auto& block : blocks)
+        {
+            parser->blocks.push_back(gproc_block {
+                to_span(parser, block.start, block.length),
+                block.number ? (int64_t) block.number->value : -1,
+                (uint32_t) parser->words.size(),
+                (uint32_t) block.data_words.size(),
+                (uint32_t) block.comments.size() });
+            for (auto& word : block.data_words)
+            {
+                parser->words.push_back(gproc_word {
+                    to_span(parser, word.start, word.length),
+                    TokenType_ToString(word.kind)[0], word.value });
+            }
+        }
+        return GPROC_OK;
+    });
+}
+
+gproc_status gproc_tokenize(gproc_parser* parser, const char* text, size_t length)
+{
+    if (!parser || (!text && length) || length > UINT32_MAX) return GPROC_INVALID_ARGUMENT;
+    reset(parser);
+
+    return guarded(parser, [&]() {
+        widen(parser, text, length);
+        Lexer lexer(parser->text, Dialect::grammar_of(parser->dialect).macros);
+        for (auto token = lexer.next(); token.type != Token::EndOfFile; token = lexer.next())
+        {
+            parser->tokens.push_back(gproc_token {
+                to_span(parser, token.start, token.length), token_type(token.type) });
+        }
+        return GPROC_OK;
+    });
+}
+
+gproc_status gproc_check_speeds(gproc_parser* parser, const gproc_speed_reference* reference)
+{
+    if (!parser || !reference || !parser->parsed) return GPROC_INVALID_ARGUMENT;
+    parser->speeds.clear();
+
+    return guarded(parser, [&]() {
+        SpeedVisitor visitor({ reference->cutting_speed_lo, reference->cutting_speed_hi,
+                               reference->tool_diameter });
+        parser->program.accept(&visitor);
+        for (auto& record : visitor.records())
+        {
+            parser->speeds.push_back(gproc_speed {
+                record.block, record.value, record.calculatedValueLo, record.calculatedValueHi });
+        }
+        return GPROC_OK;
+    });
+}
+
+const gproc_block* gproc_blocks(const gproc_parser* parser, size_t* count)
+{
+    return result(parser->blocks, count);
+}
+
+const gproc_word* gproc_words(const gproc_parser* parser, size_t* count)
+{
+    return result(parser->words, count);
+}
+
+const gproc_token* gproc_tokens(const gproc_parser* parser, size_t* count)
+{
+    return result(parser->tokens, count);
+}
+
+const gproc_speed* gproc_speeds(const gproc_parser* parser, size_t* count)
+{
+    return result(parser->speeds, count);
+}
+
+const gproc_diagnostic* gproc_diagnostics(const gproc_parser* parser, size_t* count)
+{
+    return result(parser->diagnostics, count);
+}
+
+size_t gproc_memory_usage(const gproc_parser* parser)
+{
+    auto& p = *parser;
+    return sizeof(gproc_parser) + Footprint::of(p.text) + Footprint::of(p.offsets) +
+           Footprint::of(p.program.blocks) + p.program.macros.memory_usage() +
+           Footprint::of(p.blocks) + Footprint::of(p.words) + Footprint::of(p.tokens) +
+           Footprint::of(p.speeds) + Footprint::of(p.diagnostics) + Footprint::of(p.message);
+}
@@ -0,0 +1,166 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+/* C interface of the G-code parser, for embedding it in other programs.
+ *
+ * A gproc_parser holds the result of its last call: blocks, words, tokens
+ * and diagnostics are flat arrays owned by the parser, valid until the
+ * next call on it or until it is freed. Parsers keep their buffers between
+ * calls, so reusing one for many programs saves most of the allocations.
+ *
+ * Text is UTF-8 owned by the caller and only read during the call. Spans
+ * are byte offsets into it. A parser must be used by one thread at a time;
+ * separate parsers can be used from any number of threads at once.
+ *
+ * Only additions are made to this interface, and the structs below only
+ * grow at the end.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#  if defined(GPROC_BUILD_SHARED)
+#    define GPROC_API __declspec(dllexport)
+#  elif defined(GPROC_USE_SHARED)
+#    define GPROC_API __declspec(dllimport)
+#  else
+#    define GPROC_API
+#  endif
+#else
+#  define GPROC_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GPROC_API_VERSION 2
+
+typedef enum gproc_status {
+    GPROC_OK = 0,
+    // the text has errors, see gproc_diagnostics
+    GPROC_SYNTAX_ERROR = 1,
+    GPROC_INVALID_ARGUMENT = 2,
+    GPROC_OUT_OF_MEMORY = 3,
+    GPROC_INTERNAL_ERROR = 4,
+} gproc_status;
+
+typedef enum gproc_dialect {
+    GPROC_DIALECT_RS274 = 0,
+    GPROC_DIALECT_FANUC = 1,
+    GPROC_DIALECT_HAAS = 2,
+    GPROC_DIALECT_LINUXCNC = 3,
+    GPROC_DIALECT_MARLIN = 4,
+} gproc_dialect;
+
+typedef enum gproc_token_type {
+    // address letters are given as the letter itself, e.g. 'G'
+    GPROC_TOKEN_COMMENT = 1,
+    GPROC_TOKEN_NUMBER = 2,
+    // ':'
+    GPROC_TOKEN_ALIGNMENT = 3,
+    GPROC_TOKEN_EQUAL = 4,
+    // '/'
+    GPROC_TOKEN_BLOCK_SKIP = 5,
+    GPROC_TOKEN_PERCENT = 6,
+    GPROC_TOKEN_END_OF_BLOCK = 7,
+    GPROC_TOKEN_UNKNOWN = 8,
+    // macro expressions
+    GPROC_TOKEN_HASH = 9,
+    GPROC_TOKEN_LEFT_BRACKET = 10,
+    GPROC_TOKEN_RIGHT_BRACKET = 11,
+    GPROC_TOKEN_OPERATOR = 12,
+    GPROC_TOKEN_KEYWORD = 13,
+} gproc_token_type;
+
+typedef struct gproc_span {
+    uint32_t start;
+    uint32_t length;
+} gproc_span;
+
+typedef struct gproc_token {
+    gproc_span span;
+    // a gproc_token_type or an address letter
+    int32_t type;
+} gproc_token;
+
+typedef struct gproc_word {
+    // span of the value, the letter is right before it
+    gproc_span span;
+    char letter;
+    float value;
+} gproc_word;
+
+typedef struct gproc_block {
+    // span of the block, not including the end of block
+    gproc_span span;
+    // N number, or -1 when the block has none
+    int64_t number;
+    // words of the block are words[first_word .. first_word + word_count)
+    uint32_t first_word;
+    uint32_t word_count;
+    uint32_t comment_count;
+} gproc_block;
+
+typedef struct gproc_diagnostic {
+    gproc_span span;
+    // UTF-8, owned by the parser
+    const char* message;
+} gproc_diagnostic;
+
+typedef struct gproc_speed_reference {
+    // cutting speed range of the material, m/min
+    float cutting_speed_lo;
+    float cutting_speed_hi;
+    // mm
+    float tool_diameter;
+} gproc_speed_reference;
+
+typedef struct gproc_speed {
+    uint32_t block;
+    float value;
+    // spindle speed range for the material and tool
+    float lo;
+    float hi;
+} gproc_speed;
+
+typedef struct gproc_parser gproc_parser;
+
+// GPROC_API_VERSION of the library, which may be newer than the header
+GPROC_API uint32_t gproc_version(void);
+
+// NULL when out of memory or the dialect is unknown
+GPROC_API gproc_parser* gproc_parser_new(gproc_dialect dialect);
+GPROC_API void gproc_parser_free(gproc_parser* parser);
+
+/* Parses a program into blocks and words.
+ *
+ * On GPROC_SYNTAX_ERROR the diagnostics say where, and no blocks are
+ * kept.
+ */
+GPROC_API gproc_status gproc_parse(gproc_parser* parser, const char* text, size_t length);
+
+/* Splits text into tokens, without checking the grammar. */
+GPROC_API gproc_status gproc_tokenize(gproc_parser* parser, const char* text, size_t length);
+
+/* Spindle speeds of the last parsed program checked against a material,
+ * see SpeedVisitor. */
+GPROC_API gproc_status gproc_check_speeds(gproc_parser* parser, const gproc_speed_reference* reference);
+
+// results of the last call, count is set to the number of elements
+GPROC_API const gproc_block* gproc_blocks(const gproc_parser* parser, size_t* count);
+GPROC_API const gproc_word* gproc_words(const gproc_parser* parser, size_t* count);
+GPROC_API const gproc_token* gproc_tokens(const gproc_parser* parser, size_t* count);
+GPROC_API const gproc_speed* gproc_speeds(const gproc_parser* parser, size_t* count);
+GPROC_API const gproc_diagnostic* gproc_diagnostics(const gproc_parser* parser, size_t* count);
+
+// heap bytes the parser keeps between calls, since version 2
+GPROC_API size_t gproc_memory_usage(const gproc_parser* parser);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,274 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <tuple>
+
+#include "collision.h"
+
+// segments per leaf box
+static constexpr unsigned LEAF = 32;
+
+// true when the segment runs through the inside of the box, touching its
+// faces doesn't count
+static bool segment_in_box(const float* p, const float* q, const float* lo, const float* hi)
+{
+    float t0 = 0, t1 = 1;
+    for (unsigned k = 0; k < 3; ++k)
+    {
+        auto d = q[k] - p[k];
+        if (d == 0)
+        {
+            if (p[k] <= lo[k] || p[k] >= hi[k]) return false;
+            continue;
+        }
+        auto a = (lo[k] - p[k]) / d, b = (hi[k] - p[k]) / d;
+        if (a > b) std::swap(a, b);
+        t0 = std::max(t0, a);
+        t1 = std::min(t1, b);
+        if (t0 >= t1) return false;
+    }
+    return true;
+}
+
+bool CollisionCheck::Setup::parse(const std::string& text, std::string* error)
+{
+    *this = Setup();
+    std::istringstream lines(text);
+    std::string line;
+    for (unsigned n = 1; std::getline(lines, line); ++n)
+    {
+        std::istringstream in(line);
+        std::vector<std::string> fields;
+        for (std::string field; in >> field;) fields.push_back(field);
+        if (fields.empty() || fields[0][0] == ';') continue;
+
+        // trailing numbers, the name is what comes before them
+        std::vector<float> numbers;
+        while (numbers.size() < fields.size())
+        {
+            auto& field = fields[fields.size() - 1 - numbers.size()];
+            char* end;
+            auto value = std::strtof(field.c_str(), &end);
+            if (*end) break;
+            numbers.insert(numbers.begin(), value);
+        }
+        std::string name;
+        for (size_t i = 0; i < fields.size() - numbers.size(); ++i)
+        {
+            name += (i ? " " : "") + fields[i];
+        }
+
+        if (name == "tool" && numbers.size() == 1 && numbers[0] >= 0)
+        {
+            tool_radius = numbers[0];
+            continue;
+        }
+        if (name == "origin" && numbers.size() == 3)
+        {
+            std::copy(numbers.begin(), numbers.end(), origin);
+            continue;
+        }
+        if (!name.empty() && numbers.size() == 6)
+        {
+            Box box;
+            for (unsigned k = 0; k < 3; ++k)
+            {
+                box.min[k] = std::min(numbers[k], numbers[k + 3]);
+                box.max[k] = std::max(numbers[k], numbers[k + 3]);
+            }
+            if (name == "travel") travel = box;
+            else fixtures.push_back(Fixture { name, box });
+            continue;
+        }
+        if (error)
+        {
+            *error = "Line " + std::to_string(n) +
+                ": expected 'travel', 'origin', 'tool' or a fixture name followed by its numbers";
+        }
+        return false;
+    }
+    return true;
+}
+
+/* */
+
+CollisionCheck::CollisionCheck(const Toolpath& toolpath) :
+    toolpath_(toolpath)
+{
+    auto segments = toolpath.size();
+    if (!segments) return;
+
+    // leaves bound the vertices of their segments, the last one shared with
+    // the next leaf
+    Level leaves;
+    auto count = (segments + LEAF - 1) / LEAF;
+    for (unsigned k = 0; k < 3; ++k)
+    {
+        auto& axis = toolpath.axis(k);
+        leaves.min[k].resize(count);
+        leaves.max[k].resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto first = axis.begin() + i * LEAF;
+            auto last = axis.begin() + std::min((i + 1) * LEAF, segments) + 1;
+            auto range = std::minmax_element(first, last);
+            leaves.min[k][i] = *range.first;
+            leaves.max[k][i] = *range.second;
+        }
+    }
+    levels_.push_back(std::move(leaves));
+
+    while (levels_.back().min[0].size() > 1)
+    {
+        auto& below = levels_.back();
+        auto size = below.min[0].size();
+        Level level;
+        for (unsigned k = 0; k < 3; ++k)
+        {
+            level.min[k].resize((size + 1) / 2);
+            level.max[k].resize((size + 1) / 2);
+            for (size_t i = 0; i < size; i += 2)
+            {
+                auto j = std::min(i + 1, size - 1);
+                level.min[k][i / 2] = std::min(below.min[k][i], below.min[k][j]);
+                level.max[k][i / 2] = std::max(below.max[k][i], below.max[k][j]);
+            }
+        }
+        levels_.push_back(std::move(level));
+    }
+}
+
+// descend(min, max) tells whether a box may hold anything, leaf(first, end)
+// gets the segments of leaves reached, in order
+template <typename Descend, typename Leaf>
+void CollisionCheck::query_(Descend descend, Leaf leaf) const
+{
+    if (levels_.empty()) return;
+    std::vector<std::pair<unsigned, size_t>> stack;
+    stack.emplace_back((unsigned) levels_.size() - 1, 0);
+    while (!stack.empty())
+    {
+        auto [l, i] = stack.back();
+        stack.pop_back();
+        auto& level = levels_[l];
+        float lo[3] = { level.min[0][i], level.min[1][i], level.min[2][i] };
+        float hi[3] = { level.max[0][i], level.max[1][i], level.max[2][i] };
+        if (!descend(lo, hi)) continue;
+        if (l == 0)
+        {
+            leaf(i * LEAF, std::min((i + 1) * LEAF, toolpath_.size()));
+            continue;
+        }
+        // right child first so the left one is taken next
+        auto children = levels_[l - 1].min[0].size();
+        if (2 * i + 1 < children) stack.emplace_back(l - 1, 2 * i + 1);
+        stack.emplace_back(l - 1, 2 * i);
+    }
+}
+
+std::vector<CollisionCheck::Hit> CollisionCheck::run(const Setup& setup) const
+{
+    std::vector<Hit> hits;
+    auto& blocks = toolpath_.blocks();
+    auto& motions = toolpath_.motions();
+    auto add = [&](Hit::Kind kind, size_t segment, unsigned what)
+    {
+        hits.push_back(Hit { kind, (Toolpath::Motion) motions[segment],
+                             blocks[segment], (unsigned) segment, what });
+    };
+    const float* axes[3] = {
+        toolpath_.axis(0).data(), toolpath_.axis(1).data(), toolpath_.axis(2).data() };
+
+    // the toolpath is in program coordinates, so is the travel from here on
+    auto travel = setup.travel;
+    for (unsigned k = 0; k < 3; ++k)
+    {
+        travel.min[k] -= setup.origin[k];
+        travel.max[k] -= setup.origin[k];
+    }
+
+    // most programs stay well inside the travel, which the bounds tell at once
+    bool inside = true;
+    for (unsigned k = 0; k < 3 && toolpath_.size(); ++k)
+    {
+        if (toolpath_.min(k) < travel.min[k] || toolpath_.max(k) > travel.max[k]) inside = false;
+    }
+    if (!inside)
+    {
+        query_(
+            [&](const float* lo, const float* hi)
+            {
+                for (unsigned k = 0; k < 3; ++k)
+                {
+                    if (lo[k] < travel.min[k] || hi[k] > travel.max[k]) return true;
+                }
+                return false;
+            },
+            [&](size_t first, size_t end)
+            {
+                // a segment is out when it ends out
+                for (auto s = first; s < end; ++s)
+                {
+                    for (unsigned k = 0; k < 3; ++k)
+                    {
+                        auto v = axes[k][s + 1];
+                        if (v < travel.min[k] || v > travel.max[k])
+                        {
+                            add(Hit::Travel, s, k);
+                            break;
+                        }
+                    }
+                }
+            });
+    }
+
+    for (unsigned f = 0; f < setup.fixtures.size(); ++f)
+    {
+        // the toolpath follows the tool tip: the tool reaches the radius
+        // around it and its shank everything above, so a tip anywhere below
+        // the top of the fixture within that reach runs into it
+        auto box = setup.fixtures[f].box;
+        for (unsigned k = 0; k < 2; ++k)
+        {
+            box.min[k] -= setup.tool_radius;
+            box.max[k] += setup.tool_radius;
+        }
+        box.min[2] = -1e30f;
+        query_(
+            [&](const float* lo, const float* hi)
+            {
+                for (unsigned k = 0; k < 3; ++k)
+                {
+                    if (hi[k] <= box.min[k] || lo[k] >= box.max[k]) return false;
+                }
+                return true;
+            },
+            [&](size_t first, size_t end)
+            {
+                for (auto s = first; s < end; ++s)
+                {
+                    float p[3] = { axes[0][s], axes[1][s], axes[2][s] };
+                    float q[3] = { axes[0][s + 1], axes[1][s + 1], axes[2][s + 1] };
+                    if (segment_in_box(p, q, box.min, box.max)) add(Hit::Fixture, s, f);
+                }
+            });
+    }
+
+    // one hit per block and thing hit, the chords of an arc or the passes of
+    // a loop through a fixture are a single problem
+    auto key = [](const Hit& hit) { return std::make_tuple(hit.block, hit.kind, hit.what, hit.segment); };
+    std::sort(hits.begin(), hits.end(), [&](const Hit& a, const Hit& b) { return key(a) < key(b); });
+    hits.erase(std::unique(hits.begin(), hits.end(),
+                           [](const Hit& a, const Hit& b)
+                           {
+                               return a.block == b.block && a.kind == b.kind && a.what == b.what;
+                           }),
+               hits.end());
+    std::sort(hits.begin(), hits.end(),
+              [](const Hit& a, const Hit& b) { return a.segment < b.segment; });
+    return hits;
+}
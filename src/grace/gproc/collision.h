@@ -0,0 +1,83 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "toolpath.h"
+
+/* Finds where a toolpath leaves the machine's travel or enters a fixture.
+ *
+ * Segments are grouped in runs of consecutive ones, which stay close
+ * together on any real toolpath, and the runs are merged pairwise into a
+ * hierarchy of bounding boxes kept as flat arrays per level. Building it
+ * is a single pass; a query only descends into boxes that overlap a
+ * fixture (or stick out of the travel) and tests the segments of the runs
+ * it reaches exactly.
+ */
+class CollisionCheck {
+public:
+    struct Box {
+        float min[3];
+        float max[3];
+    };
+    struct Fixture {
+        std::string name;
+        Box box;
+    };
+    struct Setup {
+        // in machine coordinates, no limits unless given
+        Box travel { { -1e30f, -1e30f, -1e30f }, { 1e30f, 1e30f, 1e30f } };
+        // program zero (the G54 origin) in machine coordinates
+        float origin[3] = { 0, 0, 0 };
+        // in program coordinates, like the toolpath
+        std::vector<Fixture> fixtures;
+        // fixtures are grown by the tool radius in X and Y, and reach down
+        // for the shank above the tip
+        float tool_radius = 0;
+
+        /* Reads lines like
+         *
+         *   travel -500 -300 -400 500 300 0
+         *   origin -250 -150 -300
+         *   tool 5
+         *   Front clamp 10 10 -50 60 40 20
+         *
+         * fixtures being a name and two corners. Returns false and sets
+         * error on the first line that doesn't fit.
+         */
+        bool parse(const std::string& text, std::string* error);
+    };
+    struct Hit {
+        enum Kind : uint8_t {
+            Travel,
+            Fixture,
+        };
+        Kind kind;
+        Toolpath::Motion motion;
+        unsigned block;
+        // first segment of the run of segments hitting the same thing
+        unsigned segment;
+        // fixture index, or the axis leaving the travel
+        unsigned what;
+    };
+    //
+    CollisionCheck(const Toolpath& toolpath);
+    // hits sorted by segment, one per block and thing hit
+    std::vector<Hit> run(const Setup& setup) const;
+
+private:
+    struct Level {
+        std::vector<float> min[3];
+        std::vector<float> max[3];
+    };
+    template <typename Descend, typename Leaf>
+    void query_(Descend descend, Leaf leaf) const;
+
+    const Toolpath& toolpath_;
+    // levels_[0] bounds runs of LEAF segments, each next level pairs of those
+    std::vector<Level> levels_;
+};
@@ -0,0 +1,196 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstdint>
+
+#include "types.h"
+
+/* Grammar tables of the G-code flavors we parse.
+ *
+ * Each dialect is a tag type holding a constexpr Grammar; the parser is a
+ * template over it, so the rules below are folded into the code at compile
+ * time and checking a word is a couple of table loads.
+ */
+namespace Dialect {
+    enum Kind {
+        RS274,
+        Fanuc,
+        Haas,
+        LinuxCNC,
+        Marlin,
+    };
+
+    enum Duplicates : uint8_t {
+        // at most one word of that letter per block
+        Once,
+        // several words of that letter, each with its own value
+        DistinctValues,
+        // anything goes
+        Repeat,
+    };
+
+    enum HeaderRule : uint8_t {
+        HeaderRequired,
+        HeaderOptional,
+    };
+
+    using LetterSet = uint64_t;
+
+    constexpr LetterSet letter(Token::Type kind) { return LetterSet(1) << kind; }
+
+    template <typename... Kinds>
+    constexpr LetterSet letters(Kinds... kinds) { return (letter(kinds) | ...); }
+
+    struct Rule {
+        Token::Type kind;
+        // position within the block when the grammar is ordered
+        uint8_t order;
+        Duplicates duplicates;
+    };
+
+    struct Grammar {
+        LetterSet letters;
+        uint8_t order[Token::Unknown];
+        Duplicates duplicates[Token::Unknown];
+        // dimension words, and letters which are only allowed after one
+        LetterSet dimensions;
+        LetterSet needs_dimension;
+        // words must follow the order of the rules
+        bool ordered;
+        HeaderRule header;
+        // a % line ends the program
+        bool trailing_percent;
+        // a letter without a number reads as zero (G28 X Y)
+        bool bare_letters;
+        // # parameters, expressions and macro statements
+        bool macros;
+    };
+
+    template <size_t N>
+    constexpr Grammar make_grammar(const Rule (&rules)[N], bool ordered, HeaderRule header,
+                                   bool trailing_percent = false, bool bare_letters = false,
+                                   LetterSet needs_dimension = 0, bool macros = false)
+    {
+        Grammar grammar {};
+        for (auto& rule : rules)
+        {
+            grammar.letters |= letter(rule.kind);
+            grammar.order[rule.kind] = rule.order;
+            grammar.duplicates[rule.kind] = rule.duplicates;
+        }
+        grammar.dimensions = letters(Token::X, Token::Y, Token::Z,
+                                     Token::U, Token::V, Token::W,
+                                     Token::P, Token::Q, Token::R,
+                                     Token::A, Token::B, Token::C);
+        grammar.needs_dimension = needs_dimension;
+        grammar.ordered = ordered;
+        grammar.header = header;
+        grammar.trailing_percent = trailing_percent;
+        grammar.bare_letters = bare_letters;
+        grammar.macros = macros;
+        return grammar;
+    }
+
+    /* The N, G, dimension, IJK, EF, S, DT, M order of the original parser. */
+    constexpr Rule RS274_RULES[] = {
+        { Token::G, 1, DistinctValues },
+        { Token::X, 2, Once }, { Token::Y, 2, Once }, { Token::Z, 2, Once },
+        { Token::U, 2, Once }, { Token::V, 2, Once }, { Token::W, 2, Once },
+        { Token::P, 2, Once }, { Token::Q, 2, Once }, { Token::R, 2, Once },
+        { Token::A, 2, Once }, { Token::B, 2, Once }, { Token::C, 2, Once },
+        { Token::I, 3, Once }, { Token::J, 3, Once }, { Token::K, 3, Once },
+        { Token::E, 4, Once }, { Token::F, 4, Once },
+        { Token::S, 5, Once },
+        { Token::D, 6, Once }, { Token::T, 6, Once },
+        { Token::M, 7, DistinctValues },
+    };
+
+    /* Fanuc and Haas take words in any order, Haas shares the table. */
+    constexpr Rule FANUC_RULES[] = {
+        { Token::O, 0, Once },
+        { Token::G, 0, DistinctValues },
+        { Token::X, 0, Once }, { Token::Y, 0, Once }, { Token::Z, 0, Once },
+        { Token::U, 0, Once }, { Token::V, 0, Once }, { Token::W, 0, Once },
+        { Token::P, 0, Once }, { Token::Q, 0, Once }, { Token::R, 0, Once },
+        { Token::A, 0, Once }, { Token::B, 0, Once }, { Token::C, 0, Once },
+        { Token::I, 0, Once }, { Token::J, 0, Once }, { Token::K, 0, Once },
+        { Token::E, 0, Once }, { Token::F, 0, Once },
+        { Token::S, 0, Once },
+        { Token::D, 0, Once }, { Token::T, 0, Once }, { Token::H, 0, Once },
+        { Token::M, 0, DistinctValues }, { Token::L, 0, Once },
+    };
+
+    /* LinuxCNC has no E word, O is reserved for subroutines. */
+    constexpr Rule LINUXCNC_RULES[] = {
+        { Token::O, 0, Once },
+        { Token::G, 0, DistinctValues },
+        { Token::X, 0, Once }, { Token::Y, 0, Once }, { Token::Z, 0, Once },
+        { Token::U, 0, Once }, { Token::V, 0, Once }, { Token::W, 0, Once },
+        { Token::P, 0, Once }, { Token::Q, 0, Once }, { Token::R, 0, Once },
+        { Token::A, 0, Once }, { Token::B, 0, Once }, { Token::C, 0, Once },
+        { Token::I, 0, Once }, { Token::J, 0, Once }, { Token::K, 0, Once },
+        { Token::F, 0, Once },
+        { Token::S, 0, Once },
+        { Token::D, 0, Once }, { Token::T, 0, Once }, { Token::H, 0, Once },
+        { Token::M, 0, DistinctValues }, { Token::L, 0, Once },
+    };
+
+    /* Marlin/RepRap: one command per line, parameters in any order. */
+    constexpr Rule MARLIN_RULES[] = {
+        { Token::G, 0, Once }, { Token::M, 0, Once }, { Token::T, 0, Once },
+        { Token::X, 0, Once }, { Token::Y, 0, Once }, { Token::Z, 0, Once },
+        { Token::A, 0, Once }, { Token::B, 0, Once }, { Token::C, 0, Once },
+        { Token::U, 0, Once }, { Token::V, 0, Once }, { Token::W, 0, Once },
+        { Token::I, 0, Once }, { Token::J, 0, Once }, { Token::K, 0, Once },
+        { Token::P, 0, Once }, { Token::Q, 0, Once }, { Token::R, 0, Once },
+        { Token::E, 0, Once }, { Token::F, 0, Once }, { Token::S, 0, Once },
+        { Token::D, 0, Once }, { Token::H, 0, Once }, { Token::L, 0, Once },
+    };
+
+    struct RS274Grammar {
+        static constexpr const char* name = "RS-274";
+        static constexpr Grammar grammar = make_grammar(
+            RS274_RULES, true, HeaderRequired, false, false,
+            letters(Token::I, Token::J, Token::K, Token::E, Token::F));
+    };
+
+    struct FanucGrammar {
+        static constexpr const char* name = "Fanuc";
+        static constexpr Grammar grammar = make_grammar(
+            FANUC_RULES, false, HeaderOptional, true, false, 0, true);
+    };
+
+    struct HaasGrammar {
+        static constexpr const char* name = "Haas";
+        static constexpr Grammar grammar = make_grammar(
+            FANUC_RULES, false, HeaderOptional, true, false, 0, true);
+    };
+
+    struct LinuxCNCGrammar {
+        static constexpr const char* name = "LinuxCNC";
+        static constexpr Grammar grammar = make_grammar(
+            LINUXCNC_RULES, false, HeaderOptional, true, false, 0, true);
+    };
+
+    struct MarlinGrammar {
+        static constexpr const char* name = "Marlin";
+        static constexpr Grammar grammar = make_grammar(
+            MARLIN_RULES, false, HeaderOptional, false, true);
+    };
+
+    // the grammar of a dialect picked at run time
+    inline const Grammar& grammar_of(Kind kind)
+    {
+        switch (kind)
+        {
+            case Fanuc:      return FanucGrammar::grammar;
+            case Haas:       return HaasGrammar::grammar;
+            case LinuxCNC:   return LinuxCNCGrammar::grammar;
+            case Marlin:     return MarlinGrammar::grammar;
+            default:         return RS274Grammar::grammar;
+        }
+    }
+};
@@ -0,0 +1,261 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include "diff.h"
+
+// windows tried for anchors, long ones stay unique where single blocks repeat
+static const unsigned ANCHOR_WINDOWS[] = { 16, 1 };
+// gaps nested deeper than this are left unmatched
+static const unsigned MAX_DEPTH = 48;
+static const uint64_t ROLLING_BASE = 1099511628211ull;
+
+static uint64_t mix(uint64_t h, uint64_t v)
+{
+    h ^= v + 0x9E3779B97F4A7C15ull;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 31);
+}
+
+static uint64_t value_bits(float value)
+{
+    // -0 and 0 write the same
+    if (value == 0) value = 0;
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static bool is_code(Token::Type kind)
+{
+    switch (kind)
+    {
+        case Token::G: case Token::M:
+        case Token::T: case Token::D: case Token::H:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Blocks with words, their exact hashes and shape hashes. */
+static void hash_blocks(const Program& program, std::vector<unsigned>& blocks,
+                        std::vector<uint64_t>& exact, std::vector<uint64_t>& shape)
+{
+    for (unsigned i = 0; i < program.blocks.size(); ++i)
+    {
+        auto& words = program.blocks[i].data_words;
+        if (words.empty()) continue;
+        uint64_t e = 0, s = 0;
+        for (const Word& w : words)
+        {
+            e = mix(mix(e, w.kind), value_bits(w.value));
+            s = mix(s, w.kind);
+            if (is_code(w.kind)) s = mix(s, value_bits(w.value));
+        }
+        blocks.push_back(i);
+        exact.push_back(e);
+        shape.push_back(s);
+    }
+}
+
+/* */
+
+bool BlockDiff::anchor_(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b,
+                        unsigned a0, unsigned a1, unsigned b0, unsigned b1,
+                        unsigned window, Pairs& pairs)
+{
+    if (window > a1 - a0 || window > b1 - b0) return false;
+
+    uint64_t outgoing = 1;
+    for (unsigned i = 1; i < window; ++i) outgoing *= ROLLING_BASE;
+    auto roll = [&](const std::vector<uint64_t>& h, unsigned first, unsigned last, auto&& fn) {
+        uint64_t r = 0;
+        for (unsigned i = first; i < last; ++i)
+        {
+            if (i >= first + window) r -= h[i - window] * outgoing;
+            r = r * ROLLING_BASE + h[i];
+            if (i + 1 >= first + window) fn(i + 1 - window, r);
+        }
+    };
+
+    struct Slot {
+        unsigned a_count = 0, a_pos = 0;
+        unsigned b_count = 0, b_pos = 0;
+    };
+    std::unordered_map<uint64_t, Slot> slots;
+    slots.reserve(a1 - a0);
+    roll(a, a0, a1, [&](unsigned i, uint64_t r) {
+        auto& slot = slots[r];
+        ++slot.a_count;
+        slot.a_pos = i;
+    });
+    roll(b, b0, b1, [&](unsigned j, uint64_t r) {
+        auto it = slots.find(r);
+        if (it == slots.end()) return;
+        ++it->second.b_count;
+        it->second.b_pos = j;
+    });
+
+    // windows that occur exactly once on either side
+    Pairs unique;
+    for (auto& entry : slots)
+    {
+        auto& slot = entry.second;
+        if (slot.a_count != 1 || slot.b_count != 1) continue;
+        if (!std::equal(&a[slot.a_pos], &a[slot.a_pos] + window, &b[slot.b_pos])) continue;
+        unique.emplace_back(slot.a_pos, slot.b_pos);
+    }
+    if (unique.empty()) return false;
+    std::sort(unique.begin(), unique.end());
+
+    // longest run of them in the same order on both sides
+    std::vector<unsigned> tails;
+    std::vector<unsigned> previous(unique.size());
+    for (unsigned k = 0; k < unique.size(); ++k)
+    {
+        auto it = std::lower_bound(tails.begin(), tails.end(), unique[k].second,
+                                   [&](unsigned t, unsigned j) { return unique[t].second < j; });
+        previous[k] = it == tails.begin() ? ~0u : *(it - 1);
+        if (it == tails.end()) tails.push_back(k);
+        else *it = k;
+    }
+    Pairs chain;
+    for (auto k = tails.back(); k != ~0u; k = previous[k])
+    {
+        chain.push_back(unique[k]);
+    }
+
+    // windows overlap along a run, keep every pair once and in order
+    bool first = true;
+    unsigned last_a = 0, last_b = 0;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+    {
+        for (unsigned t = 0; t < window; ++t)
+        {
+            auto i = it->first + t, j = it->second + t;
+            if (!first && (i <= last_a || j <= last_b)) continue;
+            pairs.emplace_back(i, j);
+            last_a = i;
+            last_b = j;
+            first = false;
+        }
+    }
+    return true;
+}
+
+void BlockDiff::match_(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b,
+                       unsigned a0, unsigned a1, unsigned b0, unsigned b1,
+                       unsigned depth, Pairs& pairs)
+{
+    while (a0 < a1 && b0 < b1 && a[a0] == b[b0])
+    {
+        pairs.emplace_back(a0++, b0++);
+    }
+    Pairs suffix;
+    while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1])
+    {
+        suffix.emplace_back(--a1, --b1);
+    }
+
+    if (a0 < a1 && b0 < b1 && depth < MAX_DEPTH)
+    {
+        Pairs anchors;
+        for (auto window : ANCHOR_WINDOWS)
+        {
+            if (anchor_(a, b, a0, a1, b0, b1, window, anchors)) break;
+        }
+        // refine what lies between the anchors
+        auto pa = a0, pb = b0;
+        for (auto& anchor : anchors)
+        {
+            match_(a, b, pa, anchor.first, pb, anchor.second, depth + 1, pairs);
+            pairs.push_back(anchor);
+            pa = anchor.first + 1;
+            pb = anchor.second + 1;
+        }
+        if (!anchors.empty())
+        {
+            match_(a, b, pa, a1, pb, b1, depth + 1, pairs);
+        }
+    }
+    pairs.insert(pairs.end(), suffix.rbegin(), suffix.rend());
+}
+
+bool BlockDiff::compare_(const Block& from, const Block& to, Change& change) const
+{
+    auto& a = from.data_words;
+    auto& b = to.data_words;
+    // only a hash collision gets here with different words
+    if (a.size() != b.size()) return true;
+    for (size_t k = 0; k < a.size(); ++k)
+    {
+        if (a[k].kind != b[k].kind) return true;
+        if (std::abs(a[k].value - b[k].value) > tolerance_)
+        {
+            change.words.emplace_back(a[k], b[k]);
+        }
+    }
+    return !change.words.empty();
+}
+
+BlockDiff::BlockDiff(const Program& from, const Program& to, float tolerance/* = 1e-4f */)
+    : tolerance_(tolerance)
+{
+    std::vector<unsigned> blocks[2];
+    std::vector<uint64_t> exact[2], shape[2];
+    hash_blocks(from, blocks[0], exact[0], shape[0]);
+    hash_blocks(to, blocks[1], exact[1], shape[1]);
+    unsigned na = blocks[0].size(), nb = blocks[1].size();
+
+    Pairs same;
+    match_(exact[0], exact[1], 0, na, 0, nb, 0, same);
+    same.emplace_back(na, nb);
+
+    // what's left is aligned again on the shape of the blocks
+    Pairs pairs;
+    unsigned pa = 0, pb = 0;
+    for (auto& pair : same)
+    {
+        match_(shape[0], shape[1], pa, pair.first, pb, pair.second, 0, pairs);
+        pairs.push_back(pair);
+        pa = pair.first + 1;
+        pb = pair.second + 1;
+    }
+
+    pa = 0, pb = 0;
+    for (auto& pair : pairs)
+    {
+        auto next = pair.second < nb ? blocks[1][pair.second] : to.blocks.size();
+        for (; pa < pair.first; ++pa)
+        {
+            changes_.push_back(Change { Deleted, blocks[0][pa], (unsigned)next, {} });
+        }
+        auto last = pair.first < na ? blocks[0][pair.first] : from.blocks.size();
+        for (; pb < pair.second; ++pb)
+        {
+            changes_.push_back(Change { Inserted, (unsigned)last, blocks[1][pb], {} });
+        }
+        if (pair.first == na) break;
+
+        Change change { Changed, blocks[0][pair.first], blocks[1][pair.second], {} };
+        if (exact[0][pair.first] != exact[1][pair.second] &&
+            compare_(from.blocks[change.old_block], to.blocks[change.new_block], change))
+        {
+            changes_.emplace_back(std::move(change));
+        }
+        pa = pair.first + 1;
+        pb = pair.second + 1;
+    }
+}
+
+size_t BlockDiff::count(Kind kind) const
+{
+    return std::count_if(changes_.begin(), changes_.end(),
+                         [&](const Change& change) { return change.kind == kind; });
+}
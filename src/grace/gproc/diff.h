@@ -0,0 +1,57 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+
+/* Block by block comparison of two programs.
+ *
+ * Blocks are compared by their words only: N numbers, spacing, comments
+ * and blank blocks don't count. Matching runs are found from rolling
+ * hashes over windows of block hashes that occur once in either program,
+ * then refined inside the gaps between them, the way histogram diffs
+ * anchor on rare lines. Gaps left over are aligned again on the shape of
+ * the blocks (their letters and G/M codes), and blocks paired that way
+ * only count as changed when a value moved by more than the tolerance.
+ * Time and memory are about linear in the number of blocks.
+ */
+class BlockDiff {
+public:
+    enum Kind {
+        Deleted,
+        Inserted,
+        Changed,
+    };
+    struct Change {
+        Kind kind;
+        // block in the old resp. new program, the next one for a deletion
+        unsigned old_block;
+        unsigned new_block;
+        // words that differ, old and new
+        std::vector<std::pair<Word, Word>> words;
+    };
+    //
+    BlockDiff(const Program& from, const Program& to, float tolerance = 1e-4f);
+    const std::vector<Change>& changes() const { return changes_; }
+    size_t count(Kind kind) const;
+
+private:
+    using Pairs = std::vector<std::pair<unsigned, unsigned>>;
+    //
+    static void match_(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b,
+                       unsigned a0, unsigned a1, unsigned b0, unsigned b1,
+                       unsigned depth, Pairs& pairs);
+    static bool anchor_(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b,
+                        unsigned a0, unsigned a1, unsigned b0, unsigned b1,
+                        unsigned window, Pairs& pairs);
+    bool compare_(const Block& from, const Block& to, Change& change) const;
+
+    float tolerance_;
+    std::vector<Change> changes_;
+};
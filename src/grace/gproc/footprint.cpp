@@ -0,0 +1,82 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <atomic>
+
+#include "footprint.h"
+
+static std::atomic<size_t> current[Footprint::TRANSIENTS];
+static std::atomic<size_t> peak[Footprint::TRANSIENTS];
+
+// short strings are kept inside the string object, up to the capacity an
+// empty one starts with
+template <typename S>
+static size_t string_heap(const S& s)
+{
+    static const auto inline_capacity = S().capacity();
+    if (s.capacity() <= inline_capacity) return 0;
+    return (s.capacity() + 1) * sizeof(typename S::value_type);
+}
+
+size_t Footprint::of(const std::string& s)
+{
+    return string_heap(s);
+}
+
+size_t Footprint::of(const std::wstring& s)
+{
+    return string_heap(s);
+}
+
+size_t Footprint::of(const Block& block)
+{
+    auto bytes = of(block.data_words) + of(block.comments);
+    for (auto& comment : block.comments) bytes += of(comment);
+    return bytes;
+}
+
+size_t Footprint::of(const std::vector<Block>& blocks)
+{
+    auto bytes = blocks.capacity() * sizeof(Block);
+    for (auto& block : blocks) bytes += of(block);
+    return bytes;
+}
+
+Footprint::Total Footprint::total(Transient kind)
+{
+    return Total { current[kind].load(), peak[kind].load() };
+}
+
+const char* Footprint::name(Transient kind)
+{
+    switch (kind)
+    {
+        case ParseText:   return "Parse copies";
+        case StyleText:   return "Styling copies";
+        case FileText:    return "Save and compare copies";
+        default:          return "<invalid>";
+    }
+}
+
+/* */
+
+FootprintHold::FootprintHold(Footprint::Transient kind, size_t bytes) :
+    kind_(kind),
+    bytes_(0)
+{
+    resize(bytes);
+}
+
+FootprintHold::~FootprintHold()
+{
+    current[kind_] -= bytes_;
+}
+
+void FootprintHold::resize(size_t bytes)
+{
+    auto now = current[kind_] += bytes - bytes_;
+    bytes_ = bytes;
+    auto seen = peak[kind_].load();
+    while (now > seen && !peak[kind_].compare_exchange_weak(seen, now)) { }
+}
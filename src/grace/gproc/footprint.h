@@ -0,0 +1,62 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+/* Heap bytes held by data structures, to tell where the memory of a
+ * document goes.
+ *
+ * Structures that are built once and then only read report what they hold
+ * with memory_usage(), worked out from the capacity of their arrays and
+ * strings. Buffers that only live for a while, like text copied out of the
+ * editor for the parser or the styler, are counted by a FootprintHold for
+ * as long as it lives, in totals that keep their peak.
+ */
+namespace Footprint {
+    enum Transient {
+        // text copied for parsing, and the program while it is built
+        ParseText,
+        // text copied for styling
+        StyleText,
+        // text copied for saving or comparing
+        FileText,
+        TRANSIENTS
+    };
+    struct Total {
+        size_t current;
+        size_t peak;
+    };
+
+    template <typename T>
+    size_t of(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+    size_t of(const std::string& s);
+    size_t of(const std::wstring& s);
+    // what a block holds besides itself
+    size_t of(const Block& block);
+    size_t of(const std::vector<Block>& blocks);
+
+    Total total(Transient kind);
+    const char* name(Transient kind);
+};
+
+/* Counts bytes against a transient total from construction to
+ * destruction. */
+class FootprintHold {
+public:
+    FootprintHold(Footprint::Transient kind, size_t bytes);
+    ~FootprintHold();
+    FootprintHold(const FootprintHold&) = delete;
+    FootprintHold& operator=(const FootprintHold&) = delete;
+    // the buffer grew or shrank
+    void resize(size_t bytes);
+
+private:
+    Footprint::Transient kind_;
+    size_t bytes_;
+};
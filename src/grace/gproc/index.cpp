@@ -0,0 +1,250 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cwctype>
+#include <iterator>
+
+#include "footprint.h"
+#include "index.h"
+
+void WordIndex::add(const Block& block, unsigned index)
+{
+    for (const Word& w : block.data_words)
+    {
+        postings_[w.kind].emplace_back(Posting { w.value, index });
+    }
+}
+
+void WordIndex::clear()
+{
+    for (auto& postings : postings_)
+    {
+        postings.clear();
+    }
+    block_count_ = 0;
+}
+
+void WordIndex::finalize(unsigned block_count)
+{
+    block_count_ = block_count;
+    // blocks come in ascending order, keep it that way for equal values
+    for (auto& postings : postings_)
+    {
+        std::stable_sort(postings.begin(), postings.end(),
+            [](const Posting& a, const Posting& b) { return a.value < b.value; });
+        postings.shrink_to_fit();
+    }
+}
+
+std::vector<unsigned> WordIndex::find(Token::Type kind, Compare cmp, float value/* = 0 */) const
+{
+    std::vector<unsigned> blocks;
+    if (kind >= Token::Unknown) return blocks;
+
+    auto& postings = postings_[kind];
+    auto lower = std::lower_bound(postings.begin(), postings.end(), value,
+        [](const Posting& p, float v) { return p.value < v; });
+    auto upper = std::upper_bound(lower, postings.end(), value,
+        [](float v, const Posting& p) { return v < p.value; });
+
+    auto collect = [&](auto first, auto last) {
+        for (; first != last; ++first) blocks.push_back(first->block);
+    };
+    switch (cmp)
+    {
+        case Any:            collect(postings.begin(), postings.end()); break;
+        case Equal:          collect(lower, upper); break;
+        case NotEqual:       collect(postings.begin(), lower);
+                             collect(upper, postings.end()); break;
+        case Less:           collect(postings.begin(), lower); break;
+        case LessEqual:      collect(postings.begin(), upper); break;
+        case Greater:        collect(upper, postings.end()); break;
+        case GreaterEqual:   collect(lower, postings.end()); break;
+    }
+    // only a single value range is already in block order
+    if (cmp != Equal)
+    {
+        std::sort(blocks.begin(), blocks.end());
+    }
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+    return blocks;
+}
+
+/* */
+
+/* Recursive descent over:
+ *
+ *   expr   := term ('|' term)*
+ *   term   := factor ('&' factor)*
+ *   factor := '!' factor | '(' expr ')' | letter [compare] [number]
+ */
+class WordIndex::QueryParser {
+public:
+    QueryParser(const WordIndex& index, const std::wstring& text)
+        : index_(index), text_(text), pos_(0) { }
+
+    std::vector<unsigned> parse()
+    {
+        auto result = parse_expr_();
+        skip_space_();
+        if (pos_ < text_.length())
+        {
+            throw QueryException(
+                std::string("Unexpected char in query: ") + std::to_string(text_[pos_]), pos_, 1);
+        }
+        return result;
+    }
+
+private:
+    std::vector<unsigned> parse_expr_()
+    {
+        auto result = parse_term_();
+        while (accept_('|'))
+        {
+            auto rhs = parse_term_();
+            std::vector<unsigned> merged;
+            merged.reserve(result.size() + rhs.size());
+            std::set_union(result.begin(), result.end(), rhs.begin(), rhs.end(),
+                           std::back_inserter(merged));
+            result.swap(merged);
+        }
+        return result;
+    }
+
+    std::vector<unsigned> parse_term_()
+    {
+        auto result = parse_factor_();
+        while (accept_('&'))
+        {
+            auto rhs = parse_factor_();
+            std::vector<unsigned> common;
+            std::set_intersection(result.begin(), result.end(), rhs.begin(), rhs.end(),
+                                  std::back_inserter(common));
+            result.swap(common);
+        }
+        return result;
+    }
+
+    std::vector<unsigned> parse_factor_()
+    {
+        if (accept_('!'))
+        {
+            auto operand = parse_factor_();
+            std::vector<unsigned> result;
+            result.reserve(index_.block_count() - operand.size());
+            auto it = operand.begin();
+            for (unsigned block = 0; block < index_.block_count(); ++block)
+            {
+                if (it != operand.end() && *it == block) { ++it; continue; }
+                result.push_back(block);
+            }
+            return result;
+        }
+        if (accept_('('))
+        {
+            auto result = parse_expr_();
+            if (!accept_(')'))
+            {
+                throw QueryException("Expected ) in query", pos_, 1);
+            }
+            return result;
+        }
+        return parse_condition_();
+    }
+
+    std::vector<unsigned> parse_condition_()
+    {
+        skip_space_();
+        auto start = pos_;
+        auto kind = pos_ < text_.length() ?
+            TokenType_FromChar(std::towupper(text_[pos_])) : Token::Unknown;
+        if (kind == Token::Unknown)
+        {
+            throw QueryException("Expected word letter in query", start, 1);
+        }
+        ++pos_;
+
+        auto cmp = WordIndex::Equal;
+        if (accept_('<'))
+        {
+            cmp = accept_('=') ? WordIndex::LessEqual : WordIndex::Less;
+        }
+        else if (accept_('>'))
+        {
+            cmp = accept_('=') ? WordIndex::GreaterEqual : WordIndex::Greater;
+        }
+        else if (accept_('!'))
+        {
+            if (!accept_('='))
+            {
+                throw QueryException("Expected = after !", pos_, 1);
+            }
+            cmp = WordIndex::NotEqual;
+        }
+        else
+        {
+            accept_('=');
+        }
+
+        skip_space_();
+        auto number_start = pos_;
+        while (pos_ < text_.length() &&
+               (std::iswdigit(text_[pos_]) || text_[pos_] == '.' ||
+                text_[pos_] == '+' || text_[pos_] == '-'))
+        {
+            ++pos_;
+        }
+        if (number_start == pos_)
+        {
+            if (cmp != WordIndex::Equal)
+            {
+                throw QueryException("Expected <number> in query", pos_, 1);
+            }
+            return index_.find(kind, WordIndex::Any);
+        }
+        try
+        {
+            auto value = std::stof(text_.substr(number_start, pos_ - number_start));
+            return index_.find(kind, cmp, value);
+        }
+        catch (std::logic_error&)
+        {
+            throw QueryException("Invalid <number> in query",
+                                 number_start, pos_ - number_start);
+        }
+    }
+
+    bool accept_(wchar_t c)
+    {
+        skip_space_();
+        if (pos_ < text_.length() && text_[pos_] == c)
+        {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    void skip_space_()
+    {
+        while (pos_ < text_.length() && std::iswspace(text_[pos_])) ++pos_;
+    }
+
+    const WordIndex& index_;
+    const std::wstring& text_;
+    unsigned pos_;
+};
+
+std::vector<unsigned> WordIndex::query(const std::wstring& query) const
+{
+    return QueryParser(*this, query).parse();
+}
+
+size_t WordIndex::memory_usage() const
+{
+    size_t bytes = 0;
+    for (auto& postings : postings_) bytes += Footprint::of(postings);
+    return bytes;
+}
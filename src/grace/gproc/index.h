@@ -0,0 +1,55 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+class QueryException : public PosException { using PosException::PosException; };
+
+/* Inverted index from words to the blocks that hold them.
+ *
+ * Postings are kept per word kind and sorted by value, so that equality
+ * and range conditions are a binary search away. Queries look like:
+ *
+ *   T            blocks with any T word
+ *   M6           blocks with an M6 word
+ *   S>12000      blocks with an S word above 12000
+ *   G0 & Z<0     rapids below zero
+ *   (M3 | M4) & !S
+ */
+class WordIndex {
+public:
+    enum Compare {
+        Any,
+        Equal,
+        NotEqual,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+    };
+    struct Posting {
+        float value;
+        unsigned block;
+    };
+    //
+    WordIndex() { }
+    void add(const Block& block, unsigned index);
+    void clear();
+    void finalize(unsigned block_count);
+    std::vector<unsigned> find(Token::Type kind, Compare cmp, float value = 0) const;
+    std::vector<unsigned> query(const std::wstring& query) const;
+    unsigned block_count() const { return block_count_; }
+    size_t memory_usage() const;
+
+private:
+    class QueryParser;
+
+    std::vector<Posting> postings_[Token::Unknown];
+    unsigned block_count_ = 0;
+};
@@ -0,0 +1,154 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+
+#include "footprint.h"
+#include "layers.h"
+
+// mm/min until the program sets a feed rate
+static const float DEFAULT_FEED = 1500;
+
+LayerIndex::LayerIndex(const Program& program) :
+    blocks_(program.blocks.size()),
+    total_extruded_(0),
+    total_time_(0)
+{
+    float position[4] = { 0, 0, 0, 0 };
+    bool absolute = true;
+    bool absoluteE = true;
+    float units = 1;
+    float feed = DEFAULT_FEED;
+
+    // moves since the last change of height go to whichever layer turns
+    // out to own them
+    struct Sums {
+        double extruded = 0;
+        double travel = 0;
+        double time = 0;
+    };
+    Sums current, pending;
+    unsigned zBlock = 0;
+    auto flush = [&](Sums& into, Sums& from) {
+        into.extruded += from.extruded;
+        into.travel += from.travel;
+        into.time += from.time;
+        from = Sums();
+    };
+    auto finish = [&]() {
+        if (first_.empty()) return;
+        extruded_.push_back((float) current.extruded);
+        travel_.push_back((float) current.travel);
+        time_.push_back((float) current.time);
+        total_extruded_ += current.extruded;
+        total_time_ += current.time;
+        extruded_sum_.push_back(total_extruded_);
+        time_sum_.push_back(total_time_);
+        current = Sums();
+    };
+
+    for (unsigned i = 0; i < program.blocks.size(); ++i)
+    {
+        auto& words = program.blocks[i].data_words;
+        if (words.empty()) continue;
+
+        bool move = false, home = false, set = false;
+        std::optional<float> axes[4];
+        for (auto& w : words)
+        {
+            switch (w.kind)
+            {
+                case Token::G:
+                    if (w.value == 0 || w.value == 1 || w.value == 2 || w.value == 3) move = true;
+                    else if (w.value == 28) home = true;
+                    else if (w.value == 92) set = true;
+                    // G90/G91 switch E along, M82/M83 only E
+                    else if (w.value == 90) absolute = absoluteE = true;
+                    else if (w.value == 91) absolute = absoluteE = false;
+                    else if (w.value == 20) units = 25.4f;
+                    else if (w.value == 21) units = 1;
+                    break;
+                case Token::M:
+                    if (w.value == 82) absoluteE = true;
+                    else if (w.value == 83) absoluteE = false;
+                    break;
+                case Token::X:
+                case Token::Y:
+                case Token::Z:
+                    axes[w.kind - Token::X] = w.value * units;
+                    break;
+                case Token::E:
+                    axes[3] = w.value * units;
+                    break;
+                case Token::F:
+                    if (w.value > 0) feed = w.value * units;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (set || home)
+        {
+            // new coordinates without a known move, homing all axes when
+            // none are given
+            bool any = axes[0] || axes[1] || axes[2] || axes[3];
+            for (unsigned k = 0; k < 4; ++k)
+            {
+                if (axes[k]) position[k] = set ? *axes[k] : 0;
+                else if (home && !any && k < 3) position[k] = 0;
+            }
+            continue;
+        }
+        if (!move) continue;
+
+        float delta[4];
+        for (unsigned k = 0; k < 4; ++k)
+        {
+            bool abs = k < 3 ? absolute : absoluteE;
+            delta[k] = !axes[k] ? 0 : abs ? *axes[k] - position[k] : *axes[k];
+            position[k] += delta[k];
+        }
+        auto distance = std::sqrt(delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2]);
+
+        if (delta[2] != 0)
+        {
+            // back down from a hop, or a new layer if something is extruded here
+            flush(current, pending);
+            zBlock = i;
+        }
+        if (delta[3] > 0 && distance > 0 && (first_.empty() || position[2] != z_.back()))
+        {
+            finish();
+            first_.push_back(zBlock);
+            z_.push_back(position[2]);
+        }
+
+        pending.extruded += delta[3];
+        if (delta[3] <= 0) pending.travel += distance;
+        pending.time += std::max(distance, std::abs(delta[3])) / feed * 60;
+    }
+    flush(current, pending);
+    finish();
+}
+
+unsigned LayerIndex::end_block(unsigned layer) const
+{
+    return layer + 1 < first_.size() ? first_[layer + 1] : blocks_;
+}
+
+unsigned LayerIndex::layer_of(unsigned block) const
+{
+    auto it = std::upper_bound(first_.begin(), first_.end(), block);
+    return it == first_.begin() ? 0 : (unsigned) (it - first_.begin()) - 1;
+}
+
+size_t LayerIndex::memory_usage() const
+{
+    return Footprint::of(first_) + Footprint::of(z_) + Footprint::of(extruded_) +
+           Footprint::of(travel_) + Footprint::of(time_) + Footprint::of(extruded_sum_) +
+           Footprint::of(time_sum_);
+}
@@ -0,0 +1,55 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <vector>
+
+#include "types.h"
+
+/* Layers of a 3D printer program and what each of them takes.
+ *
+ * A single pass follows X, Y, Z and E through G90/G91, M82/M83 and G92
+ * resets. A layer starts at the block that moved to a new height, once
+ * something is extruded there, so Z hops during travel don't split layers.
+ * Per layer the block it starts at, its height, the filament it extrudes,
+ * its travel and its estimated time are kept as flat arrays, along with
+ * running totals, so jumping to a layer or asking what was used up to it
+ * is a lookup.
+ */
+class LayerIndex {
+public:
+    LayerIndex(const Program& program);
+    size_t size() const { return first_.size(); }
+    // blocks [first_block, end_block) of a layer
+    unsigned first_block(unsigned layer) const { return first_[layer]; }
+    unsigned end_block(unsigned layer) const;
+    float z(unsigned layer) const { return z_[layer]; }
+    // filament, net of retractions, mm
+    float extruded(unsigned layer) const { return extruded_[layer]; }
+    // moves without extrusion, mm
+    float travel(unsigned layer) const { return travel_[layer]; }
+    // seconds at the programmed feed rates
+    float time(unsigned layer) const { return time_[layer]; }
+    // filament and time from the start of the program to the end of a layer
+    double extruded_through(unsigned layer) const { return extruded_sum_[layer]; }
+    double time_through(unsigned layer) const { return time_sum_[layer]; }
+    double total_extruded() const { return total_extruded_; }
+    double total_time() const { return total_time_; }
+    // layer holding a block, 0 before the first one
+    unsigned layer_of(unsigned block) const;
+    size_t memory_usage() const;
+
+private:
+    unsigned blocks_;
+    std::vector<unsigned> first_;
+    std::vector<float> z_;
+    std::vector<float> extruded_;
+    std::vector<float> travel_;
+    std::vector<float> time_;
+    std::vector<double> extruded_sum_;
+    std::vector<double> time_sum_;
+    double total_extruded_;
+    double total_time_;
+};
@@ -6,8 +6,27 @@
 
 #include "lexer.h"
 
-Lexer::Lexer(const std::wstring& text)
-    : text_(text)
+static const wchar_t* KEYWORDS[] = {
+    L"SIN", L"COS", L"TAN", L"ASIN", L"ACOS", L"ATAN",
+    L"SQRT", L"ABS", L"ROUND", L"FIX", L"FUP", L"LN", L"EXP",
+    L"MOD", L"AND", L"OR", L"XOR",
+    L"EQ", L"NE", L"GT", L"GE", L"LT", L"LE",
+    L"IF", L"THEN", L"GOTO", L"WHILE", L"DO", L"END",
+};
+
+bool is_keyword(const wchar_t* text, size_t length)
+{
+    for (auto keyword : KEYWORDS)
+    {
+        size_t i = 0;
+        while (i < length && keyword[i] && towupper(text[i]) == (wint_t) keyword[i]) ++i;
+        if (i == length && !keyword[i]) return true;
+    }
+    return false;
+}
+
+Lexer::Lexer(const std::wstring& text, bool macros/* = true */)
+    : macros_(macros), text_(text)
 {
     pos_ = 0;
 
@@ -24,7 +43,20 @@ Token::Token Lexer::next()
 
         // comma is mentioned in the spec list, but unclear
         // what it's for
-        if (c == '+' || c == '-' || c == '.' || iswdigit(c))
+        if (c == '+' || c == '-')
+        {
+            // a sign only belongs to a number right in front of it
+            if (!macros_ || (pos_ < text_length_ && (text_[pos_] == '.' || iswdigit(text_[pos_]))))
+            {
+                return tokenize_number_();
+            }
+            return Token::Token {
+                pos_ - 1,
+                1,
+                Token::Operator,
+            };
+        }
+        else if (c == '.' || iswdigit(c))
         {
             return tokenize_number_();
         }
@@ -36,6 +68,10 @@ Token::Token Lexer::next()
         {
             return tokenize_comment_();
         }
+        else if (c == ';')
+        {
+            return tokenize_line_comment_();
+        }
         else if (c == '=')
         {
             return Token::Token {
@@ -44,6 +80,16 @@ Token::Token Lexer::next()
                 Token::Equal,
             };
         }
+        else if (macros_ && (c == '#' || c == '[' || c == ']' || c == '*'))
+        {
+            return Token::Token {
+                pos_ - 1,
+                1,
+                c == '#' ? Token::Hash :
+                c == '[' ? Token::LeftBracket :
+                c == ']' ? Token::RightBracket : Token::Operator,
+            };
+        }
         else if (c == '%')
         {
             return Token::Token {
@@ -114,47 +160,22 @@ void Lexer::scan_integer_()
 
 Token::Token Lexer::tokenize_alpha_()
 {
-    Token::Type kind;
-
-    // TODO assign char values directly
-    // https://stackoverflow.com/a/17095716
-    switch (text_[pos_-1])
+    // runs of letters are macro keywords, when they are known
+    unsigned end = pos_;
+    while (end < text_length_ && iswalpha(text_[end])) ++end;
+    if (macros_ && end - pos_ >= 1 && is_keyword(text_.c_str() + pos_ - 1, end - pos_ + 1))
     {
-    case 'N': kind = Token::N; break;
-    case 'O': kind = Token::O; break;
-
-    case 'G': kind = Token::G; break;
-
-    case 'X': kind = Token::X; break;
-    case 'Y': kind = Token::Y; break;
-    case 'Z': kind = Token::Z; break;
-    case 'U': kind = Token::U; break;
-    case 'V': kind = Token::V; break;
-    case 'W': kind = Token::W; break;
-    case 'P': kind = Token::P; break;
-    case 'Q': kind = Token::Q; break;
-    case 'R': kind = Token::R; break;
-    case 'A': kind = Token::A; break;
-    case 'B': kind = Token::B; break;
-    case 'C': kind = Token::C; break;
-
-    case 'I': kind = Token::I; break;
-    case 'J': kind = Token::J; break;
-    case 'K': kind = Token::K; break;
-
-    case 'E': kind = Token::E; break;
-    case 'F': kind = Token::F; break;
-
-    case 'S': kind = Token::S; break;
-
-    case 'D': kind = Token::D; break;
-    case 'T': kind = Token::T; break;
-
-    case 'M': kind = Token::M; break;
-
-    default: kind = Token::Unknown;
+        unsigned start = pos_ - 1;
+        pos_ = end;
+        return Token::Token {
+            start,
+            end - start,
+            Token::Keyword,
+        };
     }
 
+    auto kind = TokenType_FromChar(towupper(text_[pos_-1]));
+
     return Token::Token {
         pos_-1,
         1,
@@ -185,6 +206,22 @@ Token::Token Lexer::tokenize_comment_()
     };
 }
 
+Token::Token Lexer::tokenize_line_comment_()
+{
+    unsigned start = pos_ - 1;
+
+    // runs up to the end of block, which is left for the next token
+    while (pos_ < text_length_ && text_[pos_] != '\u000A') {
+        ++pos_;
+    }
+
+    return Token::Token {
+        start,
+        pos_-start,
+        Token::Comment,
+    };
+}
+
 Token::Token Lexer::tokenize_number_()
 {
     //auto kind = Token::Integer;
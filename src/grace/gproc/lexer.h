@@ -10,18 +10,24 @@
 
 class LexerException : public PosException { using PosException::PosException; };
 
+// whether text is one of the words of macro expressions, in any case
+bool is_keyword(const wchar_t* text, size_t length);
+
 class Lexer {
 public:
-    Lexer(const std::wstring& text);
+    // without macros, # [ ] * and keywords are not tokens of the dialect
+    Lexer(const std::wstring& text, bool macros = true);
     Token::Token next();
 
 private:
     void scan_integer_();
     Token::Token tokenize_alpha_();
     Token::Token tokenize_comment_();
+    Token::Token tokenize_line_comment_();
     Token::Token tokenize_number_();
 
     unsigned pos_;
+    bool macros_;
     const std::wstring& text_;
     size_t text_length_;
 };
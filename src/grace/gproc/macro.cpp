@@ -0,0 +1,101 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <cmath>
+
+#include "macro.h"
+
+MacroRunner::MacroRunner(const Program& program, uint64_t limit/* = 100000000 */)
+    : program_(program), machine_(program.macros), limit_(limit),
+      partners_(program.blocks.size(), NONE), expressions_(program.blocks.size()),
+      error_block_(0)
+{
+    // open WHILEs per DO label, END closes the innermost one
+    std::unordered_map<unsigned, std::vector<unsigned>> open;
+    auto& blocks = program.blocks;
+    for (unsigned i = 0; i < blocks.size(); ++i)
+    {
+        auto& block = blocks[i];
+        if (block.number) numbers_.emplace(block.number->value, i);
+        for (auto& word : block.data_words)
+        {
+            if (word.expression != NO_EXPRESSION) expressions_[i] = true;
+        }
+        if (!block.statement) continue;
+
+        auto& statement = *block.statement;
+        if (statement.kind == Statement::While)
+        {
+            open[statement.label].push_back(i);
+        }
+        else if (statement.kind == Statement::End)
+        {
+            auto& whiles = open[statement.label];
+            if (whiles.empty()) continue;
+            partners_[i] = whiles.back();
+            partners_[whiles.back()] = i + 1;
+            whiles.pop_back();
+        }
+    }
+}
+
+unsigned MacroRunner::execute_(unsigned pc, const Statement& statement)
+{
+    switch (statement.kind)
+    {
+        case Statement::IfAssign:
+            if (machine_.eval(statement.condition) == 0) return pc + 1;
+            // fall through
+        case Statement::Assign:
+        {
+            auto number = machine_.eval(statement.target);
+            if (!(number >= 0 && number < MacroMachine::PARAMETERS))
+            {
+                fail_(pc, "No parameter #" + std::to_string((long long) number));
+                return NONE;
+            }
+            machine_.set((unsigned) number, machine_.eval(statement.value));
+            return pc + 1;
+        }
+        case Statement::IfGoto:
+            if (machine_.eval(statement.condition) == 0) return pc + 1;
+            // fall through
+        case Statement::Goto:
+            return jump_(pc, statement.target);
+        case Statement::While:
+            if (partners_[pc] == NONE)
+            {
+                fail_(pc, "WHILE without END" + std::to_string(statement.label));
+                return NONE;
+            }
+            return machine_.eval(statement.condition) != 0 ? pc + 1 : partners_[pc];
+        case Statement::End:
+            if (partners_[pc] == NONE)
+            {
+                fail_(pc, "END" + std::to_string(statement.label) + " without WHILE");
+                return NONE;
+            }
+            return partners_[pc];
+    }
+    return pc + 1;
+}
+
+unsigned MacroRunner::jump_(unsigned pc, uint32_t target)
+{
+    auto number = std::round(machine_.eval(target));
+    auto it = numbers_.find((unsigned) number);
+    if (number < 0 || it == numbers_.end())
+    {
+        fail_(pc, "GOTO to missing block N" + std::to_string((long long) number));
+        return NONE;
+    }
+    return it->second;
+}
+
+bool MacroRunner::fail_(unsigned block, const std::string& message)
+{
+    error_ = message;
+    error_block_ = block;
+    return false;
+}
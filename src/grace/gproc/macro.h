@@ -0,0 +1,85 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bytecode.h"
+#include "types.h"
+
+/* Runs the macro statements of a program and hands out its blocks in the
+ * order they execute, with the values of expressions filled in.
+ *
+ * Loops and jumps are resolved once up front: WHILE knows the block after
+ * its END and END the WHILE it closes, GOTO looks up N numbers in a table.
+ * Expressions run on the bytecode the parser compiled, so a loop costs a
+ * few table lookups and stack operations per iteration. Runs stop after
+ * limit blocks, so a loop that never ends can't hang an analysis.
+ */
+class MacroRunner {
+public:
+    MacroRunner(const Program& program, uint64_t limit = 100000000);
+    // why the last run stopped early, empty when it ran to the end
+    const std::string& error() const { return error_; }
+    unsigned error_block() const { return error_block_; }
+    MacroMachine& machine() { return machine_; }
+
+    /* Calls fn(index, words) for every block that runs and has words,
+     * returns false when the run stopped on an error. */
+    template <typename Fn>
+    bool run(Fn fn)
+    {
+        auto& blocks = program_.blocks;
+        error_.clear();
+        uint64_t steps = 0;
+        for (unsigned pc = 0; pc < blocks.size(); )
+        {
+            if (++steps > limit_) return fail_(pc, "Stopped after " + std::to_string(limit_) + " blocks");
+            auto& block = blocks[pc];
+            if (block.statement)
+            {
+                pc = execute_(pc, *block.statement);
+                if (pc == NONE) return false;
+                continue;
+            }
+            if (!expressions_[pc])
+            {
+                fn(pc, block.data_words);
+            }
+            else
+            {
+                words_ = block.data_words;
+                for (auto& word : words_)
+                {
+                    if (word.expression != NO_EXPRESSION) word.value = (float) machine_.eval(word.expression);
+                }
+                fn(pc, (const std::vector<Word>&) words_);
+            }
+            ++pc;
+        }
+        return true;
+    }
+
+private:
+    static constexpr unsigned NONE = ~0u;
+    //
+    unsigned execute_(unsigned pc, const Statement& statement);
+    bool fail_(unsigned block, const std::string& message);
+    unsigned jump_(unsigned pc, uint32_t target);
+
+    const Program& program_;
+    MacroMachine machine_;
+    uint64_t limit_;
+    // WHILE to the block after its END, END to its WHILE
+    std::vector<unsigned> partners_;
+    // blocks with words whose values are expressions
+    std::vector<bool> expressions_;
+    std::unordered_map<unsigned, unsigned> numbers_;
+    std::vector<Word> words_;
+    std::string error_;
+    unsigned error_block_;
+};
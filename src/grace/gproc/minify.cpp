@@ -0,0 +1,605 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cwctype>
+
+#include "minify.h"
+#include "parser.h"
+#include "pool.h"
+
+// text parsed by a worker at a time, cut at the last full line
+static const size_t CHUNK = 1 << 18;
+// output handed to the sink at a time
+static const size_t OUT_BUFFER = 1 << 20;
+
+static const Token::Type AXIS_KINDS[] = {
+    Token::X, Token::Y, Token::Z, Token::A, Token::B, Token::C,
+    Token::U, Token::V, Token::W, Token::E,
+};
+
+static const auto LETTERS = []() {
+    std::array<char, Token::Comment> letters {};
+    for (int kind = 0; kind < Token::Comment; ++kind)
+    {
+        letters[kind] = TokenType_ToString((Token::Type)kind)[0];
+    }
+    return letters;
+}();
+
+static const float UNKNOWN = NAN;
+
+// equal, or both unknown
+static bool same(float a, float b)
+{
+    return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+static bool is_cycle(float mode)
+{
+    return mode == 73 || mode == 76 || (mode >= 81 && mode <= 89);
+}
+
+static void decode_utf8(const char* data, size_t length, std::wstring& out)
+{
+    // never more chars than bytes, surrogate pairs included
+    out.resize(length);
+    size_t n = 0;
+    for (size_t i = 0; i < length;)
+    {
+        auto c = (unsigned char)data[i++];
+        if (c < 0x80)
+        {
+            out[n++] = c;
+            continue;
+        }
+        unsigned extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+        uint32_t code = c & (0x3F >> extra);
+        bool valid = extra > 0;
+        for (unsigned k = 0; valid && k < extra; ++k)
+        {
+            valid = i < length && ((unsigned char)data[i] & 0xC0) == 0x80;
+            if (valid) code = (code << 6) | (data[i++] & 0x3F);
+        }
+        if (!valid)
+        {
+            out[n++] = 0xFFFD;
+        }
+        else if (sizeof(wchar_t) == 2 && code >= 0x10000)
+        {
+            code -= 0x10000;
+            out[n++] = (wchar_t)(0xD800 + (code >> 10));
+            out[n++] = (wchar_t)(0xDC00 + (code & 0x3FF));
+        }
+        else
+        {
+            out[n++] = (wchar_t)code;
+        }
+    }
+    out.resize(n);
+}
+
+// the digits of a number as written, without padding zeros or a plus sign
+static void write_number(std::string& out, const wchar_t* text, size_t length, bool point)
+{
+    size_t i = 0;
+    bool negative = false;
+    if (i < length && (text[i] == '+' || text[i] == '-'))
+    {
+        negative = text[i++] == '-';
+    }
+    auto first = i;
+    while (i < length && text[i] != '.') ++i;
+    auto end = i;
+    bool dot = i < length;
+    auto fraction = dot ? i + 1 : i;
+    auto fractionEnd = length;
+    while (first < end && text[first] == '0') ++first;
+    while (fractionEnd > fraction && text[fractionEnd - 1] == '0') --fractionEnd;
+
+    if (first == end && fraction == fractionEnd)
+    {
+        out += '0';
+        return;
+    }
+    if (negative) out += '-';
+    for (auto k = first; k < end; ++k) out += (char)text[k];
+    if (fraction < fractionEnd)
+    {
+        out += '.';
+        for (auto k = fraction; k < fractionEnd; ++k) out += (char)text[k];
+    }
+    else if (dot && point)
+    {
+        out += '.';
+    }
+}
+
+Minifier::Minifier(Dialect::Kind dialect, const Sink& sink, Options options) :
+    dialect_(dialect),
+    sink_(sink),
+    options_(options),
+    keep_point_(dialect == Dialect::Fanuc || dialect == Dialect::Haas),
+    threads_(WorkPool::shared().size()),
+    line_(0)
+{
+    std::fill(std::begin(axes_), std::end(axes_), -1);
+    // U V W are incremental X Y Z on Fanuc style lathes, E is the
+    // extruder on printers and something else elsewhere
+    unsigned count = dialect == Dialect::RS274 || dialect == Dialect::LinuxCNC ? 9 : 6;
+    for (unsigned k = 0; k < count; ++k) axes_[AXIS_KINDS[k]] = k;
+    if (dialect == Dialect::Marlin) axes_[Token::E] = 9;
+
+    Modal unknown;
+    std::fill(std::begin(unknown.groups), std::end(unknown.groups), UNKNOWN);
+    std::fill(std::begin(unknown.position), std::end(unknown.position), UNKNOWN);
+    unknown.feed = unknown.speed = UNKNOWN;
+    original_ = written_ = unknown;
+    out_.reserve(OUT_BUFFER + 4096);
+}
+
+void Minifier::write(const char* data, size_t length)
+{
+    stats_.bytes_in += length;
+    while (length > 0)
+    {
+        // a chunk for every worker
+        auto take = std::min(length, CHUNK * threads_);
+        pending_.append(data, take);
+        data += take;
+        length -= take;
+        if (pending_.size() < CHUNK * threads_) continue;
+
+        auto last = pending_.rfind('\n');
+        if (last == std::string::npos) continue;
+        process_(pending_.data(), last + 1);
+        pending_.erase(0, last + 1);
+    }
+}
+
+void Minifier::finish()
+{
+    if (!pending_.empty())
+    {
+        if (pending_.back() != '\n') pending_ += '\n';
+        process_(pending_.data(), pending_.size());
+        pending_.clear();
+    }
+    flush_(true);
+}
+
+std::string Minifier::minify(Dialect::Kind dialect, const std::string& text,
+                             Options options, Stats* stats/* = nullptr */)
+{
+    std::string out;
+    Minifier minifier(dialect, [&](const char* data, size_t length) {
+        out.append(data, length);
+    }, options);
+    minifier.write(text.data(), text.length());
+    minifier.finish();
+    if (stats) *stats = minifier.stats();
+    return out;
+}
+
+// % alone on its line, or followed by a comment
+static bool is_percent_line(const std::wstring& text, size_t first, size_t end)
+{
+    auto i = first;
+    while (i < end && std::iswspace(text[i])) ++i;
+    if (i == end || text[i] != L'%') return false;
+    for (++i; i < end && std::iswspace(text[i]); ++i) { }
+    if (i == end || text[i] == L';') return true;
+    if (text[i] != L'(') return false;
+    auto close = text.find(L')', i);
+    if (close == std::wstring::npos || close >= end) return false;
+    for (i = close + 1; i < end && std::iswspace(text[i]); ++i) { }
+    return i == end;
+}
+
+void Minifier::process_(const char* data, size_t length)
+{
+    decode_utf8(data, length, text_);
+
+    // the % lines around a program go through as they are, the lines
+    // between them are cut into chunks
+    pieces_.clear();
+    auto lines = [&](size_t first, size_t end) {
+        while (first < end)
+        {
+            auto cut = end;
+            if (end - first > CHUNK)
+            {
+                cut = text_.find(L'\n', first + CHUNK);
+                cut = cut == std::wstring::npos || cut >= end ? end : cut + 1;
+            }
+            pieces_.push_back(Piece { first, cut, false, {}, std::nullopt });
+            first = cut;
+        }
+    };
+    size_t first = 0;
+    for (size_t from = 0; from < text_.length();)
+    {
+        auto percent = text_.find(L'%', from);
+        if (percent == std::wstring::npos) break;
+        auto start = text_.rfind(L'\n', percent);
+        start = start == std::wstring::npos || start < from ? from : start + 1;
+        auto end = text_.find(L'\n', percent);
+        end = end == std::wstring::npos ? text_.length() : end + 1;
+        from = end;
+        // a % in a comment is just text, the line is a block like any other
+        if (!is_percent_line(text_, start, end)) continue;
+        lines(first, start);
+        pieces_.push_back(Piece { start, end, true, {}, std::nullopt });
+        first = end;
+    }
+    lines(first, text_.length());
+
+    auto parse = [&](size_t piece) {
+        auto& p = pieces_[piece];
+        if (p.percent) return;
+        try {
+            p.blocks = parse_blocks(dialect_, text_.substr(p.first, p.end - p.first), (unsigned)p.first);
+        }
+        catch (PosException& e)
+        {
+            p.error = e;
+        }
+    };
+    WorkPool::shared().parallel_for(pieces_.size(), parse);
+
+    for (auto& p : pieces_)
+    {
+        if (p.error)
+        {
+            auto at = text_.begin() + std::min(p.first + p.error->position(), p.end);
+            auto line = line_ + std::count(text_.begin() + p.first, at, L'\n') + 1;
+            throw MinifyException("Line " + std::to_string(line) + ": " + p.error->what());
+        }
+        if (p.percent)
+        {
+            auto last = p.end;
+            while (last > p.first && std::iswspace(text_[last - 1])) --last;
+            auto size = out_.size();
+            out_.resize(size + (last - p.first) * 3);
+            auto out = Serializer::write_comment(&out_[size], text_.substr(p.first, last - p.first));
+            out_.resize(out - out_.data());
+            if (options_.crlf) out_ += '\r';
+            out_ += '\n';
+            ++line_;
+            continue;
+        }
+        stats_.blocks_in += p.blocks.size();
+        for (auto& block : p.blocks)
+        {
+            minify_(block, text_);
+            ++line_;
+            flush_(false);
+        }
+        // the blocks are done with, don't hold on to all of them
+        p.blocks = std::vector<Block>();
+    }
+}
+
+int Minifier::group_(float g) const
+{
+    if (g != std::floor(g)) return -1;
+    int code = (int)g;
+    if (dialect_ == Dialect::Marlin)
+    {
+        if (code >= 0 && code <= 3) return Motion;
+        if (code == 90 || code == 91) return Distance;
+        if (code == 20 || code == 21) return Units;
+        return -1;
+    }
+    switch (code)
+    {
+        case 0: case 1: case 2: case 3:
+        case 73: case 76: case 80: case 81: case 82: case 83:
+        case 84: case 85: case 86: case 87: case 88: case 89:
+            return Motion;
+        case 17: case 18: case 19:
+            return Plane;
+        case 90: case 91:
+            return Distance;
+        case 93: case 94: case 95:
+            return FeedMode;
+        case 20: case 21:
+            return Units;
+        case 40: case 41: case 42:
+            return Compensation;
+        case 98: case 99:
+            return Return;
+        case 54: case 55: case 56: case 57: case 58: case 59:
+            return Coordinates;
+        case 61: case 64:
+            return PathControl;
+        case 96: case 97:
+            return SpindleMode;
+        default:
+            return -1;
+    }
+}
+
+bool Minifier::is_active_comment_(const std::wstring& comment) const
+{
+    // messages and logs that controllers act on
+    static const wchar_t* active[] = { L"MSG,", L"DEBUG,", L"PRINT,", L"LOG", L"PROBE" };
+    if (comment.empty() || comment[0] != '(') return false;
+    for (auto prefix : active)
+    {
+        size_t i = 0;
+        while (prefix[i] && i + 1 < comment.length() &&
+               std::towupper(comment[i + 1]) == (wint_t)prefix[i]) ++i;
+        if (!prefix[i]) return true;
+    }
+    return false;
+}
+
+void Minifier::apply_(Modal& modal, const Block& block, std::vector<Action>& actions) const
+{
+    actions.clear();
+    bool other = false, lost = false, feed = false;
+    bool given[AXES] = {};
+    float target[AXES];
+
+    for (auto& w : block.data_words)
+    {
+        auto axis = axis_(w.kind);
+        if (axis >= 0)
+        {
+            given[axis] = true;
+            target[axis] = w.value;
+            continue;
+        }
+        switch (w.kind)
+        {
+            case Token::G:
+            {
+                auto group = group_(w.value);
+                if (group < 0)
+                {
+                    other = true;
+                    actions.push_back(Action { Token::G, w.value });
+                    break;
+                }
+                // the same coordinates are somewhere else now
+                if ((group == Units || group == Coordinates) && !same(modal.groups[group], w.value))
+                {
+                    lost = true;
+                }
+                // Marlin switches E along with the axes
+                if (group == Distance && dialect_ == Dialect::Marlin)
+                {
+                    modal.groups[Extruder] = w.value == 90 ? 82.f : 83.f;
+                }
+                modal.groups[group] = w.value;
+                break;
+            }
+            case Token::F:
+                modal.feed = w.value;
+                feed = true;
+                break;
+            case Token::S:
+                // Marlin commands take S as an argument
+                if (dialect_ != Dialect::Marlin)
+                {
+                    modal.speed = w.value;
+                    break;
+                }
+                actions.push_back(Action { w.kind, w.value });
+                break;
+            case Token::M:
+                if (dialect_ == Dialect::Marlin && (w.value == 82 || w.value == 83))
+                {
+                    modal.groups[Extruder] = w.value;
+                }
+                actions.push_back(Action { w.kind, w.value });
+                break;
+            default:
+                actions.push_back(Action { w.kind, w.value });
+                break;
+        }
+    }
+    // inverse time takes the feed of every move on its own
+    if (feed && modal.groups[FeedMode] == 93) actions.push_back(Action { Token::F, modal.feed });
+    if (lost) std::fill(std::begin(modal.position), std::end(modal.position), UNKNOWN);
+
+    bool any = std::find(std::begin(given), std::end(given), true) != std::end(given);
+    if (!any) return;
+
+    auto mode = modal.groups[Motion];
+    if (other || !(mode == 0 || mode == 1 || mode == 2 || mode == 3))
+    {
+        // G92, G28, canned cycles and the like take the words as given
+        if (!other) actions.push_back(Action { Token::G, mode });
+        for (unsigned k = 0; k < AXES; ++k)
+        {
+            if (given[k]) actions.push_back(Action { AXIS_KINDS[k], target[k] });
+        }
+        std::fill(std::begin(modal.position), std::end(modal.position), UNKNOWN);
+        return;
+    }
+
+    // an arc back to where it starts is a full circle
+    bool moves = mode >= 2;
+    bool relative[AXES] = {};
+    for (unsigned k = 0; k < AXES; ++k)
+    {
+        if (!given[k]) continue;
+        relative[k] = k == 9 ? modal.groups[Extruder] != 82 : modal.groups[Distance] != 90;
+        if (relative[k])
+        {
+            moves = true;
+            modal.position[k] = UNKNOWN;
+        }
+        else
+        {
+            moves |= !same(modal.position[k], target[k]);
+            modal.position[k] = target[k];
+        }
+    }
+    if (!moves) return;
+    actions.push_back(Action { Token::G, mode });
+    for (unsigned k = 0; k < AXES; ++k)
+    {
+        actions.push_back(Action { AXIS_KINDS[k], relative[k] ? target[k] : modal.position[k] });
+    }
+}
+
+void Minifier::minify_(const Block& block, const std::wstring& text)
+{
+    auto& modal = original_;
+    kept_.data_words.clear();
+    kept_.comments.clear();
+    kept_.number.reset();
+    if (options_.numbers) kept_.number = block.number;
+    for (auto& comment : block.comments)
+    {
+        if (options_.comments || is_active_comment_(comment)) kept_.comments.push_back(comment);
+    }
+
+    // modes in effect for the block, and whether it can be trimmed at all
+    float after[GROUPS];
+    std::copy(std::begin(modal.groups), std::end(modal.groups), after);
+    bool verbatim = is_cycle(modal.groups[Motion]);
+    bool lost = false;
+    // words that refer to block numbers: M97 P, M98 H, M99 P and the P and
+    // Q of the Fanuc and Haas lathe contour cycles G70 to G73
+    bool jump = false, call = false, contour = false;
+    bool p = false, q = false, h = false;
+    bool lathe = dialect_ == Dialect::Fanuc || dialect_ == Dialect::Haas;
+    unsigned seen = 0;
+    for (auto& w : block.data_words)
+    {
+        if (w.kind == Token::G)
+        {
+            contour |= lathe && w.value >= 70 && w.value <= 73 && w.value == std::trunc(w.value);
+            auto group = group_(w.value);
+            if (group < 0 || is_cycle(w.value) || (seen & (1u << group)))
+            {
+                verbatim = true;
+                continue;
+            }
+            seen |= 1u << group;
+            lost |= (group == Units || group == Coordinates) && !same(modal.groups[group], w.value);
+            after[group] = w.value;
+            if (group == Distance && dialect_ == Dialect::Marlin)
+            {
+                after[Extruder] = w.value == 90 ? 82.f : 83.f;
+            }
+        }
+        else if (w.kind == Token::M)
+        {
+            verbatim |= dialect_ == Dialect::Marlin;
+            jump |= w.value == 97 || w.value == 99;
+            call |= w.value == 98;
+        }
+        p |= w.kind == Token::P;
+        q |= w.kind == Token::Q;
+        h |= w.kind == Token::H;
+    }
+    if (!options_.numbers && ((jump && p) || (call && h) || (contour && p && q)))
+    {
+        throw MinifyException("Line " + std::to_string(line_ + 1) +
+                              ": the block refers to block numbers, keep the numbers");
+    }
+
+    bool straight = (after[Motion] == 0 || after[Motion] == 1) &&
+                    after[Compensation] != 41 && after[Compensation] != 42 && !lost;
+    for (auto& w : block.data_words)
+    {
+        bool drop = false;
+        auto axis = axis_(w.kind);
+        if (verbatim)
+        {
+        }
+        else if (w.kind == Token::G)
+        {
+            auto group = group_(w.value);
+            drop = same(modal.groups[group], w.value);
+            if (group == Distance) drop &= same(modal.groups[Extruder], after[Extruder]);
+        }
+        else if (w.kind == Token::F)
+        {
+            drop = same(modal.feed, w.value) && after[FeedMode] != 93;
+        }
+        else if (w.kind == Token::S)
+        {
+            drop = dialect_ != Dialect::Marlin && same(modal.speed, w.value);
+        }
+        else if (axis >= 0)
+        {
+            bool absolute = axis == 9 ? after[Extruder] == 82 : after[Distance] == 90;
+            drop = straight && absolute && same(modal.position[axis], w.value);
+        }
+        if (!drop) kept_.data_words.push_back(w);
+    }
+
+    // the shorter block has to do what the original does
+    apply_(original_, block, original_actions_);
+    apply_(written_, kept_, written_actions_);
+    bool equal = original_actions_.size() == written_actions_.size();
+    for (size_t i = 0; equal && i < original_actions_.size(); ++i)
+    {
+        equal = original_actions_[i].kind == written_actions_[i].kind &&
+                same(original_actions_[i].value, written_actions_[i].value);
+    }
+    equal &= same(original_.feed, written_.feed) && same(original_.speed, written_.speed);
+    for (unsigned g = 0; equal && g < GROUPS; ++g) equal = same(original_.groups[g], written_.groups[g]);
+    for (unsigned k = 0; equal && k < AXES; ++k) equal = same(original_.position[k], written_.position[k]);
+    if (!equal)
+    {
+        kept_.data_words = block.data_words;
+        written_ = original_;
+        ++stats_.fallbacks;
+    }
+
+    if (kept_.data_words.empty() && !kept_.number && kept_.comments.empty()) return;
+    write_block_(kept_, text);
+}
+
+void Minifier::write_block_(const Block& block, const std::wstring& text)
+{
+    if (block.number)
+    {
+        char buffer[16];
+        out_ += 'N';
+        out_.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), block.number->value).ptr);
+    }
+    for (auto& w : block.data_words)
+    {
+        out_ += LETTERS[w.kind];
+        // bare letters like the X of G28 X
+        if (w.length > 0) write_number(out_, text.data() + w.start, w.length, keep_point_);
+    }
+    // a ; comment runs to the end of the line
+    for (int semicolon = 0; semicolon < 2; ++semicolon)
+    {
+        for (auto& comment : block.comments)
+        {
+            if ((comment[0] == ';') != (semicolon == 1)) continue;
+            // ; comments of CRLF text end in the CR
+            auto length = comment.length();
+            if (comment[length - 1] == '\r') --length;
+            auto size = out_.size();
+            out_.resize(size + length * 3);
+            auto out = Serializer::write_comment(&out_[size], comment.substr(0, length));
+            out_.resize(out - out_.data());
+        }
+    }
+    if (options_.crlf) out_ += '\r';
+    out_ += '\n';
+    ++stats_.blocks_out;
+}
+
+void Minifier::flush_(bool all)
+{
+    if (out_.empty() || (!all && out_.size() < OUT_BUFFER)) return;
+    sink_(out_.data(), out_.size());
+    stats_.bytes_out += out_.size();
+    out_.clear();
+}
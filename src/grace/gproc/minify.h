@@ -0,0 +1,130 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dialect.h"
+#include "serializer.h"
+#include "types.h"
+
+class MinifyException : public std::runtime_error
+{
+public:
+    MinifyException(const std::string& msg) : std::runtime_error(msg) { }
+};
+
+/* Rewrites a program in as few bytes as a controller reads the same way,
+ * so that serial links keep up with short segments.
+ *
+ * The text goes through in pieces of any size. Runs of a few thousand
+ * lines are parsed on as many threads as there are cores and then trimmed
+ * in order, the modal state carrying over, so the size of the file doesn't
+ * matter. Comments, N numbers, spaces and empty blocks go, as
+ * do G words of a modal group that is already in that mode, F and S values
+ * already in effect and axis words of straight absolute moves that don't
+ * move that axis. Numbers keep their digits and only lose padding zeros
+ * and plus signs. Blocks with other G codes, canned cycles and Marlin
+ * commands keep all their words.
+ *
+ * Each block written is run through a modal interpreter next to the
+ * original, and has to leave the same state behind and move and switch
+ * the same way. A block that doesn't is written with all its words.
+ */
+class Minifier {
+public:
+    struct Options {
+        // keep N words, which M97 P, M98 H, M99 P and the P and Q of
+        // lathe cycles refer to; without them such a program is refused
+        bool numbers = false;
+        // keep comments, (MSG,...) and the like are kept anyway
+        bool comments = false;
+        bool crlf = false;
+    };
+    struct Stats {
+        size_t bytes_in = 0;
+        size_t bytes_out = 0;
+        size_t blocks_in = 0;
+        size_t blocks_out = 0;
+        // blocks written as they were, the shorter form didn't check out
+        size_t fallbacks = 0;
+    };
+    using Sink = Serializer::Sink;
+    //
+    Minifier(Dialect::Kind dialect, const Sink& sink) : Minifier(dialect, sink, Options()) { }
+    Minifier(Dialect::Kind dialect, const Sink& sink, Options options);
+    // UTF-8 text, pieces may end anywhere
+    void write(const char* data, size_t length);
+    // writes out what is left after the last piece
+    void finish();
+    const Stats& stats() const { return stats_; }
+
+    static std::string minify(Dialect::Kind dialect, const std::string& text,
+                              Options options, Stats* stats = nullptr);
+
+private:
+    enum Group {
+        Motion, Plane, Distance, FeedMode, Units, Compensation, Return,
+        Coordinates, PathControl, SpindleMode, Extruder, GROUPS
+    };
+    static const unsigned AXES = 10;
+    // what the controller keeps from block to block, NaN while unknown
+    struct Modal {
+        float groups[GROUPS];
+        float feed;
+        float speed;
+        float position[AXES];
+    };
+    // what a block makes the controller do besides changing modes
+    struct Action {
+        uint8_t kind;
+        float value;
+    };
+    // lines parsed together, or a % line that goes through as it is
+    struct Piece {
+        size_t first;
+        size_t end;
+        bool percent;
+        std::vector<Block> blocks;
+        std::optional<PosException> error;
+    };
+
+    void apply_(Modal& modal, const Block& block, std::vector<Action>& actions) const;
+    int axis_(Token::Type kind) const { return axes_[kind]; }
+    int group_(float g) const;
+    bool is_active_comment_(const std::wstring& comment) const;
+    void minify_(const Block& block, const std::wstring& text);
+    void process_(const char* data, size_t length);
+    void write_block_(const Block& block, const std::wstring& text);
+    void flush_(bool all);
+
+    Dialect::Kind dialect_;
+    Sink sink_;
+    Options options_;
+    Stats stats_;
+    // letter to axis, -1 for the other letters
+    int8_t axes_[Token::Comment];
+    // integral values written with a point keep it, X10. is not X10 on Fanuc
+    bool keep_point_;
+    // workers of the pool, each parses a chunk
+    unsigned threads_;
+
+    // the original program and what was written, as interpreted
+    Modal original_;
+    Modal written_;
+    std::vector<Action> original_actions_;
+    std::vector<Action> written_actions_;
+    Block kept_;
+
+    // text after the last full line, and the lines being worked on
+    std::string pending_;
+    std::wstring text_;
+    std::vector<Piece> pieces_;
+    size_t line_;
+    std::string out_;
+};
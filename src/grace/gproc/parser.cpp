@@ -2,36 +2,106 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
+#include <algorithm>
+#include <charconv>
+#include <cwchar>
+#include <cwctype>
+
 #include "parser.h"
 
-Parser::Parser(const std::wstring& text)
-    : lexer_(new Lexer(text)), text_(text)
+// a number as std::stof reads it, without a string of its own
+static bool to_float(const wchar_t* text, size_t length, float* value)
+{
+    char digits[64];
+    if (length >= sizeof(digits)) return false;
+    // from_chars takes no plus sign
+    if (length > 1 && text[0] == '+') ++text, --length;
+    for (size_t i = 0; i < length; ++i) digits[i] = (char)text[i];
+    auto result = std::from_chars(digits, digits + length, *value);
+    return result.ec == std::errc() && result.ptr == digits + length;
+}
+
+template <typename D>
+BasicParser<D>::BasicParser(const std::wstring& text, WordIndex* index/* = nullptr */)
+    : index_(index), lexer_(new Lexer(text, D::grammar.macros)),
+      cur_token_ { 0, 0, Token::Unknown }, next_token_ { 0, 0, Token::Unknown },
+      prev_end_(0), macros_(nullptr), text_(text)
 {
     /* next_token_ */
     /* cur_token_  */
 }
 
-Parser::~Parser()
+template <typename D>
+BasicParser<D>::~BasicParser()
 {
     delete lexer_;
 }
 
-Program Parser::parse()
+template <typename D>
+Program BasicParser<D>::parse()
 {
     Program program;
+    macros_ = &program.macros;
     advance_lexer_();
     advance_lexer_();
 
-    program.header = fetch_header_();
+    if constexpr (D::grammar.header == Dialect::HeaderRequired)
+    {
+        program.header = fetch_header_();
+    }
+    else if (cur_token_.type == Token::Percent)
+    {
+        program.header = fetch_header_();
+    }
+    else
+    {
+        program.header.present = false;
+    }
     while (next_token_.type != Token::EndOfFile)
     {
+        if constexpr (D::grammar.trailing_percent)
+        {
+            // whatever follows the closing % is not part of the program
+            if (cur_token_.type == Token::Percent) break;
+        }
         program.blocks.emplace_back(fetch_block_());
+        if (index_)
+        {
+            index_->add(program.blocks.back(), program.blocks.size() - 1);
+        }
+    }
+    if (index_)
+    {
+        index_->finalize(program.blocks.size());
     }
 
     return program;
 }
 
-Header Parser::fetch_header_()
+template <typename D>
+std::vector<Block> BasicParser<D>::parse_blocks()
+{
+    std::vector<Block> blocks;
+    MacroCode macros;
+    macros_ = &macros;
+    advance_lexer_();
+    advance_lexer_();
+
+    // every line ends its block, empty lines too
+    while (cur_token_.type != Token::EndOfFile)
+    {
+        blocks.emplace_back(fetch_block_());
+        if (blocks.back().statement || !macros.empty())
+        {
+            throw ParserException("Macros cannot be parsed apart from their program",
+                                  blocks.back().start, blocks.back().length);
+        }
+    }
+    return blocks;
+}
+
+template <typename D>
+Header BasicParser<D>::fetch_header_()
 {
     Header header;
 
@@ -61,74 +131,75 @@ Header Parser::fetch_header_()
             std::string("Expected <newline> ending header, not") + TokenType_ToString(cur_token_.type),
             cur_token_.start, cur_token_.length);
     }
+    pending_comments_.clear();
     advance_lexer_();
     return header;
 }
 
-Block Parser::fetch_block_()
+template <typename D>
+Block BasicParser<D>::fetch_block_()
 {
     Block block;
-    TokenSet rec_types;
-    WordSet rec_words;
+    // address letters seen, they are the token types up to Comment
+    uint32_t rec_types = 0;
+
+    block.start = cur_token_.start;
 
     if (cur_token_.type == Token::N)
     {
         block.number = BlockNumber(fetch_unsigned_());
     }
-    // prep words
-    while (cur_token_.type == Token::G)
+    constexpr auto& grammar = D::grammar;
+    if constexpr (grammar.macros)
     {
-        add_word_no_dupl_(block.data_words, rec_words);
+        if (cur_token_.type == Token::Hash || cur_token_.type == Token::Keyword)
+        {
+            block.statement = fetch_statement_();
+        }
     }
+    uint8_t order = 0;
     auto hasDimension = false;
-    // dimension words
-    while (cur_token_.type == Token::X ||
-           cur_token_.type == Token::Y ||
-           cur_token_.type == Token::Z ||
-           cur_token_.type == Token::U ||
-           cur_token_.type == Token::V ||
-           cur_token_.type == Token::W ||
-           cur_token_.type == Token::P ||
-           cur_token_.type == Token::Q ||
-           cur_token_.type == Token::R ||
-           cur_token_.type == Token::A ||
-           cur_token_.type == Token::B ||
-           cur_token_.type == Token::C)
+    // address letters are the token types up to Comment
+    while (cur_token_.type < Token::Comment)
     {
-        add_word_no_type_dupl_(block.data_words, rec_types);
-        hasDimension = true;
-    }
-    if (hasDimension)
-    {
-        // interpolation words
-        while (cur_token_.type == Token::I ||
-               cur_token_.type == Token::J ||
-               cur_token_.type == Token::K)
+        auto kind = cur_token_.type;
+        auto bit = Dialect::letter(kind);
+        if (!(grammar.letters & bit))
         {
-            add_word_no_type_dupl_(block.data_words, rec_types);
+            throw ParserException(
+                TokenType_ToString(kind) + " words are not allowed in " + D::name,
+                cur_token_.start, cur_token_.length);
         }
-        // advance words
-        while (cur_token_.type == Token::E ||
-               cur_token_.type == Token::F)
+        if constexpr (grammar.ordered)
         {
-            add_word_no_type_dupl_(block.data_words, rec_types);
+            if (grammar.order[kind] < order)
+            {
+                throw ParserException(
+                    std::string("Unexpected ") + TokenType_ToString(kind) + " after "
+                        + TokenType_ToString(block.data_words.back().kind),
+                    cur_token_.start, cur_token_.length);
+            }
+            order = grammar.order[kind];
         }
-    }
-    // spin word
-    if (cur_token_.type == Token::S)
-    {
-        block.data_words.emplace_back(fetch_word_());
-    }
-    // tool words
-    while (cur_token_.type == Token::D ||
-           cur_token_.type == Token::T)
-    {
-        add_word_no_type_dupl_(block.data_words, rec_types);
-    }
-    // aux words
-    while (cur_token_.type == Token::M)
-    {
-        add_word_no_dupl_(block.data_words, rec_words);
+        if ((grammar.needs_dimension & bit) && !hasDimension)
+        {
+            throw ParserException(
+                std::string("Expected a dimension word before ") + TokenType_ToString(kind),
+                cur_token_.start, cur_token_.length);
+        }
+        switch (grammar.duplicates[kind])
+        {
+            case Dialect::Once:
+                add_word_no_type_dupl_(block.data_words, rec_types);
+                break;
+            case Dialect::DistinctValues:
+                add_word_no_dupl_(block.data_words);
+                break;
+            case Dialect::Repeat:
+                block.data_words.emplace_back(fetch_word_());
+                break;
+        }
+        hasDimension |= (grammar.dimensions & bit) != 0;
     }
 
     if (!(cur_token_.type == Token::EndOfBlock ||
@@ -138,15 +209,25 @@ Block Parser::fetch_block_()
             std::string("Expected <newline> ending block, not ") + TokenType_ToString(cur_token_.type),
             cur_token_.start, cur_token_.length);
     }
+    block.length = cur_token_.start - block.start;
+    block.comments.swap(pending_comments_);
+    pending_comments_.clear();
     advance_lexer_();
     return block;
 }
 
-void Parser::add_word_no_dupl_(std::vector<Word>& words, WordSet& rec_words)
+template <typename D>
+void BasicParser<D>::add_word_no_dupl_(std::vector<Word>& words)
 {
     auto start = cur_token_.start;
     auto word = fetch_word_();
-    if (!rec_words.emplace(word).second)
+    // values of expressions are only known when they run, blocks are short
+    // enough to look through
+    auto duplicate = word.expression == NO_EXPRESSION &&
+        std::any_of(words.begin(), words.end(), [&](const Word& w) {
+            return w.expression == NO_EXPRESSION && w == word;
+        });
+    if (duplicate)
     {
         throw ParserException(
             std::string("Illegal duplicate ") + Word_ToString(word) + " within block",
@@ -155,28 +236,38 @@ void Parser::add_word_no_dupl_(std::vector<Word>& words, WordSet& rec_words)
     words.emplace_back(word);
 }
 
-void Parser::add_word_no_type_dupl_(std::vector<Word>& words, TokenSet& rec_types)
+template <typename D>
+void BasicParser<D>::add_word_no_type_dupl_(std::vector<Word>& words, uint32_t& rec_types)
 {
-    if (!rec_types.emplace(cur_token_.type).second)
+    auto bit = 1u << cur_token_.type;
+    if (rec_types & bit)
     {
         throw ParserException(
             std::string("Cannot specify ") + TokenType_ToString(cur_token_.type) + " twice within a block",
             cur_token_.start, cur_token_.length);
     }
+    rec_types |= bit;
     words.emplace_back(fetch_word_());
 }
 
-void Parser::advance_lexer_()
+template <typename D>
+void BasicParser<D>::advance_lexer_()
 {
+    prev_end_ = cur_token_.start + cur_token_.length;
     do {
         cur_token_ = next_token_;
         next_token_ = lexer_->next();
+        // comments belong to the block in which they are skipped
+        if (cur_token_.type == Token::Comment)
+        {
+            pending_comments_.emplace_back(text_.substr(cur_token_.start, cur_token_.length));
+        }
     }
-    // TODO: handle and store comments
     while (cur_token_.type == Token::Comment);
 }
 
-unsigned Parser::fetch_unsigned_()
+template <typename D>
+unsigned BasicParser<D>::fetch_unsigned_()
 {
     if (next_token_.type == Token::Number)
     {
@@ -194,15 +285,17 @@ unsigned Parser::fetch_unsigned_()
         next_token_.start, next_token_.length);
 }
 
-std::wstring Parser::fetch_comment_()
+template <typename D>
+std::wstring BasicParser<D>::fetch_comment_()
 {
     if (next_token_.type == Token::Comment)
     {
         try {
             auto ret = text_.substr(
                 next_token_.start, next_token_.length);
-            /* advance lexer afterward so we can have a unique exc path */
-            advance_lexer_(); advance_lexer_();
+            /* advance lexer afterward so we can have a unique exc path,
+               comments are skipped so a single step is enough */
+            advance_lexer_();
             return ret;
         }
         catch (...) { /* fallthrough */ }
@@ -212,24 +305,367 @@ std::wstring Parser::fetch_comment_()
         next_token_.start, next_token_.length);
 }
 
-Word Parser::fetch_word_()
+template <typename D>
+Word BasicParser<D>::fetch_word_()
 {
-    if (next_token_.type == Token::Number)
+    if constexpr (D::grammar.macros)
     {
-        auto kind = cur_token_.type;
-        try
+        auto type = next_token_.type;
+        if (type == Token::Hash || type == Token::LeftBracket ||
+            type == Token::Operator || type == Token::Keyword)
         {
-            // double or float?
-            float value = std::stof(text_.substr(
-                next_token_.start, next_token_.length));
-            /* advance lexer afterward so we can have a unique exc path */
-            advance_lexer_(); advance_lexer_();
-            return Word { kind, value };
+            // X#1, X-#1, X[#1+2.5]
+            Word word { cur_token_.type, 0 };
+            advance_lexer_();
+            word.start = cur_token_.start;
+            word.expression = macros_->begin();
+            compile_unary_();
+            macros_->emit(MacroCode::Return);
+            word.length = prev_end_ - word.start;
+            return word;
         }
-        catch (...) { /* fallthrough */ }
+    }
+
+    float value;
+    if (next_token_.type == Token::Number &&
+        to_float(text_.data() + next_token_.start, next_token_.length, &value))
+    {
+        // double or float?
+        Word word { cur_token_.type, value };
+        word.start = next_token_.start;
+        word.length = next_token_.length;
+        /* advance lexer afterward so we can have a unique exc path */
+        advance_lexer_(); advance_lexer_();
+        return word;
+    }
+
+    if constexpr (D::grammar.bare_letters)
+    {
+        Word word { cur_token_.type, 0 };
+        word.start = cur_token_.start + cur_token_.length;
+        advance_lexer_();
+        return word;
     }
 
     throw ParserException(
         std::string("Expected <number> after ") + TokenType_ToString(cur_token_.type),
         next_token_.start, next_token_.length);
 }
+
+template <typename D>
+Statement BasicParser<D>::fetch_statement_()
+{
+    Statement statement { Statement::Assign };
+
+    if (at_keyword_(L"IF"))
+    {
+        advance_lexer_();
+        expect_(Token::LeftBracket, "[ after IF");
+        statement.condition = fetch_expression_();
+        if (at_keyword_(L"GOTO"))
+        {
+            advance_lexer_();
+            statement.kind = Statement::IfGoto;
+            statement.target = fetch_expression_();
+            return statement;
+        }
+        if (!at_keyword_(L"THEN"))
+        {
+            throw ParserException("Expected GOTO or THEN after IF",
+                                  cur_token_.start, cur_token_.length);
+        }
+        advance_lexer_();
+        expect_(Token::Hash, "#<parameter> after THEN");
+        statement.kind = Statement::IfAssign;
+    }
+    else if (at_keyword_(L"GOTO"))
+    {
+        advance_lexer_();
+        statement.kind = Statement::Goto;
+        statement.target = fetch_expression_();
+        return statement;
+    }
+    else if (at_keyword_(L"WHILE") || at_keyword_(L"END"))
+    {
+        if (at_keyword_(L"WHILE"))
+        {
+            advance_lexer_();
+            expect_(Token::LeftBracket, "[ after WHILE");
+            statement.kind = Statement::While;
+            statement.condition = fetch_expression_();
+            if (!at_keyword_(L"DO"))
+            {
+                throw ParserException("Expected DO after WHILE",
+                                      cur_token_.start, cur_token_.length);
+            }
+        }
+        else
+        {
+            statement.kind = Statement::End;
+        }
+        statement.label = fetch_unsigned_();
+        return statement;
+    }
+    else if (cur_token_.type != Token::Hash)
+    {
+        auto keyword = text_.substr(cur_token_.start, cur_token_.length);
+        throw ParserException("Unexpected " + std::string(keyword.begin(), keyword.end()),
+                              cur_token_.start, cur_token_.length);
+    }
+
+    // #target = value, the target is #<number> or #<expression>
+    advance_lexer_();
+    statement.target = macros_->begin();
+    if (cur_token_.type == Token::Number)
+    {
+        if (!macros_->emit_const(std::stod(text_.substr(cur_token_.start, cur_token_.length))))
+        {
+            throw ParserException("Too many macro constants", cur_token_.start, cur_token_.length);
+        }
+        advance_lexer_();
+    }
+    else
+    {
+        compile_primary_();
+    }
+    macros_->emit(MacroCode::Return);
+    expect_(Token::Equal, "= after #<parameter>");
+    advance_lexer_();
+    statement.value = fetch_expression_();
+    return statement;
+}
+
+template <typename D>
+uint32_t BasicParser<D>::fetch_expression_()
+{
+    auto start = macros_->begin();
+    compile_comparison_();
+    macros_->emit(MacroCode::Return);
+    return start;
+}
+
+template <typename D>
+void BasicParser<D>::compile_comparison_()
+{
+    static const std::pair<const wchar_t*, MacroCode::Op> COMPARISONS[] = {
+        { L"EQ", MacroCode::Eq }, { L"NE", MacroCode::Ne },
+        { L"GT", MacroCode::Gt }, { L"GE", MacroCode::Ge },
+        { L"LT", MacroCode::Lt }, { L"LE", MacroCode::Le },
+    };
+    compile_sum_();
+    for (auto& comparison : COMPARISONS)
+    {
+        if (!at_keyword_(comparison.first)) continue;
+        advance_lexer_();
+        compile_sum_();
+        macros_->emit(comparison.second);
+        return;
+    }
+}
+
+template <typename D>
+void BasicParser<D>::compile_sum_()
+{
+    compile_product_();
+    for (;;)
+    {
+        auto c = text_[cur_token_.start];
+        if (cur_token_.type == Token::Operator && (c == '+' || c == '-'))
+        {
+            advance_lexer_();
+            compile_product_();
+            macros_->emit(c == '+' ? MacroCode::Add : MacroCode::Sub);
+        }
+        else if (cur_token_.type == Token::Number && (c == '+' || c == '-'))
+        {
+            // #1+2 lexes as #1 and +2, the sign starts the next term
+            compile_product_();
+            macros_->emit(MacroCode::Add);
+        }
+        else if (at_keyword_(L"OR") || at_keyword_(L"XOR"))
+        {
+            auto op = at_keyword_(L"OR") ? MacroCode::Or : MacroCode::Xor;
+            advance_lexer_();
+            compile_product_();
+            macros_->emit(op);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+template <typename D>
+void BasicParser<D>::compile_product_()
+{
+    compile_unary_();
+    for (;;)
+    {
+        MacroCode::Op op;
+        // / is a division inside expressions, not a block skip
+        if (cur_token_.type == Token::Operator && text_[cur_token_.start] == '*') op = MacroCode::Mul;
+        else if (cur_token_.type == Token::OptBlockSkip) op = MacroCode::Div;
+        else if (at_keyword_(L"MOD")) op = MacroCode::Mod;
+        else if (at_keyword_(L"AND")) op = MacroCode::And;
+        else break;
+        advance_lexer_();
+        compile_unary_();
+        macros_->emit(op);
+    }
+}
+
+template <typename D>
+void BasicParser<D>::compile_unary_()
+{
+    if (cur_token_.type == Token::Operator && text_[cur_token_.start] != '*')
+    {
+        auto negate = text_[cur_token_.start] == '-';
+        advance_lexer_();
+        compile_unary_();
+        if (negate) macros_->emit(MacroCode::Neg);
+        return;
+    }
+    compile_primary_();
+}
+
+template <typename D>
+void BasicParser<D>::compile_primary_()
+{
+    static const std::pair<const wchar_t*, MacroCode::Op> FUNCTIONS[] = {
+        { L"SIN", MacroCode::Sin }, { L"COS", MacroCode::Cos }, { L"TAN", MacroCode::Tan },
+        { L"ASIN", MacroCode::Asin }, { L"ACOS", MacroCode::Acos }, { L"ATAN", MacroCode::Atan },
+        { L"SQRT", MacroCode::Sqrt }, { L"ABS", MacroCode::Abs }, { L"ROUND", MacroCode::Round },
+        { L"FIX", MacroCode::Fix }, { L"FUP", MacroCode::Fup },
+        { L"LN", MacroCode::Ln }, { L"EXP", MacroCode::Exp },
+    };
+
+    switch (cur_token_.type)
+    {
+        case Token::Number:
+            if (!macros_->emit_const(std::stod(text_.substr(cur_token_.start, cur_token_.length))))
+            {
+                throw ParserException("Too many macro constants", cur_token_.start, cur_token_.length);
+            }
+            advance_lexer_();
+            return;
+        case Token::Hash:
+            advance_lexer_();
+            if (cur_token_.type == Token::Number && iswdigit(text_[cur_token_.start]))
+            {
+                // the usual #1, no need to compute the number
+                auto number = std::stod(text_.substr(cur_token_.start, cur_token_.length));
+                if (number > MacroCode::MAX_OPERAND || !macros_->emit(MacroCode::Param, (uint32_t) number))
+                {
+                    throw ParserException("Parameter number out of range", cur_token_.start, cur_token_.length);
+                }
+                advance_lexer_();
+                return;
+            }
+            compile_primary_();
+            macros_->emit(MacroCode::ParamAt);
+            return;
+        case Token::LeftBracket:
+            advance_lexer_();
+            compile_comparison_();
+            expect_(Token::RightBracket, "]");
+            advance_lexer_();
+            return;
+        case Token::Keyword:
+            for (auto& function : FUNCTIONS)
+            {
+                if (!at_keyword_(function.first)) continue;
+                advance_lexer_();
+                expect_(Token::LeftBracket, "[ after a function");
+                compile_primary_();
+                // ATAN[y]/[x] takes the quadrant into account
+                if (function.second == MacroCode::Atan &&
+                    cur_token_.type == Token::OptBlockSkip && next_token_.type == Token::LeftBracket)
+                {
+                    advance_lexer_();
+                    compile_primary_();
+                    macros_->emit(MacroCode::Atan2);
+                    return;
+                }
+                macros_->emit(function.second);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    throw ParserException(
+        std::string("Expected an expression, not ") + TokenType_ToString(cur_token_.type),
+        cur_token_.start, cur_token_.length);
+}
+
+template <typename D>
+bool BasicParser<D>::at_keyword_(const wchar_t* keyword)
+{
+    return cur_token_.type == Token::Keyword &&
+           std::equal(keyword, keyword + std::wcslen(keyword),
+                      text_.begin() + cur_token_.start, text_.begin() + cur_token_.start + cur_token_.length,
+                      [](wchar_t a, wchar_t b) { return a == (wchar_t) towupper(b); });
+}
+
+template <typename D>
+void BasicParser<D>::expect_(Token::Type type, const char* what)
+{
+    if (cur_token_.type != type)
+    {
+        throw ParserException(std::string("Expected ") + what + ", not " + TokenType_ToString(cur_token_.type),
+                              cur_token_.start, cur_token_.length);
+    }
+}
+
+template class BasicParser<Dialect::RS274Grammar>;
+template class BasicParser<Dialect::FanucGrammar>;
+template class BasicParser<Dialect::HaasGrammar>;
+template class BasicParser<Dialect::LinuxCNCGrammar>;
+template class BasicParser<Dialect::MarlinGrammar>;
+
+Program parse_program(Dialect::Kind dialect, const std::wstring& text, WordIndex* index/* = nullptr */)
+{
+    switch (dialect)
+    {
+        case Dialect::Fanuc:
+            return BasicParser<Dialect::FanucGrammar>(text, index).parse();
+        case Dialect::Haas:
+            return BasicParser<Dialect::HaasGrammar>(text, index).parse();
+        case Dialect::LinuxCNC:
+            return BasicParser<Dialect::LinuxCNCGrammar>(text, index).parse();
+        case Dialect::Marlin:
+            return BasicParser<Dialect::MarlinGrammar>(text, index).parse();
+        default:
+            return BasicParser<Dialect::RS274Grammar>(text, index).parse();
+    }
+}
+
+std::vector<Block> parse_blocks(Dialect::Kind dialect, const std::wstring& text, unsigned offset/* = 0 */)
+{
+    std::vector<Block> blocks;
+    switch (dialect)
+    {
+        case Dialect::Fanuc:
+            blocks = BasicParser<Dialect::FanucGrammar>(text).parse_blocks();
+            break;
+        case Dialect::Haas:
+            blocks = BasicParser<Dialect::HaasGrammar>(text).parse_blocks();
+            break;
+        case Dialect::LinuxCNC:
+            blocks = BasicParser<Dialect::LinuxCNCGrammar>(text).parse_blocks();
+            break;
+        case Dialect::Marlin:
+            blocks = BasicParser<Dialect::MarlinGrammar>(text).parse_blocks();
+            break;
+        default:
+            blocks = BasicParser<Dialect::RS274Grammar>(text).parse_blocks();
+            break;
+    }
+    for (auto& block : blocks)
+    {
+        block.start += offset;
+        for (auto& w : block.data_words) w.start += offset;
+    }
+    return blocks;
+}
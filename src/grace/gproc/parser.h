@@ -6,33 +6,68 @@
 
 #include <optional>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
+#include "dialect.h"
+#include "index.h"
 #include "lexer.h"
 #include "types.h"
 
 class ParserException : public PosException { using PosException::PosException; }; // private inheritance markup?
 
 
-class Parser {
+/* Parser specialized for the grammar of dialect D (see dialect.h). */
+template <typename D>
+class BasicParser {
 public:
-    Parser(const std::wstring& text);
-    ~Parser();
+    BasicParser(const std::wstring& text, WordIndex* index = nullptr);
+    ~BasicParser();
     Program parse();
+    // blocks of a few whole lines from inside a program, without a header
+    std::vector<Block> parse_blocks();
 
 private:
-    void add_word_no_dupl_(std::vector<Word>& words, WordSet& rec_words);
-    void add_word_no_type_dupl_(std::vector<Word>& words, TokenSet& rec_types);
+    void add_word_no_dupl_(std::vector<Word>& words);
+    void add_word_no_type_dupl_(std::vector<Word>& words, uint32_t& rec_types);
     void advance_lexer_();
+    bool at_keyword_(const wchar_t* keyword);
+    void compile_comparison_();
+    void compile_primary_();
+    void compile_product_();
+    void compile_sum_();
+    void compile_unary_();
+    void expect_(Token::Type type, const char* what);
     Block fetch_block_();
+    uint32_t fetch_expression_();
+    Statement fetch_statement_();
     std::wstring fetch_comment_();
     Header fetch_header_();
     unsigned fetch_unsigned_();
     Word fetch_word_();
 
+    WordIndex* index_;
     Lexer* lexer_;
+    std::vector<std::wstring> pending_comments_;
     Token::Token cur_token_;
     Token::Token next_token_;
+    // end of the last token consumed
+    unsigned prev_end_;
+    // expressions of the program being parsed
+    MacroCode* macros_;
     const std::wstring& text_;
 };
+
+using Parser = BasicParser<Dialect::RS274Grammar>;
+
+extern template class BasicParser<Dialect::RS274Grammar>;
+extern template class BasicParser<Dialect::FanucGrammar>;
+extern template class BasicParser<Dialect::HaasGrammar>;
+extern template class BasicParser<Dialect::LinuxCNCGrammar>;
+extern template class BasicParser<Dialect::MarlinGrammar>;
+
+/* Picks the parser for a dialect chosen at runtime, once per program. */
+Program parse_program(Dialect::Kind dialect, const std::wstring& text, WordIndex* index = nullptr);
+/* Parses lines cut from a program, one block per line, for editing a
+ * ProgramSnapshot. Text positions start at offset. Expressions need the
+ * rest of the program and are refused. */
+std::vector<Block> parse_blocks(Dialect::Kind dialect, const std::wstring& text, unsigned offset = 0);
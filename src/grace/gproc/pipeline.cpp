@@ -0,0 +1,163 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+
+#include "footprint.h"
+#include "pipeline.h"
+#include "pool.h"
+
+// blocks handed to all passes at a time, a few hundred KB with their words
+static const unsigned TILE = 1024;
+// not worth a part of its own for fewer blocks
+static const unsigned MIN_PART = 16384;
+
+void AnalysisPipeline::run(const Program& program) const
+{
+    auto& blocks = program.blocks;
+    auto& pool = WorkPool::shared();
+    size_t parts = pool.size();
+    parts = std::min(parts, blocks.size() / MIN_PART + 1);
+    auto chunk = (blocks.size() + parts - 1) / parts;
+
+    for (auto pass : passes_) pass->begin(program, (unsigned) parts);
+    pool.parallel_for(parts, [&](size_t part) {
+        auto first = std::min(part * chunk, blocks.size());
+        auto end = std::min(first + chunk, blocks.size());
+        for (auto tile = first; tile < end; tile += TILE)
+        {
+            auto tileEnd = std::min<size_t>(tile + TILE, end);
+            for (auto pass : passes_) pass->run((unsigned) part, blocks, (unsigned) tile, (unsigned) tileEnd);
+        }
+    });
+    for (auto pass : passes_) pass->end();
+}
+
+/* */
+
+void SpeedPass::begin(const Program&, unsigned parts)
+{
+    parts_.assign(parts, Part());
+}
+
+void SpeedPass::run(unsigned part, const std::vector<Block>& blocks, unsigned first, unsigned end)
+{
+    auto& p = parts_[part];
+    for (unsigned i = first; i < end; ++i)
+    {
+        for (auto& w : blocks[i].data_words)
+        {
+            if (w.kind == Token::G)
+            {
+                if (w.value == 70) p.exit_imperial = 1;
+                else if (w.value == 71) p.exit_imperial = 0;
+                else if (w.value == 96) p.exit_css = 1;
+                else if (w.value == 97) p.exit_css = 0;
+            }
+            else if (w.kind == Token::S)
+            {
+                p.blocks.push_back(i);
+                p.values.push_back(w.value);
+                p.css.push_back(p.exit_css);
+                p.imperial.push_back(p.exit_imperial);
+            }
+        }
+    }
+}
+
+void SpeedPass::end()
+{
+    size_t count = 0;
+    for (auto& p : parts_) count += p.blocks.size();
+    blocks_.clear();
+    values_.clear();
+    css_.clear();
+    imperial_.clear();
+    blocks_.reserve(count);
+    values_.reserve(count);
+    css_.reserve(count);
+    imperial_.reserve(count);
+
+    // default G97, G71
+    int8_t css = 0, imperial = 0;
+    for (auto& p : parts_)
+    {
+        blocks_.insert(blocks_.end(), p.blocks.begin(), p.blocks.end());
+        values_.insert(values_.end(), p.values.begin(), p.values.end());
+        for (size_t i = 0; i < p.blocks.size(); ++i)
+        {
+            css_.push_back(p.css[i] < 0 ? css : p.css[i]);
+            imperial_.push_back(p.imperial[i] < 0 ? imperial : p.imperial[i]);
+        }
+        if (p.exit_css >= 0) css = p.exit_css;
+        if (p.exit_imperial >= 0) imperial = p.exit_imperial;
+    }
+    parts_.clear();
+}
+
+std::vector<SpeedVisitor::SpeedRecord> SpeedPass::records(const SpeedVisitor::RefData& data) const
+{
+    std::vector<SpeedVisitor::SpeedRecord> records;
+    records.reserve(size());
+    auto rpm = 1000.f / (PI_F * data.toolDiameter);
+    for (size_t i = 0; i < size(); ++i)
+    {
+        // the math of SpeedVisitor::calcSpindleSpeed
+        auto factor = css_[i] ? 1 : rpm;
+        if (imperial_[i]) factor /= 39.37f;
+        records.emplace_back(SpeedVisitor::SpeedRecord {
+            blocks_[i], values_[i], data.cuttingSpeedLo * factor, data.cuttingSpeedHi * factor });
+    }
+    return records;
+}
+
+size_t SpeedPass::memory_usage() const
+{
+    return Footprint::of(parts_) + Footprint::of(blocks_) + Footprint::of(values_) +
+           Footprint::of(css_) + Footprint::of(imperial_);
+}
+
+/* */
+
+void RangePass::begin(const Program&, unsigned parts)
+{
+    parts_.assign(parts, std::vector<Range>(Token::Comment));
+}
+
+void RangePass::run(unsigned part, const std::vector<Block>& blocks, unsigned first, unsigned end)
+{
+    auto ranges = parts_[part].data();
+    for (unsigned i = first; i < end; ++i)
+    {
+        for (auto& w : blocks[i].data_words)
+        {
+            // values of expressions are only known when they run
+            if (w.expression != NO_EXPRESSION) continue;
+            auto& range = ranges[w.kind];
+            range.min = std::min(range.min, w.value);
+            range.max = std::max(range.max, w.value);
+            ++range.count;
+        }
+    }
+}
+
+void RangePass::end()
+{
+    ranges_.assign(Token::Comment, Range());
+    for (auto& part : parts_)
+    {
+        for (unsigned k = 0; k < ranges_.size(); ++k)
+        {
+            ranges_[k].min = std::min(ranges_[k].min, part[k].min);
+            ranges_[k].max = std::max(ranges_[k].max, part[k].max);
+            ranges_[k].count += part[k].count;
+        }
+    }
+    parts_.clear();
+}
+
+size_t RangePass::memory_usage() const
+{
+    return Footprint::of(parts_) + Footprint::of(ranges_);
+}
@@ -0,0 +1,106 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+/* An analysis run by an AnalysisPipeline.
+ *
+ * The blocks are split into parts that run on separate threads. A pass
+ * keeps a result per part and sees the blocks of a part in order, but not
+ * the state the part starts in: whatever depends on earlier blocks (G70,
+ * G96 and the like) is left open and settled by end(), which gets the
+ * parts in program order.
+ */
+class AnalysisPass {
+public:
+    virtual ~AnalysisPass() { }
+    // before any block, with the number of parts
+    virtual void begin(const Program& program, unsigned parts) = 0;
+    // blocks [first, end) of a part, called from the part's thread
+    virtual void run(unsigned part, const std::vector<Block>& blocks,
+                     unsigned first, unsigned end) = 0;
+    // merges the parts, on the thread that ran the pipeline
+    virtual void end() = 0;
+};
+
+/* Runs several analyses in a single pass over the blocks.
+ *
+ * Each thread walks its part in tiles small enough to stay in cache and
+ * hands every tile to all passes before moving on, so the blocks are read
+ * from memory once however many analyses there are.
+ */
+class AnalysisPipeline {
+public:
+    // the pipeline doesn't own its passes
+    void add(AnalysisPass* pass) { passes_.push_back(pass); }
+    void run(const Program& program) const;
+
+private:
+    std::vector<AnalysisPass*> passes_;
+};
+
+/* S words with the modal state they were programmed in, what SpeedVisitor
+ * and SpeedSweep check. */
+class SpeedPass : public AnalysisPass {
+public:
+    void begin(const Program& program, unsigned parts) override;
+    void run(unsigned part, const std::vector<Block>& blocks,
+             unsigned first, unsigned end) override;
+    void end() override;
+
+    size_t size() const { return blocks_.size(); }
+    unsigned block(size_t i) const { return blocks_[i]; }
+    float value(size_t i) const { return values_[i]; }
+    // G96 constant surface speed rather than G97 rpm
+    bool css(size_t i) const { return css_[i]; }
+    // G70
+    bool imperial(size_t i) const { return imperial_[i]; }
+    // same records as SpeedVisitor
+    std::vector<SpeedVisitor::SpeedRecord> records(const SpeedVisitor::RefData& data) const;
+    size_t memory_usage() const;
+
+private:
+    // -1 while a part hasn't set the mode itself
+    struct Part {
+        std::vector<unsigned> blocks;
+        std::vector<float> values;
+        std::vector<int8_t> css;
+        std::vector<int8_t> imperial;
+        int8_t exit_css = -1;
+        int8_t exit_imperial = -1;
+    };
+    std::vector<Part> parts_;
+    std::vector<unsigned> blocks_;
+    std::vector<float> values_;
+    std::vector<uint8_t> css_;
+    std::vector<uint8_t> imperial_;
+};
+
+/* Smallest and largest value programmed for each address letter. */
+class RangePass : public AnalysisPass {
+public:
+    struct Range {
+        float min = INFINITY;
+        float max = -INFINITY;
+        unsigned count = 0;
+    };
+    //
+    RangePass() : ranges_(Token::Comment) { }
+    void begin(const Program& program, unsigned parts) override;
+    void run(unsigned part, const std::vector<Block>& blocks,
+             unsigned first, unsigned end) override;
+    void end() override;
+    // address letters are the token types up to Comment
+    const Range& range(Token::Type kind) const { return ranges_[kind]; }
+    size_t memory_usage() const;
+
+private:
+    std::vector<std::vector<Range>> parts_;
+    std::vector<Range> ranges_;
+};
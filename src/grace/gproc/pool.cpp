@@ -0,0 +1,199 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <exception>
+
+#include "pool.h"
+
+// index of the worker running on this thread, -1 elsewhere
+static thread_local int current_worker = -1;
+// priority of the job running on this thread
+static thread_local WorkPool::Priority current_priority = WorkPool::Foreground;
+
+WorkPool::WorkPool(unsigned workers/* = 0 */)
+    : background_running_(0), next_worker_(0), stop_(false)
+{
+    if (workers == 0)
+    {
+        workers = std::max(2u, std::thread::hardware_concurrency());
+    }
+    background_limit_ = std::max(1u, workers / 4);
+    pending_[Foreground] = 0;
+    pending_[Background] = 0;
+
+    for (unsigned i = 0; i < workers; ++i)
+    {
+        workers_.emplace_back(new Worker);
+    }
+    for (unsigned i = 0; i < workers; ++i)
+    {
+        threads_.emplace_back(&WorkPool::run_, this, i);
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+WorkPool& WorkPool::shared()
+{
+    static WorkPool pool;
+    return pool;
+}
+
+void WorkPool::submit(Job job, Priority priority/* = Background */)
+{
+    // jobs spawned by a job stay local, the others are spread around
+    auto index = current_worker >= 0 ? (unsigned)current_worker :
+        next_worker_++ % workers_.size();
+    {
+        // count first so the counter never drops below the queued jobs
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        ++pending_[priority];
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+        workers_[index]->queues[priority].emplace_back(std::move(job));
+    }
+    wake_.notify_one();
+}
+
+void WorkPool::parallel_for(size_t count, const std::function<void(size_t)>& fn)
+{
+    if (count == 0) return;
+    if (count == 1 || workers_.size() == 1)
+    {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    // shared with the helpers, some of which may only start once all the
+    // items are taken and must then leave fn alone
+    struct Loop {
+        const std::function<void(size_t)>* fn;
+        size_t count;
+        std::atomic<size_t> next { 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+        size_t done = 0;
+        std::exception_ptr error;
+
+        void work()
+        {
+            for (size_t i; (i = next++) < count;)
+            {
+                std::exception_ptr failed;
+                try {
+                    (*fn)(i);
+                }
+                catch (...) { failed = std::current_exception(); }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (failed && !error) error = failed;
+                if (++done == count) finished.notify_all();
+            }
+        }
+    };
+    auto loop = std::make_shared<Loop>();
+    loop->fn = &fn;
+    loop->count = count;
+
+    auto helpers = std::min(count, workers_.size()) - 1;
+    for (size_t i = 0; i < helpers; ++i)
+    {
+        submit([loop]() { loop->work(); }, current_priority);
+    }
+    loop->work();
+
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->finished.wait(lock, [&]() { return loop->done == count; });
+    if (loop->error) std::rethrow_exception(loop->error);
+}
+
+bool WorkPool::has_work_() const
+{
+    return pending_[Foreground] > 0 ||
+        (pending_[Background] > 0 && background_running_ < background_limit_);
+}
+
+bool WorkPool::pop_(unsigned self, Priority priority, Job& job)
+{
+    auto& worker = *workers_[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    auto& queue = worker.queues[priority];
+    if (queue.empty()) return false;
+    job = std::move(queue.back());
+    queue.pop_back();
+    return true;
+}
+
+bool WorkPool::steal_(unsigned self, Priority priority, Job& job)
+{
+    for (unsigned i = 1; i < workers_.size(); ++i)
+    {
+        auto& victim = *workers_[(self + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        auto& queue = victim.queues[priority];
+        if (queue.empty()) continue;
+        job = std::move(queue.front());
+        queue.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void WorkPool::run_(unsigned self)
+{
+    current_worker = self;
+    for (;;)
+    {
+        Job job;
+        auto priority = Foreground;
+        auto found = pop_(self, Foreground, job) || steal_(self, Foreground, job);
+        if (!found)
+        {
+            // take a background slot before looking for background work
+            auto running = background_running_.load();
+            while (running < background_limit_ &&
+                   !background_running_.compare_exchange_weak(running, running + 1)) { }
+            if (running < background_limit_)
+            {
+                found = pop_(self, Background, job) || steal_(self, Background, job);
+                priority = Background;
+                if (!found) --background_running_;
+            }
+        }
+
+        if (found)
+        {
+            --pending_[priority];
+            current_priority = priority;
+            try {
+                job();
+            }
+            catch (...) { /* a failing job must not take the worker down */ }
+            if (priority == Background)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex_);
+                    --background_running_;
+                }
+                // the freed slot may let a sleeping worker in
+                wake_.notify_one();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        if (stop_) return;
+        wake_.wait(lock, [this]() { return stop_ || has_work_(); });
+        if (stop_) return;
+    }
+}
@@ -0,0 +1,69 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Work-stealing thread pool shared by all documents.
+ *
+ * Every worker owns a deque per priority. Workers pop their own jobs LIFO
+ * and steal FIFO from the others, foreground work first. Background jobs
+ * only run on a limited number of workers at a time, so a pile of hidden
+ * documents can't starve the visible one.
+ *
+ * Work that splits into parts goes through parallel_for rather than
+ * threads of its own, so the parts of a background job stay within the
+ * background limit too.
+ */
+class WorkPool {
+public:
+    enum Priority {
+        Foreground,
+        Background,
+    };
+    using Job = std::function<void()>;
+    //
+    WorkPool(unsigned workers = 0);
+    ~WorkPool();
+    void submit(Job job, Priority priority = Background);
+    /* Runs fn(0) .. fn(count - 1) and returns once all of them are done,
+     * rethrowing the first exception one threw. Helpers are submitted at
+     * the priority of the calling job (foreground off the pool) and the
+     * caller takes items as well, so calling it from a job can't deadlock.
+     */
+    void parallel_for(size_t count, const std::function<void(size_t)>& fn);
+    unsigned size() const { return workers_.size(); }
+
+    static WorkPool& shared();
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> queues[2];
+    };
+    //
+    bool has_work_() const;
+    bool pop_(unsigned self, Priority priority, Job& job);
+    bool steal_(unsigned self, Priority priority, Job& job);
+    void run_(unsigned self);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<unsigned> pending_[2];
+    std::atomic<unsigned> background_running_;
+    unsigned background_limit_;
+    std::atomic<unsigned> next_worker_;
+    bool stop_;
+};
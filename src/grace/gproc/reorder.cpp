@@ -0,0 +1,522 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cmath>
+
+#include "pool.h"
+#include "reorder.h"
+
+static constexpr unsigned NONE = ~0u;
+// fewer operations leave nothing to reorder once the ends are fixed
+static constexpr unsigned MIN_OPERATIONS = 3;
+// candidate positions tried per operation and pass, bounds the work on
+// huge groups
+static constexpr size_t SEARCH_BUDGET = 4000000;
+
+static float distance(const float* a, const float* b)
+{
+    auto dx = a[0] - b[0], dy = a[1] - b[1];
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+// sets a word, or adds it where the ordered grammars expect it
+static void set_word(std::vector<Word>& words, Token::Type kind, float value)
+{
+    for (auto& word : words)
+    {
+        if (word.kind == kind)
+        {
+            word.value = value;
+            return;
+        }
+    }
+    auto it = std::find_if(words.begin(), words.end(),
+                           [&](const Word& word) { return word.kind > kind; });
+    words.insert(it, Word(kind, value));
+}
+
+/* Points on a grid of about two per cell, for nearest neighbour tours. */
+class PointGrid {
+public:
+    PointGrid(const std::vector<const float*>& points) :
+        points_(points)
+    {
+        float lo[2] = { INFINITY, INFINITY }, hi[2] = { -INFINITY, -INFINITY };
+        for (auto p : points)
+        {
+            for (unsigned k = 0; k < 2; ++k)
+            {
+                lo[k] = std::min(lo[k], p[k]);
+                hi[k] = std::max(hi[k], p[k]);
+            }
+        }
+        auto area = std::max((hi[0] - lo[0]) * (hi[1] - lo[1]), 1e-6f);
+        cell_ = std::max(std::sqrt(area * 2 / std::max<size_t>(points.size(), 1)), 1e-3f);
+        origin_[0] = lo[0];
+        origin_[1] = lo[1];
+        columns_ = (int) ((hi[0] - lo[0]) / cell_) + 1;
+        rows_ = (int) ((hi[1] - lo[1]) / cell_) + 1;
+        cells_.resize((size_t) columns_ * rows_);
+        slots_.resize(points.size());
+        remaining_.resize(points.size());
+        for (unsigned i = 0; i < points.size(); ++i)
+        {
+            auto& cell = cells_[cell_of_(points[i])];
+            slots_[i] = { (unsigned) cell.size(), i };
+            cell.push_back(i);
+            remaining_[i] = i;
+        }
+    }
+
+    // nearest point left, which is then taken out
+    unsigned take_nearest(const float* p)
+    {
+        auto best = NONE;
+        float best_distance = INFINITY;
+        auto consider = [&](unsigned i) {
+            auto d = distance(p, points_[i]);
+            if (d < best_distance) best_distance = d, best = i;
+        };
+        int cx = std::clamp((int) ((p[0] - origin_[0]) / cell_), 0, columns_ - 1);
+        int cy = std::clamp((int) ((p[1] - origin_[1]) / cell_), 0, rows_ - 1);
+        for (int r = 0; ; ++r)
+        {
+            // rings grow quadratically, a few points left are faster to scan
+            if ((size_t) (2 * r + 1) * (2 * r + 1) > 4 * remaining_.size() + 16)
+            {
+                for (auto i : remaining_) consider(i);
+                break;
+            }
+            for (int y = cy - r; y <= cy + r; ++y)
+            {
+                if (y < 0 || y >= rows_) continue;
+                int step = y == cy - r || y == cy + r ? 1 : 2 * r;
+                for (int x = cx - r; x <= cx + r; x += std::max(step, 1))
+                {
+                    if (x < 0 || x >= columns_) continue;
+                    for (auto i : cells_[(size_t) y * columns_ + x]) consider(i);
+                }
+            }
+            // points further out are at least r cells away
+            if (best != NONE && best_distance <= r * cell_) break;
+            if (r > columns_ && r > rows_) break;
+        }
+        remove_(best);
+        return best;
+    }
+
+private:
+    size_t cell_of_(const float* p) const
+    {
+        int x = std::clamp((int) ((p[0] - origin_[0]) / cell_), 0, columns_ - 1);
+        int y = std::clamp((int) ((p[1] - origin_[1]) / cell_), 0, rows_ - 1);
+        return (size_t) y * columns_ + x;
+    }
+
+    void remove_(unsigned i)
+    {
+        auto& cell = cells_[cell_of_(points_[i])];
+        auto moved = cell.back();
+        cell[slots_[i].first] = moved;
+        slots_[moved].first = slots_[i].first;
+        cell.pop_back();
+
+        moved = remaining_.back();
+        remaining_[slots_[i].second] = moved;
+        slots_[moved].second = slots_[i].second;
+        remaining_.pop_back();
+    }
+
+    const std::vector<const float*>& points_;
+    float origin_[2];
+    float cell_;
+    int columns_;
+    int rows_;
+    std::vector<std::vector<unsigned>> cells_;
+    // position of each point in its cell and in remaining_
+    std::vector<std::pair<unsigned, unsigned>> slots_;
+    std::vector<unsigned> remaining_;
+};
+
+/* */
+
+RapidReorder::RapidReorder(const Program& program, Options options) :
+    program_(program),
+    options_(options)
+{
+    // jumps and loops make the order of the text meaningless
+    if (!program.macros.empty()) return;
+    scan_();
+
+    WorkPool::shared().parallel_for(groups_.size(), [&](size_t g) {
+        solve_(groups_[g], plans_[g]);
+    });
+}
+
+void RapidReorder::scan_()
+{
+    // default G0, G17, G90, G71, starting at the origin; positions are in
+    // program units
+    float position[3] = { 0, 0, 0 };
+    unsigned motion = 0;
+    unsigned cycle = 0;
+    bool absolute = true;
+    bool xy_plane = true;
+    float units = 1;
+    float feed = 0;
+
+    // the run of operations being collected
+    bool open = false;
+    bool holes = false;
+    float clearance = 0;
+    unsigned first_op = 0;
+    Plan plan;
+
+    auto valid = [&](const Operation& op) {
+        return holes || (op.top <= clearance && op.bottom == clearance);
+    };
+    auto close = [&]() {
+        if (!open) return;
+        open = false;
+        // an operation that doesn't come back up can't be moved, nor end it
+        if (!ops_.empty() && ops_.size() > first_op && !valid(ops_.back())) ops_.pop_back();
+        auto count = (unsigned) ops_.size() - first_op;
+        if (count < MIN_OPERATIONS)
+        {
+            ops_.resize(first_op);
+            return;
+        }
+        groups_.push_back(Group {
+            ops_[first_op].first, ops_.back().end, holes, first_op, count, 0, 0 });
+        plans_.push_back(plan);
+    };
+    auto open_run = [&](bool cycleRun, const float* start) {
+        close();
+        open = true;
+        holes = cycleRun;
+        first_op = (unsigned) ops_.size();
+        plan = Plan { { start[0], start[1] }, units, NONE, {} };
+    };
+
+    auto& blocks = program_.blocks;
+    for (unsigned i = 0; i < blocks.size(); ++i)
+    {
+        auto& block = blocks[i];
+        if (block.data_words.empty() && !block.statement)
+        {
+            // comments and empty lines go with the operation before them
+            if (open && ops_.size() > first_op) ops_.back().end = i + 1;
+            continue;
+        }
+
+        bool allowed = !block.statement;
+        bool moves = true;
+        bool defines = false;
+        bool center = false;
+        std::optional<float> axes[3];
+        std::optional<float> feedWord;
+        auto newMotion = motion;
+        auto newCycle = cycle;
+        for (auto& w : block.data_words)
+        {
+            if (w.expression != NO_EXPRESSION) allowed = false;
+            switch (w.kind)
+            {
+                case Token::G:
+                {
+                    auto g = w.value;
+                    if (g == 0 || g == 1 || g == 2 || g == 3) newMotion = (unsigned) g, newCycle = 0;
+                    else if (g == 17) allowed &= xy_plane;
+                    else if (g == 18 || g == 19) xy_plane = false, allowed = false;
+                    else if (g == 90) allowed &= absolute, absolute = true;
+                    else if (g == 91) absolute = false, allowed = false;
+                    else if (g == 20 || g == 70 || g == 21 || g == 71)
+                    {
+                        float to = g == 20 || g == 70 ? 25.4f : 1;
+                        if (to != units)
+                        {
+                            for (auto& p : position) p *= units / to;
+                            feed *= units / to;
+                            units = to;
+                            allowed = false;
+                        }
+                    }
+                    else if (g == 80) newCycle = 0, allowed = false;
+                    else if (g >= 81 && g <= 89 && g == std::trunc(g)) newCycle = (unsigned) g, defines = true;
+                    else if (g == 98 || g == 99) defines = true;
+                    else
+                    {
+                        // dwell, offsets and reference returns take axis
+                        // words that don't describe a move
+                        if (g == 4 || g == 10 || g == 28 || g == 30 || g == 92) moves = false;
+                        allowed = false;
+                    }
+                    break;
+                }
+                case Token::X:
+                case Token::Y:
+                case Token::Z:
+                    axes[w.kind - Token::X] = w.value;
+                    break;
+                case Token::I:
+                case Token::J:
+                case Token::K:
+                    center = true;
+                    break;
+                case Token::R:
+                case Token::P:
+                case Token::Q:
+                    // cycle parameters, or the radius of an arc
+                    if (w.kind == Token::R) center = true;
+                    defines = true;
+                    break;
+                case Token::F:
+                    feedWord = w.value;
+                    break;
+                default:
+                    allowed = false;
+                    break;
+            }
+        }
+
+        float before[3] = { position[0], position[1], position[2] };
+        if (moves)
+        {
+            for (unsigned k = 0; k < 3; ++k)
+            {
+                if (axes[k]) position[k] = absolute ? *axes[k] : position[k] + *axes[k];
+            }
+        }
+        auto feedBefore = feed;
+        if (feedWord) feed = *feedWord;
+        motion = newMotion;
+        cycle = newCycle;
+        bool xy = axes[0] || axes[1];
+
+        if (!allowed || !absolute || !xy_plane)
+        {
+            close();
+            continue;
+        }
+        if (cycle)
+        {
+            // a new depth, feed or retract plane starts a new set of holes
+            if (defines || axes[2] || feedWord)
+            {
+                open_run(true, before);
+                if (xy) plan.cycle = i;
+                else continue;
+            }
+            else if (!xy || !open || !holes)
+            {
+                close();
+                continue;
+            }
+            Operation hole { i, i + 1, { position[0], position[1] }, { position[0], position[1] },
+                             feed, feed, position[2], position[2] };
+            ops_.push_back(hole);
+            continue;
+        }
+        if (defines && !center)
+        {
+            close();
+            continue;
+        }
+
+        bool entry = motion == 0 && xy && !center && before[2] == position[2];
+        if (entry)
+        {
+            if (!open || holes || !valid(ops_.back()) || position[2] != clearance)
+            {
+                open_run(false, before);
+                clearance = position[2];
+            }
+            Operation op { i, i + 1, { position[0], position[1] }, { position[0], position[1] },
+                           feedBefore, feed, position[2], position[2] };
+            ops_.push_back(op);
+        }
+        else if (open && !holes)
+        {
+            auto& op = ops_.back();
+            op.end = i + 1;
+            op.exit[0] = position[0];
+            op.exit[1] = position[1];
+            op.feed_out = feed;
+            op.top = std::max(op.top, position[2]);
+            op.bottom = position[2];
+        }
+        else if (open)
+        {
+            close();
+        }
+    }
+    close();
+}
+
+void RapidReorder::solve_(Group& group, Plan& plan) const
+{
+    auto n = group.op_count;
+    auto ops = ops_.data() + group.first_op;
+    // node n is where the tool starts, path[0] always
+    auto in = [&](unsigned node) { return node == n ? plan.start : ops[node].entry; };
+    auto out = [&](unsigned node) { return node == n ? plan.start : ops[node].exit; };
+    auto cost = [&](unsigned a, unsigned b) { return distance(out(a), in(b)); };
+    auto length = [&](const std::vector<unsigned>& path) {
+        double sum = 0;
+        for (size_t p = 0; p + 1 < path.size(); ++p) sum += cost(path[p], path[p + 1]);
+        return sum;
+    };
+
+    std::vector<unsigned> path(n + 1);
+    path[0] = n;
+    for (unsigned i = 0; i < n; ++i) path[i + 1] = i;
+    group.before = length(path) * plan.units;
+
+    // nearest neighbour tour, the last operation stays last
+    std::vector<const float*> entries;
+    for (unsigned i = 0; i + 1 < n; ++i) entries.push_back(ops[i].entry);
+    PointGrid grid(entries);
+    for (unsigned p = 1; p < n; ++p) path[p] = grid.take_nearest(out(path[p - 1]));
+
+    size_t window = std::min<size_t>(std::max<size_t>(SEARCH_BUDGET / n, 50), n);
+    const float epsilon = 1e-5f;
+    for (unsigned pass = 0; pass < options_.passes; ++pass)
+    {
+        bool improved = false;
+        // 2-opt, reversing a stretch of holes doesn't change its inside
+        if (group.holes)
+        {
+            for (size_t i = 1; i + 1 < n; ++i)
+            {
+                for (size_t j = i + 1; j < n && j < i + window; ++j)
+                {
+                    auto delta = cost(path[i - 1], path[j]) + cost(path[i], path[j + 1])
+                               - cost(path[i - 1], path[i]) - cost(path[j], path[j + 1]);
+                    if (delta < -epsilon)
+                    {
+                        std::reverse(path.begin() + i, path.begin() + j + 1);
+                        improved = true;
+                    }
+                }
+            }
+        }
+        // moving single operations, which works for one-way operations too
+        for (size_t i = 1; i < n; ++i)
+        {
+            auto gain = cost(path[i - 1], path[i]) + cost(path[i], path[i + 1])
+                      - cost(path[i - 1], path[i + 1]);
+            auto lo = i > window ? i - window : 1;
+            auto hi = std::min<size_t>(n, i + window);
+            size_t best = 0;
+            float bestDelta = -epsilon;
+            for (size_t k = lo; k <= hi; ++k)
+            {
+                // between path[k - 1] and path[k]
+                if (k == i || k == i + 1) continue;
+                auto delta = cost(path[k - 1], path[i]) + cost(path[i], path[k])
+                           - cost(path[k - 1], path[k]) - gain;
+                if (delta < bestDelta) bestDelta = delta, best = k;
+            }
+            if (!best) continue;
+            if (best < i) std::rotate(path.begin() + best, path.begin() + i, path.begin() + i + 1);
+            else std::rotate(path.begin() + i, path.begin() + i + 1, path.begin() + best);
+            improved = true;
+        }
+        if (!improved) break;
+    }
+
+    group.after = length(path) * plan.units;
+    plan.order.clear();
+    if (group.after < group.before)
+    {
+        for (size_t p = 1; p <= n; ++p) plan.order.push_back(group.first_op + path[p]);
+    }
+    else
+    {
+        group.after = group.before;
+        for (unsigned i = 0; i < n; ++i) plan.order.push_back(group.first_op + i);
+    }
+}
+
+double RapidReorder::before() const
+{
+    double sum = 0;
+    for (auto& group : groups_) sum += group.before;
+    return sum;
+}
+
+double RapidReorder::after() const
+{
+    double sum = 0;
+    for (auto& group : groups_) sum += group.after;
+    return sum;
+}
+
+Program RapidReorder::apply() const
+{
+    auto& blocks = program_.blocks;
+    Program result;
+    result.header = program_.header;
+    result.blocks.reserve(blocks.size());
+
+    unsigned next = 0;
+    for (size_t g = 0; g < groups_.size(); ++g)
+    {
+        auto& group = groups_[g];
+        auto& plan = plans_[g];
+        result.blocks.insert(result.blocks.end(), blocks.begin() + next, blocks.begin() + group.first);
+        next = group.end;
+
+        auto feed = ops_[group.first_op].feed_in;
+        for (size_t k = 0; k < plan.order.size(); ++k)
+        {
+            auto& op = ops_[plan.order[k]];
+            Block entry = blocks[op.first];
+            auto& words = entry.data_words;
+            if (group.holes)
+            {
+                // the cycle's parameters go with whichever hole comes first
+                if (op.first == plan.cycle && k > 0)
+                {
+                    words.erase(std::remove_if(words.begin(), words.end(), [](const Word& w) {
+                        return w.kind != Token::X && w.kind != Token::Y;
+                    }), words.end());
+                }
+                else if (plan.cycle != NONE && k == 0 && op.first != plan.cycle)
+                {
+                    std::vector<Word> cycleWords;
+                    for (auto& w : blocks[plan.cycle].data_words)
+                    {
+                        if (w.kind != Token::X && w.kind != Token::Y) cycleWords.push_back(w);
+                    }
+                    words.swap(cycleWords);
+                }
+            }
+            else
+            {
+                if (std::none_of(words.begin(), words.end(), [](const Word& w) {
+                        return w.kind == Token::G && w.value == 0; }))
+                {
+                    words.insert(std::find_if(words.begin(), words.end(), [](const Word& w) {
+                        return w.kind > Token::G;
+                    }), Word(Token::G, 0));
+                }
+                // the feed it used to inherit from the operation before
+                if (op.feed_in != feed && op.feed_in > 0 &&
+                    std::none_of(words.begin(), words.end(), [](const Word& w) { return w.kind == Token::F; }))
+                {
+                    set_word(words, Token::F, op.feed_in);
+                }
+                feed = op.feed_out;
+            }
+            set_word(words, Token::X, op.entry[0]);
+            set_word(words, Token::Y, op.entry[1]);
+            result.blocks.push_back(std::move(entry));
+            result.blocks.insert(result.blocks.end(), blocks.begin() + op.first + 1, blocks.begin() + op.end);
+        }
+    }
+    result.blocks.insert(result.blocks.end(), blocks.begin() + next, blocks.end());
+    return result;
+}
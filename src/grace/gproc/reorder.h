@@ -0,0 +1,91 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <vector>
+
+#include "types.h"
+
+/* Reorders independent operations of a program to shorten the rapids
+ * between them.
+ *
+ * Two kinds of operations can trade places without changing what is cut:
+ * the holes of a canned cycle (G81-G89 and the X/Y blocks after it), and
+ * milling operations that each start with an XY rapid at a common
+ * clearance height, stay below it and come back up to it. A group is a run
+ * of such operations with nothing in between that could change the tool
+ * or the modal state: blocks with other letters or G codes, incremental
+ * moves or macros end it. Each group keeps its first position and its last
+ * operation, so whatever follows sees the same state.
+ *
+ * Groups are solved in parallel: a nearest neighbour tour over a grid,
+ * then 2-opt for holes and moves of single operations for milling, until
+ * nothing shortens the rapids. Operations keep their blocks, the entries
+ * get their full XY and the feed they used to inherit.
+ */
+class RapidReorder {
+public:
+    struct Options {
+        // improvement passes over a group
+        unsigned passes = 16;
+    };
+    struct Group {
+        // blocks [first, end) hold the operations
+        unsigned first;
+        unsigned end;
+        bool holes;
+        // operations are ops()[first_op .. first_op + op_count)
+        unsigned first_op;
+        unsigned op_count;
+        // rapid distance between the operations in mm, as programmed and
+        // in the new order
+        double before;
+        double after;
+    };
+    //
+    RapidReorder(const Program& program) : RapidReorder(program, Options()) { }
+    RapidReorder(const Program& program, Options options);
+    const std::vector<Group>& groups() const { return groups_; }
+    // total rapid distance between operations, mm
+    double before() const;
+    double after() const;
+    // the program with each group in its new order
+    Program apply() const;
+
+private:
+    struct Operation {
+        // blocks [first, end)
+        unsigned first;
+        unsigned end;
+        // where the first rapid goes and where the operation ends
+        float entry[2];
+        float exit[2];
+        // modal F before and after the operation
+        float feed_in;
+        float feed_out;
+        // highest and last Z of the operation
+        float top;
+        float bottom;
+    };
+    struct Plan {
+        // where the tool is before the group, in program units
+        float start[2];
+        // mm per program unit
+        float units;
+        // block starting the canned cycle when it is also a hole
+        unsigned cycle;
+        // new order of the operations, indices into ops_
+        std::vector<unsigned> order;
+    };
+    //
+    void scan_();
+    void solve_(Group& group, Plan& plan) const;
+
+    const Program& program_;
+    Options options_;
+    std::vector<Operation> ops_;
+    std::vector<Group> groups_;
+    std::vector<Plan> plans_;
+};
@@ -0,0 +1,440 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <IOKit/serial/ioss.h>
+#endif
+#endif
+
+#include "sender.h"
+
+// sent lines kept around for Marlin to ask for again
+static const size_t HISTORY_LINES = 1024;
+// how often progress is reported, milliseconds
+static const int REPORT_INTERVAL = 100;
+
+#ifdef _WIN32
+
+SerialChannel::SerialChannel(const std::string& device, unsigned baud/* = 115200 */)
+{
+    // COM10 and up only open through the device namespace
+    auto name = "\\\\.\\" + device;
+    handle_ = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle_ == INVALID_HANDLE_VALUE)
+    {
+        throw ChannelException("Cannot open " + device + ", error " + std::to_string(GetLastError()));
+    }
+    DCB dcb = { sizeof(DCB) };
+    GetCommState(handle_, &dcb);
+    dcb.BaudRate = baud;
+    dcb.ByteSize = 8;
+    dcb.Parity = NOPARITY;
+    dcb.StopBits = ONESTOPBIT;
+    dcb.fBinary = TRUE;
+    dcb.fOutxCtsFlow = FALSE;
+    dcb.fRtsControl = RTS_CONTROL_ENABLE;
+    dcb.fDtrControl = DTR_CONTROL_ENABLE;
+    dcb.fOutX = dcb.fInX = FALSE;
+    SetCommState(handle_, &dcb);
+}
+
+SerialChannel::~SerialChannel()
+{
+    CloseHandle(handle_);
+}
+
+void SerialChannel::write(const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        DWORD written = 0;
+        if (!WriteFile(handle_, data, (DWORD)length, &written, NULL))
+        {
+            throw ChannelException("Write failed, error " + std::to_string(GetLastError()));
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+size_t SerialChannel::read(char* data, size_t length, int timeout_ms)
+{
+    // return as soon as anything is there, or after timeout
+    COMMTIMEOUTS timeouts = { MAXDWORD, MAXDWORD, (DWORD)timeout_ms, 0, 0 };
+    SetCommTimeouts(handle_, &timeouts);
+    DWORD count = 0;
+    if (!ReadFile(handle_, data, (DWORD)length, &count, NULL))
+    {
+        throw ChannelException("Read failed, error " + std::to_string(GetLastError()));
+    }
+    return count;
+}
+
+#else
+
+#if defined(__linux__) && defined(TCGETS2) && \
+    (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || defined(__arm__))
+// <asm/termbits.h> clashes with <termios.h>, its termios2 is this on
+// architectures with the generic layout
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#define GPROC_TERMIOS2
+static const tcflag_t KERNEL_CBAUD = 0010017;
+static const tcflag_t KERNEL_BOTHER = 0010000;
+#endif
+
+static speed_t standard_speed(unsigned baud)
+{
+    switch (baud)
+    {
+        case 1200:     return B1200;
+        case 2400:     return B2400;
+        case 4800:     return B4800;
+        case 9600:     return B9600;
+        case 19200:    return B19200;
+        case 38400:    return B38400;
+        case 57600:    return B57600;
+        case 115200:   return B115200;
+        case 230400:   return B230400;
+#ifdef B460800
+        case 460800:   return B460800;
+#endif
+#ifdef B921600
+        case 921600:   return B921600;
+#endif
+        default:       return B0;
+    }
+}
+
+// rates without a B constant, such as Marlin's 250000, after tcsetattr
+static bool set_custom_speed(int fd, unsigned baud)
+{
+#if defined(GPROC_TERMIOS2)
+    termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) != 0) return false;
+    tio.c_cflag = (tio.c_cflag & ~KERNEL_CBAUD) | KERNEL_BOTHER;
+    tio.c_ispeed = tio.c_ospeed = baud;
+    return ioctl(fd, TCSETS2, &tio) == 0;
+#elif defined(__APPLE__)
+    speed_t speed = baud;
+    return ioctl(fd, IOSSIOSPEED, &speed) == 0;
+#else
+    (void) fd;
+    (void) baud;
+    return false;
+#endif
+}
+
+SerialChannel::SerialChannel(const std::string& device, unsigned baud/* = 115200 */)
+{
+    fd_ = open(device.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd_ < 0)
+    {
+        throw ChannelException("Cannot open " + device + ": " + std::strerror(errno));
+    }
+    termios tio;
+    if (tcgetattr(fd_, &tio) == 0)
+    {
+        auto speed = standard_speed(baud);
+        cfmakeraw(&tio);
+        // a custom rate replaces this one below
+        cfsetspeed(&tio, speed != B0 ? speed : B9600);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(fd_, TCSANOW, &tio);
+        if (speed == B0 && !set_custom_speed(fd_, baud))
+        {
+            close(fd_);
+            throw ChannelException("Cannot set " + device + " to " + std::to_string(baud) + " baud");
+        }
+    }
+}
+
+SerialChannel::~SerialChannel()
+{
+    close(fd_);
+}
+
+void SerialChannel::write(const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        auto written = ::write(fd_, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0) throw ChannelException(std::string("Write failed: ") + std::strerror(errno));
+        data += written;
+        length -= written;
+    }
+}
+
+size_t SerialChannel::read(char* data, size_t length, int timeout_ms)
+{
+    pollfd fd = { fd_, POLLIN, 0 };
+    auto ready = poll(&fd, 1, timeout_ms);
+    if (ready < 0 && errno == EINTR) return 0;
+    if (ready < 0) throw ChannelException(std::string("Poll failed: ") + std::strerror(errno));
+    if (ready == 0) return 0;
+    auto count = ::read(fd_, data, length);
+    if (count < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+    // a pseudo-terminal whose other end went away reads as EIO
+    if (count <= 0) throw ChannelException("The controller went away");
+    return count;
+}
+
+#endif
+
+/* */
+
+Sender::Sender(Channel& channel, Options options)
+    : channel_(channel), options_(options), cancelled_(false), in_flight_bytes_(0),
+      next_(0), last_resend_(0), resend_acks_(0)
+{
+    Serializer::Options format;
+    // every byte counts against the controller's buffer
+    format.spaces = false;
+    format.comments = false;
+    format.numbering = Serializer::StripNumbers;
+    serializer_ = Serializer(format);
+}
+
+Sender::Options Sender::options_for(Dialect::Kind dialect)
+{
+    Options options;
+    if (dialect == Dialect::Marlin)
+    {
+        // Marlin's BUFSIZE
+        options.flow = LineCounting;
+        options.buffer = 4;
+        options.checksums = true;
+        // no realtime poll, busy messages keep a long move from going quiet
+        options.status_poll = false;
+    }
+    return options;
+}
+
+unsigned Sender::checksum(const char* line, size_t length)
+{
+    unsigned sum = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        sum ^= (unsigned char)line[i];
+    }
+    return sum;
+}
+
+bool Sender::fits_(size_t length) const
+{
+    // a line larger than the whole buffer goes out on its own
+    if (in_flight_.empty()) return true;
+    if (options_.flow == LineCounting) return in_flight_.size() < options_.buffer;
+    return in_flight_bytes_ + length <= options_.buffer;
+}
+
+Sender::Line Sender::make_line_(unsigned number, const std::string& command) const
+{
+    Line line { number, {} };
+    if (!options_.checksums)
+    {
+        line.text = command + "\n";
+        return line;
+    }
+    line.text = "N" + std::to_string(number) + " " + command;
+    line.text += "*" + std::to_string(checksum(line.text.data(), line.text.length())) + "\n";
+    return line;
+}
+
+void Sender::acknowledge_()
+{
+    if (in_flight_.empty()) return;
+    auto& pending = in_flight_.front();
+    in_flight_bytes_ -= pending.length;
+    if (pending.counts) ++progress_.acknowledged;
+    in_flight_.pop_front();
+    if (resend_acks_ > 0) --resend_acks_;
+}
+
+void Sender::rewind_(unsigned number)
+{
+    // lines already out after a garbled one each ask for it again
+    if (number == last_resend_ && resend_acks_ > 0) return;
+
+    auto it = std::find_if(history_.begin(), history_.end(),
+                           [&](const Line& line) { return line.number == number; });
+    if (it == history_.end())
+    {
+        progress_.error = "The controller asked for line " + std::to_string(number) + " again, which is gone";
+        cancelled_ = true;
+        return;
+    }
+    next_ = it - history_.begin();
+    last_resend_ = number;
+    resend_acks_ = in_flight_.size();
+    for (auto& pending : in_flight_)
+    {
+        if (pending.number >= number) pending.counts = false;
+    }
+}
+
+void Sender::on_response_(const std::string& response)
+{
+    if (response.compare(0, 2, "ok") == 0)
+    {
+        acknowledge_();
+    }
+    else if (response.compare(0, 5, "error") == 0 || response.compare(0, 5, "Error") == 0)
+    {
+        ++progress_.errors;
+        // Marlin follows up with an ok, Grbl doesn't
+        if (!options_.checksums) acknowledge_();
+    }
+    else if (response.compare(0, 7, "Resend:") == 0 || response.compare(0, 3, "rs ") == 0)
+    {
+        auto digits = response.find_first_of("0123456789");
+        if (digits != std::string::npos)
+        {
+            rewind_(std::stoul(response.substr(digits)));
+        }
+    }
+    // anything else is status, echo or busy chatter
+}
+
+Sender::Progress Sender::run(const Program& program, const ProgressCallback& callback)
+{
+    using namespace std::chrono;
+
+    progress_ = Progress();
+    in_flight_.clear();
+    in_flight_bytes_ = 0;
+    history_.clear();
+    next_ = 0;
+    resend_acks_ = 0;
+    for (auto& block : program.blocks)
+    {
+        if (!block.data_words.empty()) ++progress_.total;
+    }
+
+    if (options_.checksums)
+    {
+        // line numbers start over at 1
+        history_.emplace_back(make_line_(0, "M110 N0"));
+    }
+
+    auto started = steady_clock::now();
+    auto reported = started;
+    auto heard = started;
+    auto polled = false;
+    auto report = [&](steady_clock::time_point now) {
+        auto elapsed = duration<double>(now - started).count();
+        progress_.blocks_per_second = elapsed > 0 ? progress_.acknowledged / elapsed : 0;
+        if (callback) callback(progress_);
+        reported = now;
+    };
+
+    size_t block = 0;
+    unsigned number = 0;
+    std::string command;
+    std::string response;
+    char buffer[4096];
+    try {
+        while (!cancelled_)
+        {
+            // keep the controller's buffer as full as it goes
+            for (;;)
+            {
+                if (next_ == history_.size())
+                {
+                    while (block < program.blocks.size() && program.blocks[block].data_words.empty())
+                    {
+                        ++block;
+                    }
+                    if (block == program.blocks.size()) break;
+                    command.clear();
+                    serializer_.write(program.blocks[block++], command);
+                    command.pop_back();
+                    history_.emplace_back(make_line_(++number, command));
+                }
+                auto& line = history_[next_];
+                if (!fits_(line.text.length())) break;
+
+                channel_.write(line.text.data(), line.text.length());
+                in_flight_.push_back(Pending { line.text.length(), line.number, line.number > 0 });
+                in_flight_bytes_ += line.text.length();
+                progress_.sent = std::max<size_t>(progress_.sent, line.number);
+                ++next_;
+            }
+            while (history_.size() > HISTORY_LINES && next_ > 0)
+            {
+                history_.pop_front();
+                --next_;
+            }
+
+            if (next_ == history_.size() && block == program.blocks.size() && in_flight_.empty())
+            {
+                progress_.done = true;
+                break;
+            }
+
+            auto count = channel_.read(buffer, sizeof(buffer), REPORT_INTERVAL / 2);
+            auto now = steady_clock::now();
+            if (count > 0) heard = now, polled = false;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (buffer[i] == '\r') continue;
+                if (buffer[i] != '\n')
+                {
+                    response += buffer[i];
+                    continue;
+                }
+                on_response_(response);
+                response.clear();
+            }
+
+            if (duration_cast<milliseconds>(now - heard).count() > options_.timeout_ms)
+            {
+                if (options_.status_poll && !polled)
+                {
+                    // busy with what it has, a live controller answers this
+                    channel_.write("?", 1);
+                    polled = true;
+                    heard = now;
+                }
+                else
+                {
+                    progress_.error = "The controller stopped responding";
+                    break;
+                }
+            }
+            if (duration_cast<milliseconds>(now - reported).count() >= REPORT_INTERVAL)
+            {
+                report(now);
+            }
+        }
+    }
+    catch (ChannelException& e)
+    {
+        progress_.error = e.what();
+    }
+    report(steady_clock::now());
+    return progress_;
+}
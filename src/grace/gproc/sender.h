@@ -0,0 +1,134 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include "dialect.h"
+#include "serializer.h"
+#include "types.h"
+
+class ChannelException : public std::runtime_error
+{
+public:
+    ChannelException(const std::string& msg) : std::runtime_error(msg) { }
+};
+
+/* Byte stream to a controller. */
+class Channel {
+public:
+    virtual ~Channel() { }
+    virtual void write(const char* data, size_t length) = 0;
+    // waits up to timeout for data, returns 0 when none came
+    virtual size_t read(char* data, size_t length, int timeout_ms) = 0;
+};
+
+/* Serial port, or anything that looks like one such as a pseudo-terminal. */
+class SerialChannel : public Channel {
+public:
+    SerialChannel(const std::string& device, unsigned baud = 115200);
+#ifndef _WIN32
+    // takes over an open descriptor
+    explicit SerialChannel(int fd) : fd_(fd) { }
+#endif
+    ~SerialChannel();
+    void write(const char* data, size_t length);
+    size_t read(char* data, size_t length, int timeout_ms);
+
+private:
+#ifdef _WIN32
+    void* handle_;
+#else
+    int fd_;
+#endif
+};
+
+/* Streams a program to a controller as fast as it takes it.
+ *
+ * Grbl style controllers are fed by character counting: lines go out as
+ * long as the bytes of all unacknowledged lines fit in the controller's
+ * receive buffer, so the buffer never runs dry while the previous line is
+ * being planned. Marlin style controllers take a number of lines instead,
+ * each numbered and checksummed, and ask for a line again when it came
+ * through garbled.
+ */
+class Sender {
+public:
+    enum FlowControl {
+        CharacterCounting,
+        LineCounting,
+    };
+    struct Options {
+        FlowControl flow = CharacterCounting;
+        // receive buffer of the controller, in bytes or lines
+        unsigned buffer = 128;
+        // send N<line> ... *<checksum>
+        bool checksums = false;
+        // answer to silence: a dwell or a long slow move says nothing, so
+        // ask for a status report ('?') and give up when that goes
+        // unanswered for another timeout as well
+        bool status_poll = true;
+        // how long the controller may say nothing
+        int timeout_ms = 30000;
+    };
+    struct Progress {
+        size_t sent = 0;
+        size_t acknowledged = 0;
+        size_t total = 0;
+        size_t errors = 0;
+        double blocks_per_second = 0;
+        bool done = false;
+        std::string error;
+    };
+    using ProgressCallback = std::function<void(const Progress& progress)>;
+    //
+    Sender(Channel& channel, Options options);
+    // streams every block, returns when done, failed or cancelled
+    Progress run(const Program& program, const ProgressCallback& callback);
+    void cancel() { cancelled_ = true; }
+
+    static Options options_for(Dialect::Kind dialect);
+    // XOR of the bytes of line, as Marlin checks it
+    static unsigned checksum(const char* line, size_t length);
+
+private:
+    struct Line {
+        unsigned number;
+        std::string text;
+    };
+    struct Pending {
+        size_t length;
+        unsigned number;
+        // whether its ok means a block got through
+        bool counts;
+    };
+    //
+    bool fits_(size_t length) const;
+    Line make_line_(unsigned number, const std::string& command) const;
+    void acknowledge_();
+    void rewind_(unsigned number);
+    void on_response_(const std::string& response);
+
+    Channel& channel_;
+    Options options_;
+    Serializer serializer_;
+    std::atomic<bool> cancelled_;
+
+    // lines out but not acknowledged yet, oldest first
+    std::deque<Pending> in_flight_;
+    size_t in_flight_bytes_;
+    // lines that may be asked for again, and the next one to write
+    std::deque<Line> history_;
+    size_t next_;
+    // acks still due from before the last resend, which repeat its request
+    unsigned last_resend_;
+    size_t resend_acks_;
+    Progress progress_;
+};
@@ -0,0 +1,234 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <vector>
+
+#include "serializer.h"
+
+// longest fixed float is 39 integral digits, a sign, a dot and decimals
+constexpr size_t MAX_VALUE_CHARS = 64;
+// a UTF-16 unit never takes more than three UTF-8 bytes
+constexpr size_t MAX_UTF8_PER_WCHAR = 3;
+
+char* Serializer::write_value(char* out, float value, int precision)
+{
+    if (value == 0)
+    {
+        // also folds -0 into 0
+        *out++ = '0';
+        return out;
+    }
+    if (precision < 0)
+    {
+        return std::to_chars(out, out + MAX_VALUE_CHARS, value,
+                             std::chars_format::fixed).ptr;
+    }
+    auto first = out;
+    out = std::to_chars(out, out + MAX_VALUE_CHARS, value,
+                        std::chars_format::fixed, precision).ptr;
+    if (precision > 0)
+    {
+        while (out[-1] == '0') --out;
+        if (out[-1] == '.') --out;
+    }
+    if (out - first == 2 && first[0] == '-' && first[1] == '0')
+    {
+        // rounded down to -0
+        first[0] = '0';
+        out = first + 1;
+    }
+    return out;
+}
+
+std::wstring format_value(float value, int precision)
+{
+    char buffer[MAX_VALUE_CHARS];
+    auto end = Serializer::write_value(buffer, value, precision);
+    return std::wstring(buffer, end);
+}
+
+/* */
+
+size_t Serializer::max_block_size_(const Block& block) const
+{
+    // N word, words with separators, line ending
+    auto size = (1 + MAX_VALUE_CHARS) * (block.data_words.size() + 1) + 2;
+    if (options_.comments)
+    {
+        for (auto& comment : block.comments)
+        {
+            size += 1 + comment.length() * MAX_UTF8_PER_WCHAR;
+        }
+    }
+    return size;
+}
+
+char* Serializer::write_comment(char* out, const std::wstring& comment)
+{
+    for (size_t i = 0; i < comment.length(); ++i)
+    {
+        uint32_t c = comment[i];
+        if (c < 0x80)
+        {
+            *out++ = (char)c;
+            continue;
+        }
+        if (sizeof(wchar_t) == 2 && c >= 0xD800 && c < 0xDC00 && i + 1 < comment.length())
+        {
+            // surrogate pair: 4 bytes from 2 units, still within budget
+            c = 0x10000 + ((c - 0xD800) << 10) + ((uint32_t)comment[++i] - 0xDC00);
+        }
+        if (c < 0x800)
+        {
+            *out++ = (char)(0xC0 | (c >> 6));
+        }
+        else if (c < 0x10000)
+        {
+            *out++ = (char)(0xE0 | (c >> 12));
+            *out++ = (char)(0x80 | ((c >> 6) & 0x3F));
+        }
+        else
+        {
+            *out++ = (char)(0xF0 | (c >> 18));
+            *out++ = (char)(0x80 | ((c >> 12) & 0x3F));
+            *out++ = (char)(0x80 | ((c >> 6) & 0x3F));
+        }
+        *out++ = (char)(0x80 | (c & 0x3F));
+    }
+    return out;
+}
+
+static const auto LETTERS = []() {
+    std::array<char, Token::Unknown + 1> letters {};
+    for (int kind = 0; kind <= Token::Unknown; ++kind)
+    {
+        letters[kind] = TokenType_ToString((Token::Type)kind)[0];
+    }
+    return letters;
+}();
+
+char* Serializer::write_block_(char* out, const Block& block, unsigned number) const
+{
+    auto first = out;
+    auto separate = [&]() {
+        if (options_.spaces && out != first) *out++ = ' ';
+    };
+
+    if (options_.numbering == Renumber && !block.data_words.empty())
+    {
+        *out++ = 'N';
+        out = std::to_chars(out, out + MAX_VALUE_CHARS, number).ptr;
+    }
+    else if (options_.numbering == KeepNumbers && block.number)
+    {
+        *out++ = 'N';
+        out = std::to_chars(out, out + MAX_VALUE_CHARS, block.number->value).ptr;
+    }
+    for (const Word& w : block.data_words)
+    {
+        separate();
+        *out++ = LETTERS[w.kind];
+        out = write_value(out, w.value, options_.precision);
+    }
+    if (options_.comments)
+    {
+        for (auto& comment : block.comments)
+        {
+            separate();
+            out = write_comment(out, comment);
+        }
+    }
+    if (options_.crlf) *out++ = '\r';
+    *out++ = '\n';
+    return out;
+}
+
+void Serializer::write(const Program& program, const Sink& sink, size_t buffer_size/* = 1 << 20 */) const
+{
+    std::vector<char> buffer(buffer_size);
+    auto out = buffer.data();
+    auto flush = [&]() {
+        sink(buffer.data(), out - buffer.data());
+        out = buffer.data();
+    };
+
+    if (program.header.present)
+    {
+        *out++ = '%';
+        if (program.header.identifier)
+        {
+            if (auto number = std::get_if<unsigned>(&*program.header.identifier))
+            {
+                out = std::to_chars(out, out + MAX_VALUE_CHARS, *number).ptr;
+            }
+            else
+            {
+                auto& comment = std::get<std::wstring>(*program.header.identifier);
+                if (comment.length() * MAX_UTF8_PER_WCHAR + 3 > buffer.size())
+                {
+                    buffer.resize(comment.length() * MAX_UTF8_PER_WCHAR + 3);
+                    out = buffer.data() + 1;
+                }
+                out = write_comment(out, comment);
+            }
+        }
+        if (options_.crlf) *out++ = '\r';
+        *out++ = '\n';
+    }
+
+    auto number = options_.renumber_start;
+    for (const Block& block : program.blocks)
+    {
+        auto needed = max_block_size_(block);
+        if ((size_t)(buffer.data() + buffer.size() - out) < needed)
+        {
+            flush();
+            // a single block can outgrow the buffer with huge comments
+            if (buffer.size() < needed) buffer.resize(needed);
+            out = buffer.data();
+        }
+        out = write_block_(out, block, number);
+        if (!block.data_words.empty()) number += options_.renumber_step;
+    }
+    flush();
+}
+
+std::string Serializer::write(const Program& program) const
+{
+    size_t size = 2 + MAX_VALUE_CHARS;
+    for (const Block& block : program.blocks)
+    {
+        size += max_block_size_(block);
+    }
+    if (program.header.identifier)
+    {
+        if (auto comment = std::get_if<std::wstring>(&*program.header.identifier))
+        {
+            size += comment->length() * MAX_UTF8_PER_WCHAR;
+        }
+    }
+
+    // a single buffer large enough for everything, trimmed at the end
+    std::string text;
+    text.resize(size);
+    size_t length = 0;
+    write(program, [&](const char* data, size_t n) {
+        std::memcpy(&text[length], data, n);
+        length += n;
+    });
+    text.resize(length);
+    return text;
+}
+
+void Serializer::write(const Block& block, std::string& out, unsigned number/* = 0 */) const
+{
+    auto size = out.size();
+    out.resize(size + max_block_size_(block));
+    auto end = write_block_(&out[size], block, number);
+    out.resize(end - out.data());
+}
@@ -0,0 +1,58 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "types.h"
+
+/* Writes a Program back to G-code text (UTF-8).
+ *
+ * Blocks are formatted with to_chars straight into a fixed buffer that is
+ * handed to the sink whenever it fills up, so there is no allocation per
+ * word. With the default options the output parses back to an identical
+ * Program.
+ */
+class Serializer {
+public:
+    enum Numbering {
+        KeepNumbers,
+        StripNumbers,
+        Renumber,
+    };
+    struct Options {
+        // decimals for non-integral values, -1 for the shortest exact form
+        int precision = -1;
+        // separate words with a space
+        bool spaces = true;
+        bool comments = true;
+        bool crlf = false;
+        Numbering numbering = KeepNumbers;
+        unsigned renumber_start = 10;
+        unsigned renumber_step = 10;
+    };
+    using Sink = std::function<void(const char* data, size_t length)>;
+    //
+    Serializer() { }
+    Serializer(Options options) : options_(options) { }
+    void write(const Program& program, const Sink& sink, size_t buffer_size = 1 << 20) const;
+    std::string write(const Program& program) const;
+    // appends a single block and its line ending to out
+    void write(const Block& block, std::string& out, unsigned number = 0) const;
+
+    static char* write_value(char* out, float value, int precision);
+    // UTF-8 of a comment, at most 3 bytes per char
+    static char* write_comment(char* out, const std::wstring& comment);
+
+private:
+    size_t max_block_size_(const Block& block) const;
+    char* write_block_(char* out, const Block& block, unsigned number) const;
+
+    Options options_;
+};
+
+/* Formats value with at most precision decimals, trailing zeros removed. */
+std::wstring format_value(float value, int precision);
@@ -0,0 +1,219 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#include "simulator.h"
+
+PipeChannel::Pair PipeChannel::make_pair()
+{
+    auto a = std::make_shared<Queue>();
+    auto b = std::make_shared<Queue>();
+    return Pair(std::unique_ptr<PipeChannel>(new PipeChannel(a, b)),
+                std::unique_ptr<PipeChannel>(new PipeChannel(b, a)));
+}
+
+PipeChannel::~PipeChannel()
+{
+    for (auto queue : { in_, out_ })
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->closed = true;
+        queue->ready.notify_all();
+    }
+}
+
+void PipeChannel::write(const char* data, size_t length)
+{
+    std::lock_guard<std::mutex> lock(out_->mutex);
+    if (out_->closed) throw ChannelException("The other end went away");
+    out_->data.append(data, length);
+    out_->ready.notify_all();
+}
+
+size_t PipeChannel::read(char* data, size_t length, int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(in_->mutex);
+    in_->ready.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                        [&]() { return !in_->data.empty() || in_->closed; });
+    if (in_->data.empty() && in_->closed) throw ChannelException("The other end went away");
+    auto count = std::min(length, in_->data.size());
+    std::memcpy(data, in_->data.data(), count);
+    in_->data.erase(0, count);
+    return count;
+}
+
+/* */
+
+ControllerSimulator::ControllerSimulator(Options options)
+    : options_(options), stop_(false), last_line_(0), lines_seen_(0)
+{
+}
+
+ControllerSimulator::~ControllerSimulator()
+{
+    stop_ = true;
+    if (thread_.joinable()) thread_.join();
+}
+
+ControllerSimulator::Options ControllerSimulator::options_for(Dialect::Kind dialect)
+{
+    Options options;
+    auto sender = Sender::options_for(dialect);
+    options.flow = sender.flow;
+    options.checksums = sender.checksums;
+    if (sender.flow == Sender::LineCounting)
+    {
+        // Marlin reads lines into a command queue of BUFSIZE
+        options.planner = sender.buffer;
+    }
+    return options;
+}
+
+std::unique_ptr<Channel> ControllerSimulator::connect()
+{
+    std::unique_ptr<Channel> channel;
+#ifdef _WIN32
+    auto ends = PipeChannel::make_pair();
+    end_ = std::move(ends.first);
+    channel = std::move(ends.second);
+#else
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        if (master >= 0) close(master);
+        throw ChannelException(std::string("Cannot open a pseudo-terminal: ") + std::strerror(errno));
+    }
+    end_ = std::make_unique<SerialChannel>(master);
+    device_ = ptsname(master);
+    // the slave is opened before the controller reads, or it reads a hang up
+    channel = std::make_unique<SerialChannel>(device_);
+#endif
+    thread_ = std::thread(&ControllerSimulator::run_, this);
+    return channel;
+}
+
+bool ControllerSimulator::on_line_(const std::string& line, std::string& reply)
+{
+    if (!options_.checksums)
+    {
+        reply += "ok\n";
+        return !line.empty();
+    }
+
+    auto resend = [&](const char* error) {
+        reply += "Error:" + std::string(error) + ", Last Line: " + std::to_string(last_line_) + "\n";
+        reply += "Resend: " + std::to_string(last_line_ + 1) + "\nok\n";
+        return false;
+    };
+
+    auto star = line.rfind('*');
+    if (line.empty() || line[0] != 'N') return resend("No Line Number with checksum");
+    if (star == std::string::npos) return resend("No Checksum with line number");
+    bool garbled = options_.corrupt_every && ++lines_seen_ % options_.corrupt_every == 0;
+    if (garbled || Sender::checksum(line.data(), star) != std::strtoul(&line[star + 1], nullptr, 10))
+    {
+        return resend("checksum mismatch");
+    }
+
+    char* command;
+    unsigned number = std::strtoul(&line[1], &command, 10);
+    while (*command == ' ') ++command;
+    if (std::strncmp(command, "M110", 4) == 0)
+    {
+        // M110 N<n> sets the number of the last line
+        auto n = std::strchr(command + 4, 'N');
+        last_line_ = n ? std::strtoul(n + 1, nullptr, 10) : number;
+        reply += "ok\n";
+        return false;
+    }
+    if (number != last_line_ + 1) return resend("Line Number is not Last Line Number+1");
+    last_line_ = number;
+    reply += "ok\n";
+    return true;
+}
+
+void ControllerSimulator::run_()
+{
+    using namespace std::chrono;
+
+    std::string received;
+    std::string reply;
+    char buffer[4096];
+    unsigned planned = 0;
+    double budget = 0;
+    auto last = steady_clock::now();
+
+    while (!stop_)
+    {
+        size_t count;
+        try {
+            count = end_->read(buffer, sizeof(buffer), 1);
+        }
+        catch (ChannelException&)
+        {
+            // the sender hung up
+            return;
+        }
+        // Grbl picks its status poll out of the stream and answers at once
+        if (!options_.checksums)
+        {
+            auto polls = std::count(buffer, buffer + count, '?');
+            count = std::remove(buffer, buffer + count, '?') - buffer;
+            for (; polls > 0; --polls) reply += planned ? "<Run>\n" : "<Idle>\n";
+        }
+        // an overrun receive buffer loses bytes, as it would on the wire
+        count = std::min<size_t>(count, options_.buffer - std::min<size_t>(options_.buffer, received.size()));
+        received.append(buffer, count);
+
+        auto now = steady_clock::now();
+        if (options_.blocks_per_second > 0)
+        {
+            budget += duration<double>(now - last).count() * options_.blocks_per_second;
+            auto executed = std::min<double>(planned, std::floor(budget));
+            planned -= (unsigned)executed;
+            budget -= executed;
+            // an idle planner doesn't bank time
+            if (planned == 0) budget = std::min(budget, 1.0);
+        }
+        else
+        {
+            planned = 0;
+        }
+        last = now;
+
+        // a line leaves the receive buffer once the planner takes it
+        size_t start = 0;
+        for (;;)
+        {
+            if (planned >= options_.planner) break;
+            auto end = received.find('\n', start);
+            if (end == std::string::npos) break;
+            if (on_line_(received.substr(start, end - start), reply)) ++planned;
+            start = end + 1;
+        }
+        received.erase(0, start);
+
+        if (reply.empty()) continue;
+        try {
+            end_->write(reply.data(), reply.length());
+        }
+        catch (ChannelException&)
+        {
+            return;
+        }
+        reply.clear();
+    }
+}
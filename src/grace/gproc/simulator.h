@@ -0,0 +1,86 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "sender.h"
+
+/* One end of a byte stream in memory, for systems without pseudo-terminals. */
+class PipeChannel : public Channel {
+public:
+    using Pair = std::pair<std::unique_ptr<PipeChannel>, std::unique_ptr<PipeChannel>>;
+    static Pair make_pair();
+    ~PipeChannel();
+    void write(const char* data, size_t length);
+    size_t read(char* data, size_t length, int timeout_ms);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::string data;
+        bool closed = false;
+    };
+    //
+    PipeChannel(std::shared_ptr<Queue> in, std::shared_ptr<Queue> out)
+        : in_(in), out_(out) { }
+
+    std::shared_ptr<Queue> in_;
+    std::shared_ptr<Queue> out_;
+};
+
+/* A Grbl or Marlin style controller to stream to without any hardware.
+ *
+ * Bytes sit in the receive buffer until the planner has room for their
+ * line, which is when the line is acknowledged, and the planner executes
+ * blocks at a fixed rate. A sender that doesn't keep the buffer full sees
+ * its throughput drop just like on a real machine. With checksums lines
+ * are checked the way Marlin does and garbled ones are asked for again.
+ * The controller sits behind a pseudo-terminal where there are ones, so
+ * the sender goes through a real serial stack.
+ */
+class ControllerSimulator {
+public:
+    struct Options {
+        Sender::FlowControl flow = Sender::CharacterCounting;
+        // receive buffer, bytes
+        unsigned buffer = 128;
+        // blocks the planner holds, and how many it executes per second,
+        // 0 for as fast as they come
+        unsigned planner = 16;
+        double blocks_per_second = 0;
+        bool checksums = false;
+        // garble every nth line on the way in, 0 for a clean line
+        unsigned corrupt_every = 0;
+    };
+    //
+    ControllerSimulator(Options options);
+    ~ControllerSimulator();
+    // starts the controller, returns the end a sender talks to
+    std::unique_ptr<Channel> connect();
+    // pseudo-terminal of the controller, empty when in memory
+    const std::string& device() const { return device_; }
+
+    static Options options_for(Dialect::Kind dialect);
+
+private:
+    bool on_line_(const std::string& line, std::string& reply);
+    void run_();
+
+    Options options_;
+    std::unique_ptr<Channel> end_;
+    std::string device_;
+    std::thread thread_;
+    std::atomic<bool> stop_;
+    unsigned last_line_;
+    unsigned lines_seen_;
+};
@@ -0,0 +1,157 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+
+#include "footprint.h"
+#include "snapshot.h"
+
+// blocks per chunk, what an edit copies at least
+static const size_t CHUNK = 1024;
+
+static void move_block(Block& block, int shift)
+{
+    if (shift == 0) return;
+    block.start += shift;
+    for (auto& w : block.data_words) w.start += shift;
+}
+
+ProgramSnapshot::ProgramSnapshot(Program&& program, unsigned version/* = 0 */) :
+    version_(version),
+    header_(std::move(program.header)),
+    macros_(std::make_shared<const MacroCode>(std::move(program.macros)))
+{
+    auto& blocks = program.blocks;
+    for (size_t first = 0; first < blocks.size(); first += CHUNK)
+    {
+        auto end = std::min(first + CHUNK, blocks.size());
+        auto chunk = std::make_shared<const std::vector<Block>>(
+            std::make_move_iterator(blocks.begin() + first),
+            std::make_move_iterator(blocks.begin() + end));
+        chunks_.push_back(Chunk { chunk, 0, Footprint::of(*chunk) });
+        ends_.push_back(end);
+    }
+}
+
+const Block& ProgramSnapshot::block(size_t index) const
+{
+    auto chunk = chunk_of_(index);
+    auto first = chunk ? ends_[chunk - 1] : 0;
+    return (*chunks_[chunk].blocks)[index - first];
+}
+
+size_t ProgramSnapshot::chunk_of_(size_t index) const
+{
+    return std::upper_bound(ends_.begin(), ends_.end(), index) - ends_.begin();
+}
+
+std::shared_ptr<const ProgramSnapshot> ProgramSnapshot::replace(
+    size_t first, size_t end, std::vector<Block> blocks, int shift, unsigned version) const
+{
+    std::shared_ptr<ProgramSnapshot> next(new ProgramSnapshot());
+    next->version_ = version;
+    next->header_ = header_;
+    next->macros_ = macros_;
+
+    // chunks [a, b] hold the blocks that go, or the place of an insertion
+    size_t a = 0, b = 0;
+    if (!chunks_.empty())
+    {
+        a = std::min(chunk_of_(first), chunks_.size() - 1);
+        b = end > first ? chunk_of_(end - 1) : a;
+    }
+
+    // what the edit leaves of them goes into new chunks along with the
+    // new blocks, positions settled
+    std::vector<Block> rebuilt;
+    size_t last = a;
+    if (!chunks_.empty())
+    {
+        auto aFirst = a ? ends_[a - 1] : 0;
+        auto bFirst = b ? ends_[b - 1] : 0;
+        auto& before = *chunks_[a].blocks;
+        auto& after = *chunks_[b].blocks;
+        rebuilt.reserve(first - aFirst + blocks.size() + ends_[b] - end);
+        for (auto i = aFirst; i < first; ++i)
+        {
+            rebuilt.push_back(before[i - aFirst]);
+            move_block(rebuilt.back(), chunks_[a].shift);
+        }
+        rebuilt.insert(rebuilt.end(), std::make_move_iterator(blocks.begin()),
+                       std::make_move_iterator(blocks.end()));
+        for (auto i = end; i < ends_[b]; ++i)
+        {
+            rebuilt.push_back(after[i - bFirst]);
+            move_block(rebuilt.back(), chunks_[b].shift + shift);
+        }
+        last = b;
+        // small edits would leave small chunks behind, take in the next one
+        if (rebuilt.size() < CHUNK / 2 && last + 1 < chunks_.size() &&
+            rebuilt.size() + chunks_[last + 1].blocks->size() <= CHUNK)
+        {
+            ++last;
+            for (auto& block : *chunks_[last].blocks)
+            {
+                rebuilt.push_back(block);
+                move_block(rebuilt.back(), chunks_[last].shift + shift);
+            }
+        }
+        ++last;
+    }
+    else
+    {
+        rebuilt = std::move(blocks);
+    }
+
+    auto& chunks = next->chunks_;
+    chunks.reserve(chunks_.size() + rebuilt.size() / CHUNK + 1);
+    chunks.insert(chunks.end(), chunks_.begin(), chunks_.begin() + a);
+    auto pieces = (rebuilt.size() + CHUNK - 1) / CHUNK;
+    for (size_t i = 0; i < pieces; ++i)
+    {
+        auto from = rebuilt.size() * i / pieces;
+        auto to = rebuilt.size() * (i + 1) / pieces;
+        auto chunk = std::make_shared<const std::vector<Block>>(
+            std::make_move_iterator(rebuilt.begin() + from),
+            std::make_move_iterator(rebuilt.begin() + to));
+        chunks.push_back(Chunk { chunk, 0, Footprint::of(*chunk) });
+    }
+    for (auto i = last; i < chunks_.size(); ++i)
+    {
+        chunks.push_back(Chunk { chunks_[i].blocks, chunks_[i].shift + shift, chunks_[i].bytes });
+    }
+
+    next->ends_.reserve(chunks.size());
+    size_t count = 0;
+    for (auto& chunk : chunks)
+    {
+        count += chunk.blocks->size();
+        next->ends_.push_back(count);
+    }
+    return next;
+}
+
+Program ProgramSnapshot::program() const
+{
+    Program program;
+    program.header = header_;
+    program.macros = *macros_;
+    program.blocks.reserve(size());
+    for (auto& chunk : chunks_)
+    {
+        for (auto& block : *chunk.blocks)
+        {
+            program.blocks.push_back(block);
+            move_block(program.blocks.back(), chunk.shift);
+        }
+    }
+    return program;
+}
+
+size_t ProgramSnapshot::memory_usage() const
+{
+    auto bytes = Footprint::of(chunks_) + Footprint::of(ends_) + macros_->memory_usage();
+    for (auto& chunk : chunks_) bytes += chunk.bytes;
+    return bytes;
+}
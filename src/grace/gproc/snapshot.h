@@ -0,0 +1,60 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "types.h"
+
+/* A version of a parsed program that never changes once made.
+ *
+ * The blocks are kept in chunks of about a thousand behind shared
+ * pointers. Replacing some blocks copies only the chunks they fall in and
+ * the table of chunks, and the new version shares every other chunk with
+ * the one it came from. Text positions behind the edit move by a shift kept
+ * per chunk rather than in each block. Any thread may hold on to a version
+ * and read it without a lock while newer ones are made.
+ */
+class ProgramSnapshot {
+public:
+    ProgramSnapshot(Program&& program, unsigned version = 0);
+    // number of the edit it was made for
+    unsigned version() const { return version_; }
+    const Header& header() const { return header_; }
+    const MacroCode& macros() const { return *macros_; }
+    size_t size() const { return ends_.empty() ? 0 : ends_.back(); }
+    // text positions of the block and its words are as parsed, add shift()
+    const Block& block(size_t index) const;
+    int shift(size_t index) const { return chunks_[chunk_of_(index)].shift; }
+    // text span of a block in this version
+    unsigned start(size_t index) const { return block(index).start + shift(index); }
+    unsigned length(size_t index) const { return block(index).length; }
+    // blocks [first, end) replaced by others parsed from the new text, the
+    // text after them moved by shift
+    std::shared_ptr<const ProgramSnapshot> replace(
+        size_t first, size_t end, std::vector<Block> blocks, int shift, unsigned version) const;
+    // a copy of its own for code that works on whole programs
+    Program program() const;
+    // heap bytes of this version, counting the chunks it shares
+    size_t memory_usage() const;
+
+private:
+    struct Chunk {
+        std::shared_ptr<const std::vector<Block>> blocks;
+        int shift;
+        // heap bytes of the blocks, counted once when the chunk is made
+        size_t bytes;
+    };
+    ProgramSnapshot() { }
+    size_t chunk_of_(size_t index) const;
+
+    unsigned version_;
+    Header header_;
+    std::shared_ptr<const MacroCode> macros_;
+    std::vector<Chunk> chunks_;
+    // blocks up to the end of each chunk
+    std::vector<size_t> ends_;
+};
@@ -0,0 +1,96 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "sweep.h"
+
+SpeedSweep::SpeedSweep(const Program& program, const CallGraph* calls/* = nullptr */)
+{
+    // default G97, G71
+    bool css = false;
+    float units = 1;
+
+    for (size_t i = 0; i < program.blocks.size(); ++i)
+    {
+        for (const Word& w : program.blocks[i].data_words)
+        {
+            if (w.kind == Token::G)
+            {
+                if (w.value == 70) units = 1 / 39.37f;
+                else if (w.value == 71) units = 1;
+                else if (w.value == 96) css = true;
+                else if (w.value == 97) css = false;
+            }
+            else if (w.kind == Token::S)
+            {
+                values_.push_back(w.value);
+                css_.push_back(css ? units : 0);
+                rpm_.push_back(css ? 0 : units);
+                blocks_.push_back(i);
+                weights_.push_back(calls ? calls->block_executions(i) : 1);
+            }
+        }
+    }
+}
+
+SpeedSweep::SpeedSweep(const SpeedPass& speeds, const CallGraph* calls/* = nullptr */)
+{
+    auto count = speeds.size();
+    values_.reserve(count);
+    css_.reserve(count);
+    rpm_.reserve(count);
+    blocks_.reserve(count);
+    weights_.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        float units = speeds.imperial(i) ? 1 / 39.37f : 1;
+        values_.push_back(speeds.value(i));
+        css_.push_back(speeds.css(i) ? units : 0);
+        rpm_.push_back(speeds.css(i) ? 0 : units);
+        blocks_.push_back(speeds.block(i));
+        weights_.push_back(calls ? calls->block_executions(speeds.block(i)) : 1);
+    }
+}
+
+std::vector<SpeedSweep::Result> SpeedSweep::run(const std::vector<Material>& materials,
+                                                const std::vector<float>& diameters) const
+{
+    std::vector<Result> results;
+    results.reserve(materials.size() * diameters.size());
+
+    auto count = values_.size();
+    auto values = values_.data();
+    auto css = css_.data();
+    auto rpm = rpm_.data();
+    auto weights = weights_.data();
+
+    for (unsigned m = 0; m < materials.size(); ++m)
+    {
+        auto lo = materials[m].cuttingSpeedLo;
+        auto hi = materials[m].cuttingSpeedHi;
+        for (float diameter : diameters)
+        {
+            auto factor = 1000.f / (PI_F * diameter);
+            // keep this loop free of branches so it vectorizes
+            uint64_t outOfRange = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto k = css[i] + rpm[i] * factor;
+                outOfRange += weights[i] * ((values[i] < lo * k) | (values[i] > hi * k));
+            }
+
+            unsigned firstBlock = 0;
+            for (size_t i = 0; outOfRange && i < count; ++i)
+            {
+                auto k = css[i] + rpm[i] * factor;
+                if (weights[i] && (values[i] < lo * k || values[i] > hi * k))
+                {
+                    firstBlock = blocks_[i];
+                    break;
+                }
+            }
+            results.emplace_back(Result { m, diameter, outOfRange, firstBlock });
+        }
+    }
+    return results;
+}
@@ -0,0 +1,56 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "calls.h"
+#include "pipeline.h"
+#include "types.h"
+
+/* Checks every S word against many material/tool diameter pairs at once.
+ *
+ * The program is walked a single time to collect S values and the modal
+ * state they were programmed in (G70/G71, G96/G97) as flat arrays. Each
+ * combination is then a branch-free loop over those arrays:
+ *
+ *   expected = cs * (css + rpm * 1000 / (PI * diameter))
+ *
+ * where css and rpm hold the unit factor for G96 resp. G97 and zero for
+ * the other mode, the same math as SpeedVisitor::calcSpindleSpeed.
+ *
+ * Given the call graph, each S word counts as often as its block runs, so
+ * a subprogram called 200 times is still walked once.
+ */
+class SpeedSweep {
+public:
+    struct Material {
+        float cuttingSpeedLo;
+        float cuttingSpeedHi;
+    };
+    struct Result {
+        unsigned material;
+        float toolDiameter;
+        // S words out of range, weighed by how often they run
+        uint64_t outOfRange;
+        unsigned firstBlock;
+    };
+    //
+    SpeedSweep(const Program& program, const CallGraph* calls = nullptr);
+    // from speeds already collected
+    SpeedSweep(const SpeedPass& speeds, const CallGraph* calls = nullptr);
+    std::vector<Result> run(const std::vector<Material>& materials,
+                            const std::vector<float>& diameters) const;
+    size_t size() const { return values_.size(); }
+
+private:
+    std::vector<float> values_;
+    std::vector<float> css_;
+    std::vector<float> rpm_;
+    std::vector<unsigned> blocks_;
+    // runs of the block per run of the program
+    std::vector<uint64_t> weights_;
+};
@@ -0,0 +1,348 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cfloat>
+
+#include "footprint.h"
+#include "macro.h"
+#include "toolpath.h"
+
+// blocks a macro program may run before it is cut short, loops that never
+// end would otherwise fill memory with segments
+static const uint64_t MACRO_BLOCK_LIMIT = 20000000;
+
+Toolpath::Toolpath()
+    : min_{0, 0, 0}, max_{0, 0, 0}
+{
+}
+
+Toolpath::Toolpath(const Program& program, float tolerance/* = 0.01f */)
+    : Toolpath()
+{
+    // default G0, G17, G90, G71, starting at the origin
+    float position[3] = {0, 0, 0};
+    Motion motion = Rapid;
+    bool clockwise = false;
+    auto plane = ArcLinearizer::XY;
+    bool absolute = true;
+    float units = 1;
+    add_vertex_(position);
+
+    ArcLinearizer arcs(tolerance);
+    std::vector<uint32_t> arcSegments;
+
+    auto step = [&](unsigned i, const std::vector<Word>& words) {
+        std::optional<float> axes[3];
+        float center[3] = {0, 0, 0};
+        bool hasCenter = false;
+        std::optional<float> radius;
+        bool machine_coords = false;
+        bool moves = true;
+        for (const Word& w : words)
+        {
+            switch (w.kind)
+            {
+                case Token::G:
+                    if (w.value == 0) motion = Rapid;
+                    else if (w.value == 1) motion = Feed;
+                    else if (w.value == 2 || w.value == 3) motion = Arc, clockwise = w.value == 2;
+                    else if (w.value == 17) plane = ArcLinearizer::XY;
+                    else if (w.value == 18) plane = ArcLinearizer::ZX;
+                    else if (w.value == 19) plane = ArcLinearizer::YZ;
+                    else if (w.value == 90 || w.value == 91) absolute = w.value == 90;
+                    else if (w.value == 20 || w.value == 70) units = 25.4f;
+                    else if (w.value == 21 || w.value == 71) units = 1;
+                    else if (w.value == 53) machine_coords = true;
+                    // dwell, offsets and reference returns take axis words
+                    // that don't describe a move
+                    else if (w.value == 4 || w.value == 10 || w.value == 28 ||
+                             w.value == 30 || w.value == 92) moves = false;
+                    break;
+                case Token::X:
+                case Token::Y:
+                case Token::Z:
+                    axes[w.kind - Token::X] = w.value;
+                    break;
+                case Token::I:
+                case Token::J:
+                case Token::K:
+                    center[w.kind - Token::I] = w.value;
+                    hasCenter = true;
+                    break;
+                case Token::R:
+                    radius = w.value;
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (!moves || !(axes[0] || axes[1] || axes[2])) return;
+
+        // modal words apply to the whole block, whatever their position
+        float start[3] = { position[0], position[1], position[2] };
+        for (unsigned k = 0; k < 3; ++k)
+        {
+            if (!axes[k]) continue;
+            auto value = *axes[k] * units;
+            position[k] = absolute || machine_coords ? value : position[k] + value;
+        }
+
+        // an arc without a center or radius is drawn as its chord
+        if (motion == Arc && hasCenter)
+        {
+            for (auto& c : center) c *= units;
+            arcs.add_center(start, position, center, plane, clockwise);
+            arcSegments.push_back(blocks_.size());
+        }
+        else if (motion == Arc && radius)
+        {
+            arcs.add_radius(start, position, *radius * units, plane, clockwise);
+            arcSegments.push_back(blocks_.size());
+        }
+        blocks_.push_back(i);
+        motions_.push_back(motion);
+        add_vertex_(position);
+    };
+
+    // macro programs are followed through their loops and jumps
+    if (!program.macros.empty())
+    {
+        MacroRunner(program, MACRO_BLOCK_LIMIT).run(step);
+    }
+    else
+    {
+        for (unsigned i = 0; i < program.blocks.size(); ++i)
+        {
+            step(i, program.blocks[i].data_words);
+        }
+    }
+
+    if (arcs.size() > 0) add_arcs_(arcs, arcSegments);
+
+    for (unsigned k = 0; k < 3; ++k)
+    {
+        auto [lo, hi] = std::minmax_element(coords_[k].begin(), coords_[k].end());
+        min_[k] = *lo;
+        max_[k] = *hi;
+    }
+}
+
+void Toolpath::add_vertex_(const float* p)
+{
+    for (unsigned k = 0; k < 3; ++k)
+    {
+        coords_[k].push_back(p[k]);
+    }
+}
+
+void Toolpath::add_arcs_(ArcLinearizer& arcs, const std::vector<uint32_t>& segments)
+{
+    arcs.prepare();
+    size_t extra = 0;
+    for (size_t a = 0; a < arcs.size(); ++a)
+    {
+        extra += arcs.chords(a) - 1;
+    }
+
+    // lay the chords out in place of their arcs, in one pass
+    auto count = size();
+    std::vector<float> coords[3];
+    for (unsigned k = 0; k < 3; ++k)
+    {
+        coords[k].resize(count + 1 + extra);
+        coords[k][0] = coords_[k][0];
+    }
+    std::vector<uint32_t> blocks;
+    std::vector<uint8_t> motions;
+    blocks.reserve(count + extra);
+    motions.reserve(count + extra);
+
+    size_t out = 1;
+    size_t arc = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned n = 1;
+        if (arc < segments.size() && segments[arc] == i)
+        {
+            n = arcs.chords(arc);
+            arcs.emit(arc++, &coords[0][out], &coords[1][out], &coords[2][out]);
+        }
+        else
+        {
+            for (unsigned k = 0; k < 3; ++k) coords[k][out] = coords_[k][i + 1];
+        }
+        blocks.insert(blocks.end(), n, blocks_[i]);
+        motions.insert(motions.end(), n, motions_[i]);
+        out += n;
+    }
+
+    for (unsigned k = 0; k < 3; ++k) coords_[k] = std::move(coords[k]);
+    blocks_ = std::move(blocks);
+    motions_ = std::move(motions);
+}
+
+/* */
+
+// squared distance from (u, v) to the segment (u0, v0)-(u1, v1)
+static float segment_distance2(float u, float v, float u0, float v0, float u1, float v1)
+{
+    float du = u1 - u0, dv = v1 - v0;
+    float length2 = du * du + dv * dv;
+    float t = length2 > 0 ? ((u - u0) * du + (v - v0) * dv) / length2 : 0;
+    t = std::clamp(t, 0.f, 1.f);
+    float eu = u0 + t * du - u, ev = v0 + t * dv - v;
+    return eu * eu + ev * ev;
+}
+
+ToolpathLod::ToolpathLod(const Toolpath& toolpath, unsigned uAxis, unsigned vAxis)
+    : axes_{uAxis, vAxis}
+{
+    auto& u = toolpath.axis(uAxis);
+    auto& v = toolpath.axis(vAxis);
+    auto extent = std::max({toolpath.max(uAxis) - toolpath.min(uAxis),
+                            toolpath.max(vAxis) - toolpath.min(vAxis), 1.f});
+
+    // the finest level only drops what floats can't tell apart anyway
+    Level base;
+    base.error = 0;
+    base.u = u;
+    base.v = v;
+    base.source.resize(u.size());
+    for (size_t i = 0; i < base.source.size(); ++i) base.source[i] = i;
+    base.motions = toolpath.motions();
+
+    auto tolerance = extent * 1e-6f;
+    levels_.emplace_back(decimate_(base, tolerance));
+    base = Level();
+
+    // only keep levels that at least halve the one below
+    for (tolerance *= 2; tolerance < extent; tolerance *= 2)
+    {
+        auto& last = levels_.back();
+        if (last.size() < 256) break;
+        auto level = decimate_(last, tolerance);
+        if (level.size() * 2 > last.size()) continue;
+        levels_.emplace_back(std::move(level));
+    }
+    for (auto& level : levels_) bound_(level);
+}
+
+ToolpathLod::Level ToolpathLod::decimate_(const Level& level, float tolerance)
+{
+    Level out;
+    out.error = level.error + tolerance;
+    if (level.u.empty()) return out;
+
+    auto count = level.u.size();
+    auto tolerance2 = tolerance * tolerance;
+    auto keep = [&](size_t i) {
+        out.u.push_back(level.u[i]);
+        out.v.push_back(level.v[i]);
+        out.source.push_back(level.source[i]);
+    };
+
+    keep(0);
+    size_t anchor = 0;
+    for (size_t i = 1; i < count; ++i)
+    {
+        auto du = level.u[i] - level.u[anchor];
+        auto dv = level.v[i] - level.v[anchor];
+        bool last = i == count - 1;
+        // a vertex where the motion changes is kept, so every segment has one
+        if (last || level.motions[i - 1] != level.motions[i] ||
+            du * du + dv * dv > tolerance2)
+        {
+            out.motions.push_back(level.motions[anchor]);
+            keep(i);
+            anchor = i;
+        }
+    }
+    return out;
+}
+
+void ToolpathLod::bound_(Level& level)
+{
+    auto count = (level.size() + CHUNK - 1) / CHUNK;
+    const std::vector<float>* axes[2] = { &level.u, &level.v };
+    for (unsigned k = 0; k < 2; ++k)
+    {
+        level.chunk_min[k].resize(count);
+        level.chunk_max[k].resize(count);
+        for (size_t c = 0; c < count; ++c)
+        {
+            // the last vertex is shared with the next chunk
+            auto first = axes[k]->begin() + c * CHUNK;
+            auto last = axes[k]->begin() + std::min((c + 1) * CHUNK, level.size()) + 1;
+            auto range = std::minmax_element(first, last);
+            level.chunk_min[k][c] = *range.first;
+            level.chunk_max[k][c] = *range.second;
+        }
+    }
+}
+
+const ToolpathLod::Level& ToolpathLod::level(float error) const
+{
+    for (auto it = levels_.rbegin(); it != levels_.rend(); ++it)
+    {
+        if (it->error <= error) return *it;
+    }
+    return levels_.front();
+}
+
+std::optional<size_t> ToolpathLod::pick(const Toolpath& toolpath, float u, float v,
+                                        float radius, float error) const
+{
+    auto& level = this->level(error);
+    auto& tu = toolpath.axis(axes_[0]);
+    auto& tv = toolpath.axis(axes_[1]);
+
+    // coarse segments near the point, then the segments they stand for
+    auto reach = radius + level.error;
+    auto best = radius * radius;
+    std::optional<size_t> found;
+    for (size_t c = 0; c < level.chunks(); ++c)
+    {
+        if (u < level.chunk_min[0][c] - reach || u > level.chunk_max[0][c] + reach ||
+            v < level.chunk_min[1][c] - reach || v > level.chunk_max[1][c] + reach) continue;
+        auto end = std::min((c + 1) * CHUNK, level.size());
+        for (size_t j = c * CHUNK; j < end; ++j)
+        {
+            auto d = segment_distance2(u, v, level.u[j], level.v[j], level.u[j + 1], level.v[j + 1]);
+            if (d > reach * reach) continue;
+            for (size_t i = level.source[j]; i < level.source[j + 1]; ++i)
+            {
+                d = segment_distance2(u, v, tu[i], tv[i], tu[i + 1], tv[i + 1]);
+                // later segments are drawn on top, prefer them on a tie
+                if (d <= best)
+                {
+                    best = d;
+                    found = i;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+size_t Toolpath::memory_usage() const
+{
+    return Footprint::of(coords_[0]) + Footprint::of(coords_[1]) + Footprint::of(coords_[2]) +
+           Footprint::of(blocks_) + Footprint::of(motions_);
+}
+
+size_t ToolpathLod::memory_usage() const
+{
+    auto bytes = Footprint::of(levels_);
+    for (auto& level : levels_)
+    {
+        bytes += Footprint::of(level.u) + Footprint::of(level.v) +
+                 Footprint::of(level.source) + Footprint::of(level.motions);
+        for (unsigned k = 0; k < 2; ++k)
+        {
+            bytes += Footprint::of(level.chunk_min[k]) + Footprint::of(level.chunk_max[k]);
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,95 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "arc.h"
+#include "types.h"
+
+/* Motion of the tool through a program, as one long polyline.
+ *
+ * Vertices are kept as flat coordinate arrays in millimeters. Segment i
+ * runs from vertex i to vertex i + 1 and remembers the block it comes from
+ * and how the tool moves, so millions of blocks cost a few bytes each.
+ * Arcs are split into chords no further than tolerance from the arc.
+ * Programs with macros are followed as they run, loops unrolled.
+ */
+class Toolpath {
+public:
+    enum Motion : uint8_t {
+        Rapid,
+        Feed,
+        Arc,
+    };
+    //
+    Toolpath();
+    Toolpath(const Program& program, float tolerance = 0.01f);
+    size_t size() const { return blocks_.size(); }
+    const std::vector<float>& axis(unsigned i) const { return coords_[i]; }
+    const std::vector<uint32_t>& blocks() const { return blocks_; }
+    const std::vector<uint8_t>& motions() const { return motions_; }
+    float min(unsigned i) const { return min_[i]; }
+    float max(unsigned i) const { return max_[i]; }
+    size_t memory_usage() const;
+
+private:
+    void add_vertex_(const float* p);
+    void add_arcs_(ArcLinearizer& arcs, const std::vector<uint32_t>& segments);
+
+    std::vector<float> coords_[3];
+    std::vector<uint32_t> blocks_;
+    std::vector<uint8_t> motions_;
+    float min_[3];
+    float max_[3];
+};
+
+/* Multi-resolution pyramid of a toolpath projected on a plane.
+ *
+ * Every level is decimated from the one below it: a vertex is dropped when
+ * it lies within the level's tolerance of the last vertex kept and the
+ * motion doesn't change there, so the simplified path never strays further
+ * than the summed tolerances from the real one. Tolerances double from
+ * level to level; a view draws the coarsest level that is still finer than
+ * half a pixel, which bounds the work by the pixels covered rather than
+ * the size of the program. Zoomed in that is a fine level, so every level
+ * also keeps the bounds of each run of CHUNK segments and a view skips the
+ * runs off the screen.
+ */
+class ToolpathLod {
+public:
+    struct Level {
+        // how far this level may be from the toolpath
+        float error;
+        std::vector<float> u;
+        std::vector<float> v;
+        // vertex of the toolpath each vertex stands for
+        std::vector<uint32_t> source;
+        std::vector<uint8_t> motions;
+        // bounds of the vertices of segments [c * CHUNK, (c + 1) * CHUNK]
+        std::vector<float> chunk_min[2];
+        std::vector<float> chunk_max[2];
+        size_t size() const { return motions.size(); }
+        size_t chunks() const { return chunk_min[0].size(); }
+    };
+    static constexpr size_t CHUNK = 256;
+    //
+    ToolpathLod(const Toolpath& toolpath, unsigned uAxis, unsigned vAxis);
+    const Level& level(float error) const;
+    size_t levels() const { return levels_.size(); }
+    size_t memory_usage() const;
+    // segment of the toolpath closest to (u, v), within radius
+    std::optional<size_t> pick(const Toolpath& toolpath, float u, float v,
+                               float radius, float error) const;
+
+private:
+    static Level decimate_(const Level& level, float tolerance);
+    static void bound_(Level& level);
+
+    unsigned axes_[2];
+    std::vector<Level> levels_;
+};
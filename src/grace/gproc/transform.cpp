@@ -0,0 +1,209 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+
+#include "pool.h"
+#include "serializer.h"
+#include "transform.h"
+
+static bool is_length_word(Token::Type kind)
+{
+    switch (kind)
+    {
+        case Token::X: case Token::Y: case Token::Z:
+        case Token::U: case Token::V: case Token::W:
+        case Token::I: case Token::J: case Token::K:
+        case Token::R:
+        case Token::F:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static Token::Type center_word(Token::Type axis)
+{
+    switch (axis)
+    {
+        case Token::X:   return Token::I;
+        case Token::Y:   return Token::J;
+        case Token::Z:   return Token::K;
+        default:   return Token::Unknown;
+    }
+}
+
+/* */
+
+Transform::ChunkExit Transform::scan_(const Block* first, const Block* last) const
+{
+    ChunkExit exit;
+    for (; first != last; ++first)
+    {
+        for (const Word& w : first->data_words)
+        {
+            if (w.kind != Token::G) continue;
+            if (w.value == 90 || w.value == 91) exit.absolute = w.value == 90;
+            else if (w.value == 70 || w.value == 71) exit.metric = w.value == 71;
+            else if (w.value >= 17 && w.value <= 19) exit.plane = (int)w.value;
+        }
+    }
+    return exit;
+}
+
+std::optional<float> Transform::rewrite_word_(const Word& w, const State& state,
+                                              bool machine_coords) const
+{
+    switch (kind_)
+    {
+        case Offset:
+            if (w.kind == target_ && state.absolute && !machine_coords)
+            {
+                return w.value + amount_;
+            }
+            break;
+        case Scale:
+            if (w.kind == target_)
+            {
+                return w.value * amount_;
+            }
+            break;
+        case Mirror:
+            if (machine_coords) break;
+            if (w.kind == target_ || w.kind == center_word(target_))
+            {
+                return -w.value;
+            }
+            if (w.kind == Token::G && (w.value == 2 || w.value == 3) &&
+                (state.plane[0] == target_ || state.plane[1] == target_))
+            {
+                // mirroring within the plane reverses the arc direction
+                return 5 - w.value;
+            }
+            break;
+        case ToMetric:
+        case ToImperial:
+            if (w.kind == Token::G && (w.value == 70 || w.value == 71))
+            {
+                return kind_ == ToMetric ? 71.f : 70.f;
+            }
+            if (is_length_word(w.kind) && state.metric != (kind_ == ToMetric))
+            {
+                return w.value * amount_;
+            }
+            break;
+    }
+    return std::nullopt;
+}
+
+std::optional<TextEdit> Transform::unit_edit_(const std::vector<Block>& blocks,
+                                              const std::wstring& eol) const
+{
+    for (const Block& block : blocks)
+    {
+        for (const Word& w : block.data_words)
+        {
+            // a unit word ahead of the first length gets rewritten instead
+            if (w.kind == Token::G && (w.value == 70 || w.value == 71)) return std::nullopt;
+        }
+        for (const Word& w : block.data_words)
+        {
+            if (w.expression == NO_EXPRESSION && is_length_word(w.kind))
+            {
+                return TextEdit { block.start, 0, (kind_ == ToMetric ? L"G71" : L"G70") + eol };
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+void Transform::rewrite_(const Block* first, const Block* last, State state,
+                         unsigned precision, std::vector<TextEdit>& edits) const
+{
+    for (; first != last; ++first)
+    {
+        // modal words take effect for the whole block they appear in
+        auto machine_coords = false;
+        for (const Word& w : first->data_words)
+        {
+            if (w.kind != Token::G) continue;
+            if (w.value == 90 || w.value == 91) state.absolute = w.value == 90;
+            else if (w.value == 17) state.plane[0] = Token::X, state.plane[1] = Token::Y;
+            else if (w.value == 18) state.plane[0] = Token::Z, state.plane[1] = Token::X;
+            else if (w.value == 19) state.plane[0] = Token::Y, state.plane[1] = Token::Z;
+            else if (w.value == 70 || w.value == 71) state.metric = w.value == 71;
+            else if (w.value == 53) machine_coords = true;
+        }
+        for (const Word& w : first->data_words)
+        {
+            // values computed by macros are left alone
+            if (w.expression != NO_EXPRESSION) continue;
+            auto value = rewrite_word_(w, state, machine_coords);
+            if (value && *value != w.value)
+            {
+                edits.emplace_back(TextEdit {
+                    w.start, w.length,
+                    format_value(*value, w.kind == Token::G ? 0 : precision)
+                });
+            }
+        }
+    }
+}
+
+std::vector<TextEdit> Transform::apply(const Program& program, unsigned precision/* = 3 */,
+                                       const std::wstring& eol/* = L"\n" */) const
+{
+    auto& blocks = program.blocks;
+    auto& pool = WorkPool::shared();
+    size_t workers = pool.size();
+    // not worth splitting small programs
+    workers = std::min(workers, blocks.size() / 4096 + 1);
+    auto chunk = (blocks.size() + workers - 1) / std::max<size_t>(workers, 1);
+    auto range = [&](size_t i) {
+        auto first = blocks.data() + std::min(i * chunk, blocks.size());
+        auto last = blocks.data() + std::min((i + 1) * chunk, blocks.size());
+        return std::make_pair(first, last);
+    };
+
+    std::vector<ChunkExit> exits(workers);
+    pool.parallel_for(workers, [&](size_t i) {
+        auto r = range(i);
+        exits[i] = scan_(r.first, r.second);
+    });
+
+    std::vector<State> entries(workers);
+    for (size_t i = 1; i < workers; ++i)
+    {
+        auto state = entries[i - 1];
+        auto& exit = exits[i - 1];
+        if (exit.absolute != -1) state.absolute = exit.absolute;
+        if (exit.metric != -1) state.metric = exit.metric;
+        if (exit.plane == 17) state.plane[0] = Token::X, state.plane[1] = Token::Y;
+        if (exit.plane == 18) state.plane[0] = Token::Z, state.plane[1] = Token::X;
+        if (exit.plane == 19) state.plane[0] = Token::Y, state.plane[1] = Token::Z;
+        entries[i] = state;
+    }
+
+    std::vector<std::vector<TextEdit>> chunk_edits(workers);
+    pool.parallel_for(workers, [&](size_t i) {
+        auto r = range(i);
+        rewrite_(r.first, r.second, entries[i], precision, chunk_edits[i]);
+    });
+
+    std::vector<TextEdit> edits;
+    for (auto& e : chunk_edits)
+    {
+        edits.insert(edits.end(), std::make_move_iterator(e.begin()),
+                     std::make_move_iterator(e.end()));
+    }
+
+    // without a unit word the controller reads the converted values in
+    // whatever units it is set to, no edit comes before the first length
+    if (kind_ == ToMetric || kind_ == ToImperial)
+    {
+        auto unit = unit_edit_(blocks, eol);
+        if (unit) edits.insert(edits.begin(), std::move(*unit));
+    }
+    return edits;
+}
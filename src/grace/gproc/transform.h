@@ -0,0 +1,74 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+/* A replacement of the text span [start, start+length). */
+struct TextEdit {
+    unsigned start;
+    unsigned length;
+    std::wstring text;
+};
+
+/* Numeric rewrite of a parsed program.
+ *
+ * apply() never touches the program, it returns the minimal set of edits
+ * to the value spans that actually change, in ascending order. Blocks are
+ * processed in parallel chunks: modal state (G90/G91, G70/G71, plane) is
+ * resolved per chunk first, then propagated so every chunk knows the state
+ * it starts in. Unit conversions add a G70/G71 line when the program has
+ * none ahead of its first length.
+ */
+class Transform {
+public:
+    enum Kind {
+        Offset,
+        Scale,
+        Mirror,
+        ToMetric,
+        ToImperial,
+    };
+    //
+    static Transform offset(Token::Type axis, float delta) { return Transform(Offset, axis, delta); }
+    static Transform scale(Token::Type kind, float factor) { return Transform(Scale, kind, factor); }
+    static Transform mirror(Token::Type axis) { return Transform(Mirror, axis, -1); }
+    static Transform to_metric() { return Transform(ToMetric, Token::Unknown, 25.4f); }
+    static Transform to_imperial() { return Transform(ToImperial, Token::Unknown, 1 / 25.4f); }
+
+    // eol ends lines the transform adds, the one the text uses
+    std::vector<TextEdit> apply(const Program& program, unsigned precision = 3,
+                                const std::wstring& eol = L"\n") const;
+
+private:
+    struct State {
+        bool absolute = true;   // G90
+        bool metric = true;     // G71
+        Token::Type plane[2] = { Token::X, Token::Y };  // G17
+    };
+    struct ChunkExit {
+        int absolute = -1;
+        int metric = -1;
+        int plane = -1;
+    };
+    //
+    Transform(Kind kind, Token::Type target, float amount)
+        : kind_(kind), target_(target), amount_(amount) { }
+    ChunkExit scan_(const Block* first, const Block* last) const;
+    void rewrite_(const Block* first, const Block* last, State state,
+                  unsigned precision, std::vector<TextEdit>& edits) const;
+    std::optional<float> rewrite_word_(const Word& w, const State& state,
+                                       bool machine_coords) const;
+    // unit line ahead of the first length when no G70/G71 comes before it
+    std::optional<TextEdit> unit_edit_(const std::vector<Block>& blocks,
+                                       const std::wstring& eol) const;
+
+    Kind kind_;
+    Token::Type target_;
+    float amount_;
+};
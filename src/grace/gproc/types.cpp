@@ -28,7 +28,7 @@ void Visitor::visit(Block* b)
     {
         b->number->accept(this);
     }
-    for (Word w : b->data_words)
+    for (Word& w : b->data_words)
     {
         w.accept(this);
     }
@@ -36,7 +36,7 @@ void Visitor::visit(Block* b)
 
 void Visitor::visit(Program* p)
 {
-    for (Block b : p->blocks) { b.accept(this); }
+    for (Block& b : p->blocks) { b.accept(this); }
 }
 
 /* */
@@ -58,6 +58,16 @@ float SpeedVisitor::calcSpindleSpeed(float cs)
     return value;
 }
 
+void SpeedVisitor::visit(Program* p)
+{
+    block_ = 0;
+    for (Block& b : p->blocks)
+    {
+        b.accept(this);
+        ++block_;
+    }
+}
+
 void SpeedVisitor::visit(Word* w)
 {
     if (w->kind == Token::G)
@@ -85,9 +95,8 @@ void SpeedVisitor::visit(Word* w)
     }
     else if (w->kind == Token::S)
     {
-        // XXX add current line
         speed_records_.emplace_back(SpeedVisitor::SpeedRecord {
-            0, w->value,
+            block_, w->value,
             calcSpindleSpeed(ref_data_.cuttingSpeedLo),
             calcSpindleSpeed(ref_data_.cuttingSpeedHi)
         });
@@ -8,12 +8,13 @@
 #include <iostream>
 #include <optional>
 #include <string>
-#include <unordered_set>
 #include <variant>
 #include <vector>
 
 #include <wx/string.h>
 
+#include "bytecode.h"
+
 constexpr float PI_F = 3.14159265358979f;
 
 namespace Token {
@@ -47,12 +48,21 @@ namespace Token {
 
         D,
         T,
+        H,
 
         M,
+        L,
 
         Comment,
         Number,
 
+        // macro expressions: # [ ] + - * and words like SIN, WHILE, EQ
+        Hash,
+        LeftBracket,
+        RightBracket,
+        Operator,
+        Keyword,
+
         AlignmentChar,
         Equal,
         OptBlockSkip,
@@ -102,12 +112,20 @@ inline std::string TokenType_ToString(Token::Type tt)
 
         case Token::D:   return "D";
         case Token::T:   return "T";
+        case Token::H:   return "H";
 
         case Token::M:   return "M";
+        case Token::L:   return "L";
 
         case Token::Comment:   return "Comment";
         case Token::Number:   return "Number";
 
+        case Token::Hash:   return "#";
+        case Token::LeftBracket:   return "[";
+        case Token::RightBracket:   return "]";
+        case Token::Operator:   return "Operator";
+        case Token::Keyword:   return "Keyword";
+
         case Token::AlignmentChar:   return ":";
         case Token::Equal:   return "=";
         case Token::OptBlockSkip:   return "/";
@@ -121,6 +139,48 @@ inline std::string TokenType_ToString(Token::Type tt)
     }
 }
 
+inline Token::Type TokenType_FromChar(wchar_t c)
+{
+    switch (c)
+    {
+        case 'N':   return Token::N;
+        case 'O':   return Token::O;
+
+        case 'G':   return Token::G;
+
+        case 'X':   return Token::X;
+        case 'Y':   return Token::Y;
+        case 'Z':   return Token::Z;
+        case 'U':   return Token::U;
+        case 'V':   return Token::V;
+        case 'W':   return Token::W;
+        case 'P':   return Token::P;
+        case 'Q':   return Token::Q;
+        case 'R':   return Token::R;
+        case 'A':   return Token::A;
+        case 'B':   return Token::B;
+        case 'C':   return Token::C;
+
+        case 'I':   return Token::I;
+        case 'J':   return Token::J;
+        case 'K':   return Token::K;
+
+        case 'E':   return Token::E;
+        case 'F':   return Token::F;
+
+        case 'S':   return Token::S;
+
+        case 'D':   return Token::D;
+        case 'T':   return Token::T;
+        case 'H':   return Token::H;
+
+        case 'M':   return Token::M;
+        case 'L':   return Token::L;
+
+        default:   return Token::Unknown;
+    }
+}
+
 inline std::ostream& operator<<(std::ostream& stream,
                          const Token::Token& t) {
     return stream << TokenType_ToString(t.type) << "(" << t.start << "," << t.length << ")" << std::endl;
@@ -147,6 +207,11 @@ public:
     }
     Token::Type kind;
     float value;
+    // text span of the value, filled in by the parser
+    unsigned start = 0;
+    unsigned length = 0;
+    // macro expression giving the value, see Program::macros
+    uint32_t expression = NO_EXPRESSION;
 };
 
 inline std::string Word_ToString(Word& w)
@@ -163,27 +228,13 @@ inline std::string Word_ToString(Word& w)
     return TokenType_ToString(w.kind) + value;
 }
 
-namespace std
-{
-    template <>
-    struct hash<Word>
-    {
-        size_t operator()(const Word& w) const
-        {
-            return ((hash<int>()(static_cast<int>(w.kind))
-                    ^ (hash<float>()(w.value) << 1)) >> 1);
-        }
-    };
-}
-
-using TokenSet = std::unordered_set<Token::Type>;
-using WordSet = std::unordered_set<Word>;
-
 class Header : public BaseNode {
 public:
     Header() { }
     void accept(Visitor* v);
     std::optional<std::variant<unsigned, std::wstring>> identifier;
+    // dialects without a required header may omit the % line
+    bool present = true;
 };
 
 class BlockNumber : public BaseNode {
@@ -193,12 +244,41 @@ public:
     unsigned value;
 };
 
+/* Macro statement taking up a block, its parts are expressions in
+ * Program::macros. */
+struct Statement {
+    enum Kind : uint8_t {
+        // #target = value
+        Assign,
+        // IF [condition] THEN #target = value
+        IfAssign,
+        // GOTO target
+        Goto,
+        // IF [condition] GOTO target
+        IfGoto,
+        // WHILE [condition] DO label
+        While,
+        // END label
+        End,
+    };
+    Kind kind;
+    uint32_t condition = NO_EXPRESSION;
+    uint32_t target = NO_EXPRESSION;
+    uint32_t value = NO_EXPRESSION;
+    unsigned label = 0;
+};
+
 class Block : public BaseNode {
 public:
     Block() { }
     void accept(Visitor* v);
     std::optional<BlockNumber> number;
     std::vector<Word> data_words;
+    std::optional<Statement> statement;
+    std::vector<std::wstring> comments;
+    // text span of the block, not including the end of block
+    unsigned start = 0;
+    unsigned length = 0;
 };
 
 class Program : public BaseNode {
@@ -207,6 +287,8 @@ public:
     void accept(Visitor* v);
     Header header;
     std::vector<Block> blocks;
+    // expressions of macro statements and words, empty without macros
+    MacroCode macros;
 };
 
 /* */
@@ -228,14 +310,16 @@ public:
         float toolDiameter;
     };
     struct SpeedRecord {
-        unsigned line;
+        unsigned block;
         float value;
         float calculatedValueLo;
         float calculatedValueHi;
     };
     //
     SpeedVisitor(RefData data) : ref_data_(data) { }
+    using Visitor::visit;
     void visit(Word* w);
+    void visit(Program* p);
     std::vector<SpeedRecord> records() { return speed_records_; }
 private:
     enum Units {
@@ -250,6 +334,7 @@ private:
     float calcSpindleSpeed(float cs);
 
     std::vector<SpeedRecord> speed_records_;
+    unsigned block_ = 0;
     // default G97
     SpeedVisitor::SpindleSpeed speed_kind_ = SpeedVisitor::RevPerMinute;
     // default G71
@@ -0,0 +1,449 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#include <share.h>
+#else
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include <wx/dir.h>
+#include <wx/filename.h>
+#include <wx/stc/stc.h>
+#include <wx/stdpaths.h>
+
+#include "fileio.h"
+#include "journal.h"
+#include "gproc/pool.h"
+
+static const char JOURNAL_MAGIC[4] = { 'G', 'R', 'J', '1' };
+static const wxString JOURNAL_EXT = "grj";
+// a checkpoint is taken once the journal is this large and bigger than the document
+static const uint64_t CHECKPOINT_MIN_SIZE = 64 << 20;
+// pending records are handed over at least every this many bytes
+static const size_t FLUSH_SIZE = 1 << 20;
+
+static wxString JournalDir()
+{
+    wxFileName dir(wxStandardPaths::Get().GetUserDataDir(), wxEmptyString);
+    dir.AppendDir("journal");
+    dir.Mkdir(wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+    return dir.GetPath();
+}
+
+/* Opens path for appending, exclusively: a journal that can't be opened
+   this way belongs to a running instance. */
+static std::FILE* OpenExclusive(const std::filesystem::path& path, bool truncate)
+{
+#ifdef _WIN32
+    return _wfsopen(path.c_str(), truncate ? L"wb" : L"ab", _SH_DENYRW);
+#else
+    auto file = std::fopen(path.c_str(), truncate ? "wb" : "ab");
+    if (file && flock(fileno(file), LOCK_EX | LOCK_NB) != 0)
+    {
+        std::fclose(file);
+        return nullptr;
+    }
+    return file;
+#endif
+}
+
+static void SyncFile(std::FILE* file)
+{
+    std::fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+
+template <typename T>
+static void Put(std::string& out, T value)
+{
+    // journals are little-endian, like every machine we run on
+    out.append((const char*)&value, sizeof(value));
+}
+
+template <typename T>
+static bool Get(const std::string& in, size_t& pos, T& value)
+{
+    if (pos + sizeof(value) > in.size()) return false;
+    std::memcpy(&value, in.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+/* */
+
+void Journal::Writer::Open(bool truncate)
+{
+    Close();
+    file = OpenExclusive(path, truncate);
+    if (truncate) size = 0;
+}
+
+void Journal::Writer::Close()
+{
+    if (file) std::fclose(file);
+    file = nullptr;
+}
+
+void Journal::Writer::Drain()
+{
+    std::lock_guard<std::mutex> write_lock(write_mutex);
+    for (;;)
+    {
+        Item item;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (items.empty()) break;
+            item = std::move(items.front());
+            items.pop_front();
+        }
+
+        if (item.kind == Item::Checkpoint)
+        {
+            auto snapshot = path;
+            snapshot.replace_extension("base");
+            auto error = WriteFileAtomic(wxString(snapshot.native()),
+                                         item.snapshot->data(), item.snapshot->length());
+            // keep appending to the old base when the snapshot failed
+            if (!error.empty()) continue;
+            item.kind = Item::Reset;
+        }
+        if (item.kind == Item::Reset)
+        {
+            Open(true);
+            // an empty reset drops the journal until the next edit
+            if (item.data.empty())
+            {
+                Close();
+                std::error_code ec;
+                std::filesystem::remove(path, ec);
+                continue;
+            }
+        }
+        if (!file) continue;
+        std::fwrite(item.data.data(), 1, item.data.size(), file);
+        size += item.data.size();
+        SyncFile(file);
+    }
+}
+
+/* */
+
+Journal::Journal(const std::filesystem::path& path)
+    : writer_(std::make_shared<Writer>()), started_(false), pending_bytes_(0)
+{
+    writer_->path = path;
+}
+
+Journal::Journal()
+    : Journal(std::filesystem::path())
+{
+    static std::atomic<unsigned> serial { 0 };
+    wxString name;
+    name << wxGetProcessId() << "-" << wxDateTime::Now().GetTicks() << "-" << serial++;
+    writer_->path = wxFileName(JournalDir(), name, JOURNAL_EXT).GetFullPath().ToStdWstring();
+}
+
+Journal::~Journal()
+{
+    Flush(true);
+    writer_->Close();
+}
+
+std::string Journal::MakeHeader(const wxString& basePath, uint64_t size, int64_t time) const
+{
+    std::string header(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    for (auto& name : { path_, basePath })
+    {
+        std::string utf8(name.utf8_str());
+        Put<uint32_t>(header, utf8.length());
+        header += utf8;
+    }
+    Put<uint64_t>(header, size);
+    Put<int64_t>(header, time);
+    return header;
+}
+
+void Journal::Reset(const wxString& path, uint64_t length)
+{
+    // anything pending was made against the previous base
+    pending_.clear();
+    pending_bytes_ = 0;
+
+    path_ = path;
+    int64_t time = 0;
+    if (path != wxEmptyString && wxFileExists(path))
+    {
+        time = wxFileName(path).GetModificationTime().GetTicks();
+    }
+    // the length of the text, which isn't the size of a compressed file
+    header_ = MakeHeader(path, length, time);
+    if (started_)
+    {
+        Enqueue(Item { Item::Reset });
+        started_ = false;
+    }
+}
+
+void Journal::Insert(unsigned position, const char* text, size_t length)
+{
+    if (!pending_.empty())
+    {
+        auto& last = pending_.back();
+        // typing: extend the previous insert
+        if (last.op == 'I' && last.position + last.length == position)
+        {
+            last.text.append(text, length);
+            last.length += length;
+            pending_bytes_ += length;
+            return;
+        }
+    }
+    pending_.emplace_back(Record { 'I', position, (uint32_t)length, std::string(text, length) });
+    pending_bytes_ += length + 9;
+    if (pending_bytes_ >= FLUSH_SIZE) Flush();
+}
+
+void Journal::Delete(unsigned position, unsigned length)
+{
+    if (!pending_.empty())
+    {
+        auto& last = pending_.back();
+        // backspace over text that was just typed
+        if (last.op == 'I' && position >= last.position &&
+            position + length == last.position + last.length)
+        {
+            last.length -= length;
+            last.text.resize(last.length);
+            if (last.length == 0) pending_.pop_back();
+            return;
+        }
+        // backspace or delete key runs
+        if (last.op == 'D' && position + length == last.position)
+        {
+            last.position = position;
+            last.length += length;
+            return;
+        }
+        if (last.op == 'D' && position == last.position)
+        {
+            last.length += length;
+            return;
+        }
+    }
+    pending_.emplace_back(Record { 'D', position, length });
+    pending_bytes_ += 9;
+}
+
+void Journal::Flush(bool wait/* = false */)
+{
+    if (pending_.empty())
+    {
+        if (wait) writer_->Drain();
+        return;
+    }
+
+    std::string data;
+    data.reserve(pending_bytes_ + header_.length());
+    if (!started_) data = header_;
+    for (auto& record : pending_)
+    {
+        Put<char>(data, record.op);
+        Put<uint32_t>(data, record.position);
+        Put<uint32_t>(data, record.length);
+        data += record.text;
+    }
+    pending_.clear();
+    pending_bytes_ = 0;
+    Enqueue(Item { started_ ? Item::Append : Item::Reset, std::move(data) }, wait);
+    started_ = true;
+}
+
+void Journal::MaybeCheckpoint(wxStyledTextCtrl* editor)
+{
+    uint64_t length = editor->GetLength();
+    if (writer_->size < CHECKPOINT_MIN_SIZE || writer_->size < 2 * length) return;
+    Checkpoint(editor);
+}
+
+void Journal::Checkpoint(wxStyledTextCtrl* editor)
+{
+    uint64_t length = editor->GetLength();
+    auto snapshot = writer_->path;
+    snapshot.replace_extension("base");
+    auto data = std::make_shared<std::string>(editor->GetCharacterPointer(), length);
+    pending_.clear();
+    pending_bytes_ = 0;
+    // the snapshot is ours, only its size is checked on replay
+    header_ = MakeHeader(wxString(snapshot.native()), length, 0);
+    Enqueue(Item { Item::Checkpoint, header_, data });
+    started_ = true;
+}
+
+void Journal::Enqueue(Item item, bool wait/* = false */)
+{
+    {
+        std::lock_guard<std::mutex> lock(writer_->queue_mutex);
+        writer_->items.emplace_back(std::move(item));
+    }
+    if (wait)
+    {
+        writer_->Drain();
+        return;
+    }
+    auto writer = writer_;
+    WorkPool::shared().submit([writer]() { writer->Drain(); }, WorkPool::Foreground);
+}
+
+void Journal::Discard()
+{
+    {
+        std::lock_guard<std::mutex> lock(writer_->queue_mutex);
+        writer_->items.clear();
+    }
+    pending_.clear();
+    pending_bytes_ = 0;
+    started_ = false;
+
+    std::lock_guard<std::mutex> lock(writer_->write_mutex);
+    writer_->Close();
+    Remove(wxString(writer_->path.native()));
+}
+
+void Journal::Remove(const wxString& journalPath)
+{
+    std::filesystem::path path(journalPath.ToStdWstring());
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    std::filesystem::remove(path.replace_extension("base"), ec);
+}
+
+/* */
+
+std::vector<wxString> Journal::FindOrphans()
+{
+    std::vector<wxString> orphans;
+    wxArrayString files;
+    wxDir::GetAllFiles(JournalDir(), &files, "*." + JOURNAL_EXT, wxDIR_FILES);
+    for (auto& file : files)
+    {
+        auto handle = OpenExclusive(file.ToStdWstring(), false);
+        if (!handle) continue;
+        std::fseek(handle, 0, SEEK_END);
+        bool empty = std::ftell(handle) == 0;
+        std::fclose(handle);
+        // cut short between a reset and its header
+        if (empty) Remove(file);
+        else orphans.push_back(file);
+    }
+    return orphans;
+}
+
+Journal* Journal::Resume(const wxString& journalPath, const wxString& path)
+{
+    auto journal = new Journal(std::filesystem::path(journalPath.ToStdWstring()));
+    journal->path_ = path;
+    journal->started_ = true;
+    journal->writer_->Open(false);
+    if (journal->writer_->file)
+    {
+        journal->writer_->size = std::ftell(journal->writer_->file);
+    }
+    return journal;
+}
+
+bool Journal::Replay(const wxString& journalPath, wxStyledTextCtrl* editor,
+                     wxString* path, wxString* error)
+{
+    std::string data;
+    {
+#ifdef _WIN32
+        auto file = _wfopen(journalPath.wc_str(), L"rb");
+#else
+        auto file = std::fopen(journalPath.fn_str(), "rb");
+#endif
+        if (!file)
+        {
+            *error = _T("Cannot read the journal");
+            return false;
+        }
+        char buffer[1 << 16];
+        size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            data.append(buffer, n);
+        }
+        std::fclose(file);
+    }
+
+    if (data.compare(0, sizeof(JOURNAL_MAGIC), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0)
+    {
+        *error = _T("Not a journal");
+        return false;
+    }
+    size_t pos = sizeof(JOURNAL_MAGIC);
+    wxString names[2];
+    for (auto& name : names)
+    {
+        uint32_t length;
+        if (!Get(data, pos, length) || pos + length > data.size())
+        {
+            *error = _T("Truncated journal header");
+            return false;
+        }
+        name = wxString::FromUTF8(data.data() + pos, length);
+        pos += length;
+    }
+    uint64_t baseSize;
+    int64_t baseTime;
+    if (!Get(data, pos, baseSize) || !Get(data, pos, baseTime))
+    {
+        *error = _T("Truncated journal header");
+        return false;
+    }
+    *path = names[0];
+    auto& basePath = names[1];
+
+    editor->ClearAll();
+    if (basePath != wxEmptyString)
+    {
+        bool changed = baseTime != 0 && wxFileExists(basePath) &&
+                       wxFileName(basePath).GetModificationTime().GetTicks() != baseTime;
+        if (changed || !editor->LoadFile(basePath) || (uint64_t)editor->GetLength() != baseSize)
+        {
+            *error = _T("The file changed since the journal was written");
+            return false;
+        }
+    }
+
+    // a record cut short by the crash simply ends the replay
+    char op;
+    uint32_t position, length;
+    while (Get(data, pos, op) && Get(data, pos, position) && Get(data, pos, length))
+    {
+        if (position > (uint32_t)editor->GetLength()) break;
+        if (op == 'I')
+        {
+            if (pos + length > data.size()) break;
+            editor->InsertTextRaw(position, data.substr(pos, length).c_str());
+            pos += length;
+        }
+        else if (op == 'D')
+        {
+            editor->DeleteRange(position, length);
+        }
+        else break;
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <wx/string.h>
+
+class wxStyledTextCtrl;
+
+/* Append-only log of the edits made to a document since its last save.
+ *
+ * A journal starts with a header naming the document and the base file
+ * the edits apply to (the saved document, or a checkpoint snapshot),
+ * followed by insert and delete records in
+ * buffer byte positions. Records are coalesced in memory while typing and
+ * appended in batches on the shared pool; nothing ever rewrites the
+ * document except an occasional checkpoint once the journal outgrows it.
+ *
+ * Journals live in the user data directory and are removed when their
+ * document is saved or discarded, so whatever is left at startup belongs
+ * to a session that crashed. The file is only created with the first
+ * edit, so untouched documents leave nothing behind.
+ */
+class Journal {
+public:
+    Journal();
+    ~Journal();
+    // starts over against a freshly loaded or saved file, or no file at all
+    void Reset(const wxString& path, uint64_t length);
+    void Insert(unsigned position, const char* text, size_t length);
+    void Delete(unsigned position, unsigned length);
+    // hands pending records to the pool, or writes them right away
+    void Flush(bool wait = false);
+    // replaces the base by a snapshot of the buffer
+    void Checkpoint(wxStyledTextCtrl* editor);
+    // the same, once the journal outgrew the document
+    void MaybeCheckpoint(wxStyledTextCtrl* editor);
+    void Discard();
+
+    // journals left behind by a crashed session
+    static std::vector<wxString> FindOrphans();
+    // applies a journal to editor; fills path with the document it edits
+    static bool Replay(const wxString& journalPath, wxStyledTextCtrl* editor,
+                       wxString* path, wxString* error);
+    // picks up a replayed orphan to keep appending to it
+    static Journal* Resume(const wxString& journalPath, const wxString& path);
+    static void Remove(const wxString& journalPath);
+
+private:
+    struct Record {
+        char op;
+        uint32_t position;
+        uint32_t length;
+        std::string text;
+    };
+    struct Item {
+        enum Kind { Append, Reset, Checkpoint } kind;
+        std::string data;
+        std::shared_ptr<std::string> snapshot;
+    };
+    struct Writer {
+        std::filesystem::path path;
+        std::FILE* file = nullptr;
+        // serializes the jobs, then guards the items they take in order
+        std::mutex write_mutex;
+        std::mutex queue_mutex;
+        std::deque<Item> items;
+        std::atomic<uint64_t> size { 0 };
+        void Drain();
+        void Open(bool truncate);
+        void Close();
+    };
+    //
+    Journal(const std::filesystem::path& path);
+    void Enqueue(Item item, bool wait = false);
+    std::string MakeHeader(const wxString& basePath, uint64_t size, int64_t time) const;
+
+    std::shared_ptr<Writer> writer_;
+    wxString path_;
+    // the header of the next write, until the journal file is started
+    std::string header_;
+    bool started_;
+    std::vector<Record> pending_;
+    size_t pending_bytes_;
+};
@@ -5,12 +5,21 @@
 #include <iostream>
 
 #include <wx/aboutdlg.h>
+#include <wx/choicdlg.h>
+#include <wx/config.h>
+#include <wx/ffile.h>
 #include <wx/filename.h>
 #include <wx/menu.h>
 #include <wx/msgdlg.h>
 #include <wx/stc/stc.h>
+#include <wx/stopwatch.h>
+#include <wx/textdlg.h>
 
 #include "main.h"
+#include "fileio.h"
+#include "gproc/footprint.h"
+#include "gproc/minify.h"
+#include "gproc/pool.h"
 
 App::App()
 {
@@ -21,6 +30,7 @@ bool App::OnInit()
 {
     auto frame = new MainFrame(GetAppDisplayName());
     frame->Show();
+    frame->RecoverJournals();
     return true;
 }
 
@@ -28,13 +38,15 @@ IMPLEMENT_APP(App);
 
 MainFrame::MainFrame(const wxString& title)
         : wxFrame(NULL, wxID_ANY, title, wxDefaultPosition, wxSize(1280, 800)),
-          editor_(new Editor(this))
+          editor_(nullptr), preview_(nullptr), sidebar_(nullptr),
+          memory_panel_(nullptr), alive_(std::make_shared<bool>(true))
 {
     auto fileMenu = new wxMenu;
     fileMenu->Append(wxID_NEW);
     fileMenu->Append(wxID_OPEN);
     fileMenu->Append(wxID_SAVE);
     fileMenu->Append(wxID_SAVEAS, _T("Save &As..."));
+    fileMenu->Append(wxID_CLOSE, _T("&Close\tCtrl+W"));
     fileMenu->AppendSeparator();
     fileMenu->Append(wxID_EXIT);
 
@@ -42,15 +54,85 @@ MainFrame::MainFrame(const wxString& title)
     Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnOpen, this, wxID_OPEN);
     Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnSave, this, wxID_SAVE);
     Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnSaveAs, this, wxID_SAVEAS);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnCloseTab, this, wxID_CLOSE);
     Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnExit, this, wxID_EXIT);
 
+    auto searchMenu = new wxMenu;
+    searchMenu->Append(wxID_FIND, _T("&Find Words...\tCtrl+F"));
+    searchMenu->Append(ID_FIND_NEXT, _T("Find &Next\tF3"));
+    searchMenu->Append(ID_FIND_PREV, _T("Find &Previous\tShift+F3"));
+    searchMenu->AppendSeparator();
+    searchMenu->Append(ID_COMPARE, _T("&Compare With..."));
+    searchMenu->Append(ID_GOTO_LAYER, _T("Go to &Layer...\tCtrl+L"));
+
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnFindWords, this, wxID_FIND);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnFindNext, this, ID_FIND_NEXT);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnFindNext, this, ID_FIND_PREV);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnCompare, this, ID_COMPARE);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnGotoLayer, this, ID_GOTO_LAYER);
+
+    auto transformMenu = new wxMenu;
+    transformMenu->Append(ID_TRANSFORM_OFFSET, _T("&Offset Axis..."));
+    transformMenu->Append(ID_TRANSFORM_SCALE, _T("&Scale Feeds..."));
+    transformMenu->Append(ID_TRANSFORM_MIRROR, _T("&Mirror Axis..."));
+    transformMenu->AppendSeparator();
+    transformMenu->Append(ID_TRANSFORM_METRIC, _T("Convert to M&etric (G71)"));
+    transformMenu->Append(ID_TRANSFORM_IMPERIAL, _T("Convert to &Imperial (G70)"));
+
+    transformMenu->AppendSeparator();
+    transformMenu->Append(ID_REFORMAT, _T("&Reformat"));
+    transformMenu->Append(ID_RENUMBER, _T("Re&number Blocks"));
+    transformMenu->Append(ID_OPTIMIZE_RAPIDS, _T("Optimize R&apids..."));
+    transformMenu->Append(ID_FIT_ARCS, _T("&Fit Arcs..."));
+
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnTransform, this,
+         ID_TRANSFORM_OFFSET, ID_TRANSFORM_IMPERIAL);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnReformat, this, ID_REFORMAT);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnReformat, this, ID_RENUMBER);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnOptimizeRapids, this, ID_OPTIMIZE_RAPIDS);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnFitArcs, this, ID_FIT_ARCS);
+
+    auto dialectMenu = new wxMenu;
+    dialectMenu->AppendRadioItem(ID_DIALECT_RS274, _T("&RS-274"));
+    dialectMenu->AppendRadioItem(ID_DIALECT_FANUC, _T("&Fanuc"));
+    dialectMenu->AppendRadioItem(ID_DIALECT_HAAS, _T("&Haas"));
+    dialectMenu->AppendRadioItem(ID_DIALECT_LINUXCNC, _T("&LinuxCNC"));
+    dialectMenu->AppendRadioItem(ID_DIALECT_MARLIN, _T("&Marlin/RepRap"));
+
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnDialect, this,
+         ID_DIALECT_RS274, ID_DIALECT_MARLIN);
+
+    auto machineMenu = new wxMenu;
+    machineMenu->Append(ID_SEND_CONTROLLER, _T("Send to &Controller..."));
+    machineMenu->Append(ID_SEND_SIMULATOR, _T("Send to &Simulator"));
+    machineMenu->Append(ID_SEND_STOP, _T("S&top Sending"));
+    machineMenu->Append(ID_MINIFY, _T("&Minify for Streaming..."));
+    machineMenu->AppendSeparator();
+    machineMenu->Append(ID_CHECK_COLLISIONS, _T("Check C&ollisions..."));
+
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnSend, this,
+         ID_SEND_CONTROLLER, ID_SEND_SIMULATOR);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnStopSending, this, ID_SEND_STOP);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnMinify, this, ID_MINIFY);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnCheckCollisions, this, ID_CHECK_COLLISIONS);
+
     auto helpMenu = new wxMenu;
+    helpMenu->AppendCheckItem(ID_MEMORY_PANEL, _T("&Memory Usage"));
+    helpMenu->AppendSeparator();
     helpMenu->Append(wxID_ABOUT);
 
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnMemoryPanel, this, ID_MEMORY_PANEL);
+    Bind(wxEVT_UPDATE_UI, [this](wxUpdateUIEvent& event) {
+        event.Check(memory_panel_ && memory_panel_->IsShown());
+    }, ID_MEMORY_PANEL);
     Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::OnAbout, this, wxID_ABOUT);
 
     auto menubar = new wxMenuBar;
     menubar->Append(fileMenu, wxGetStockLabel(wxID_FILE));
+    menubar->Append(searchMenu, _T("&Search"));
+    menubar->Append(transformMenu, _T("&Transform"));
+    menubar->Append(dialectMenu, _T("&Dialect"));
+    menubar->Append(machineMenu, _T("&Machine"));
     menubar->Append(helpMenu, wxGetStockLabel(wxID_HELP));
     SetMenuBar(menubar);
 
@@ -58,87 +140,237 @@ MainFrame::MainFrame(const wxString& title)
 
     CreateStatusBar();
 
+    notebook_ = new wxNotebook(this, wxID_ANY);
+    notebook_->Bind(wxEVT_NOTEBOOK_PAGE_CHANGED, &MainFrame::OnPageChanged, this);
+
+    preview_ = new Preview(this);
+    sidebar_ = new Sidebar(this);
+
     auto sizer = new wxBoxSizer(wxHORIZONTAL);
-    sizer->Add(editor_, 1, wxEXPAND);
-    sizer->Add(new Sidebar(this), 0, wxEXPAND);
+    sizer->Add(notebook_, 1, wxEXPAND);
+    sizer->Add(preview_, 0, wxEXPAND);
+    sizer->Add(sidebar_, 0, wxEXPAND);
     SetSizer(sizer);
 
-    editor_->SetFocus();
-
-    editor_->Bind(wxEVT_STC_SAVEPOINTLEFT, [=](wxCommandEvent&) { UpdateTitle(); });
-    editor_->Bind(wxEVT_STC_SAVEPOINTREACHED, [=](wxCommandEvent&) { UpdateTitle(); });
     Bind(STC_STATUS_CHANGED, &MainFrame::OnStatusChanged, this);
 
-    UpdateTitle();
+    AddEditor();
     Centre();
 }
 
 MainFrame::~MainFrame()
 {
-    delete editor_;
+    StopSending();
 }
 
-void MainFrame::OnStatusChanged(wxCommandEvent& event)
+Editor* MainFrame::AddEditor()
 {
-    SetStatusText(event.GetString());
+    auto editor = new Editor(notebook_);
+    editor->Bind(wxEVT_STC_SAVEPOINTLEFT, [=](wxCommandEvent&) { UpdateTabLabel(editor); UpdateTitle(); });
+    editor->Bind(wxEVT_STC_SAVEPOINTREACHED, [=](wxCommandEvent&) { UpdateTabLabel(editor); UpdateTitle(); });
+
+    notebook_->AddPage(editor, wxEmptyString, true);
+    // AddPage only sends a page changed event when there was a page before
+    if (notebook_->GetPageCount() == 1)
+    {
+        SelectEditor(editor);
+    }
+    editor->SetFocus();
+    return editor;
+}
+
+void MainFrame::OnPageChanged(wxBookCtrlEvent& event)
+{
+    SelectEditor((Editor*) notebook_->GetPage(event.GetSelection()));
 }
 
-bool MainFrame::DoSave(bool forceSaveAs/* = false */)
+void MainFrame::SelectEditor(Editor* editor)
 {
-    auto path = path_.get();
-    if (!forceSaveAs && path != wxEmptyString)
+    editor_ = editor;
+    for (size_t i = 0; i < notebook_->GetPageCount(); ++i)
     {
-        editor_->SaveFile(path);
-        return true;
+        auto page = (Editor*) notebook_->GetPage(i);
+        page->SetForeground(page == editor_);
     }
 
-    auto dialog = new wxFileDialog(
-        this, _T("Save As"), wxEmptyString, wxEmptyString,
-        _("G-code files (*.gcode)|*.gcode;*.txt|All files (*.*)|*"),
-        wxFD_SAVE | wxFD_OVERWRITE_PROMPT, wxDefaultPosition);
+    GetMenuBar()->Check(ID_DIALECT_RS274 + editor_->GetDialect(), true);
+    SetStatusText(editor_->GetStatus());
+    preview_->SetEditor(editor_);
+    sidebar_->SetEditor(editor_);
+    UpdateTitle();
+}
 
-    bool ret = false;
-    if (dialog->ShowModal() == wxID_OK)
+void MainFrame::OnStatusChanged(wxCommandEvent& event)
+{
+    // background documents keep their status until they are selected
+    if (event.GetEventObject() != editor_) return;
+    SetStatusText(event.GetString());
+    preview_->SetEditor(editor_);
+}
+
+bool MainFrame::DoSave(bool forceSaveAs/* = false */, bool wait/* = false */)
+{
+    auto path = editor_->GetPath();
+    if (forceSaveAs || path == wxEmptyString)
     {
-        editor_->SaveFile(dialog->GetPath());
-        path_.set(this, dialog->GetPath());
-        ret = true;
+        auto dialog = new wxFileDialog(
+            this, _T("Save As"), wxEmptyString, wxEmptyString,
+            _("G-code files (*.gcode, *.gcode.gz)|*.gcode;*.txt;*.gz|All files (*.*)|*"),
+            wxFD_SAVE | wxFD_OVERWRITE_PROMPT, wxDefaultPosition);
+
+        path = wxEmptyString;
+        if (dialog->ShowModal() == wxID_OK)
+        {
+            path = dialog->GetPath();
+        }
+        dialog->Destroy();
+        if (path == wxEmptyString) return false;
+
+        editor_->SetPath(path);
+        UpdateTitle();
     }
-    dialog->Destroy();
+
+    auto editor = editor_;
+    bool ret = true;
+    SetStatusText(_T("Saving ") + wxFileName(path).GetFullName() + "...");
+    editor->SaveAsync(path, [=, &ret](const wxString& error) {
+        if (error != wxEmptyString)
+        {
+            // only the synchronous path is still around to read ret
+            if (wait) ret = false;
+            wxMessageBox(error, _T("Could not save ") + path, wxOK|wxICON_ERROR, this);
+            return;
+        }
+        UpdateTabLabel(editor);
+        UpdateTitle();
+        if (editor == editor_)
+        {
+            SetStatusText(_T("Saved ") + wxFileName(path).GetFullName());
+        }
+    }, wait);
     return ret;
 }
 
 void MainFrame::OnClose(wxCloseEvent& event)
 {
-    // TODO: if we can't veto, we should save changes to Documents folder
-    if(event.CanVeto() && !QueryCanDiscard()) {
-        event.Veto();
+    if (!event.CanVeto())
+    {
+        // no time to ask, leave the changes for the next session
+        for (size_t i = 0; i < notebook_->GetPageCount(); ++i)
+        {
+            ((Editor*) notebook_->GetPage(i))->KeepJournal();
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < notebook_->GetPageCount(); ++i)
+        {
+            if (!((Editor*) notebook_->GetPage(i))->GetModify()) continue;
+
+            notebook_->ChangeSelection(i);
+            SelectEditor((Editor*) notebook_->GetPage(i));
+            if (!QueryCanDiscard()) {
+                event.Veto();
+                return;
+            }
+        }
     }
     event.Skip();
 }
 
-void MainFrame::OnNew(wxCommandEvent& WXUNUSED(event))
+void MainFrame::OnCloseTab(wxCommandEvent& WXUNUSED(event))
 {
     if (!QueryCanDiscard()) return;
 
-    editor_->ClearAll();
-    editor_->EmptyUndoBuffer();
-    path_.set(this, wxEmptyString);
+    if (notebook_->GetPageCount() == 1)
+    {
+        // always keep a document around
+        editor_->ClearAll();
+        editor_->EmptyUndoBuffer();
+        editor_->SetPath(wxEmptyString);
+        editor_->ResetJournal();
+        UpdateTitle();
+        return;
+    }
+    notebook_->DeletePage(notebook_->GetSelection());
+    SelectEditor((Editor*) notebook_->GetCurrentPage());
 }
 
-void MainFrame::OnOpen(wxCommandEvent& WXUNUSED(event))
+void MainFrame::RecoverJournals()
 {
-    if (!QueryCanDiscard()) return;
+    unsigned recovered = 0;
+    for (auto& journal : Journal::FindOrphans())
+    {
+        // reuse a pristine untitled document rather than piling up tabs
+        auto editor = editor_;
+        if (editor->GetPath() != wxEmptyString || editor->GetModify() ||
+            editor->GetLength() > 0)
+        {
+            editor = AddEditor();
+        }
+
+        wxString error;
+        if (editor->Recover(journal, &error))
+        {
+            UpdateTabLabel(editor);
+            ++recovered;
+            continue;
+        }
+
+        editor->ClearAll();
+        editor->EmptyUndoBuffer();
+        editor->SetSavePoint();
+        editor->ResetJournal();
+        if (notebook_->GetPageCount() > 1)
+        {
+            notebook_->DeletePage(notebook_->FindPage(editor));
+            SelectEditor((Editor*) notebook_->GetCurrentPage());
+        }
+        auto answer = wxMessageBox(
+            error + _T("\n\nDiscard these unsaved changes?"),
+            _T("Could not recover ") + journal, wxYES_NO|wxICON_WARNING, this);
+        if (answer == wxYES) Journal::Remove(journal);
+    }
+    UpdateTitle();
+
+    if (recovered > 0)
+    {
+        wxString msg;
+        msg << "Recovered unsaved changes to " << recovered << " documents";
+        SetStatusText(msg);
+    }
+}
+
+void MainFrame::OnNew(wxCommandEvent& WXUNUSED(event))
+{
+    AddEditor();
+}
 
+void MainFrame::OnOpen(wxCommandEvent& WXUNUSED(event))
+{
     auto dialog = new wxFileDialog(
         this, _T("Open"), wxEmptyString, wxEmptyString,
-        _("G-code files (*.gcode)|*.gcode;*.txt|All files (*.*)|*"),
+        _("G-code files (*.gcode, *.gcode.gz)|*.gcode;*.txt;*.gz|All files (*.*)|*"),
         wxFD_OPEN, wxDefaultPosition);
 
     if (dialog->ShowModal() == wxID_OK)
     {
-        editor_->LoadFile(dialog->GetPath());
-        path_.set(this, dialog->GetPath());
+        // reuse a pristine untitled document rather than piling up tabs
+        if (editor_->GetPath() != wxEmptyString || editor_->GetModify() ||
+            editor_->GetLength() > 0)
+        {
+            AddEditor();
+        }
+        if (!editor_->LoadFile(dialog->GetPath()))
+        {
+            wxMessageBox(editor_->GetStatus(), _T("Could not open ") + dialog->GetPath(),
+                         wxOK|wxICON_ERROR, this);
+        }
+        else
+        {
+            editor_->SetPath(dialog->GetPath());
+        }
+        UpdateTitle();
     }
     dialog->Destroy();
 }
@@ -153,6 +385,553 @@ void MainFrame::OnSaveAs(wxCommandEvent& WXUNUSED(event))
     DoSave(true);
 }
 
+void MainFrame::OnFindWords(wxCommandEvent& WXUNUSED(event))
+{
+    wxString prompt = _T("Words to find, e.g. S>12000 or G0 & Z<0");
+    // what the program holds, to pick limits from
+    if (auto ranges = editor_->GetRanges())
+    {
+        for (auto kind : { Token::S, Token::F, Token::Z })
+        {
+            auto& range = ranges->range(kind);
+            if (!range.count) continue;
+            prompt << "\n" << TokenType_ToString(kind) << " " << range.min << " to " << range.max;
+        }
+    }
+    auto query = wxGetTextFromUser(prompt, _T("Find Words"), wxEmptyString, this);
+    if (query == wxEmptyString) return;
+
+    try {
+        wxStopWatch watch;
+        auto count = editor_->FindBlocks(query);
+        wxString msg;
+        msg << count << " blocks found in " << watch.Time() << " ms";
+        SetStatusText(msg);
+    }
+    catch (QueryException e)
+    {
+        SetStatusText(std::to_string(e.position()) + ": " + e.what());
+    }
+}
+
+void MainFrame::OnFindNext(wxCommandEvent& event)
+{
+    editor_->FindNext(event.GetId() == ID_FIND_NEXT);
+}
+
+void MainFrame::OnCompare(wxCommandEvent& WXUNUSED(event))
+{
+    if (!editor_->IsProgramCurrent())
+    {
+        SetStatusText(_T("Program must compile before it can be compared"));
+        return;
+    }
+
+    auto dialog = new wxFileDialog(
+        this, _T("Compare With"), wxEmptyString, wxEmptyString,
+        _("G-code files (*.gcode, *.gcode.gz)|*.gcode;*.txt;*.gz|All files (*.*)|*"),
+        wxFD_OPEN, wxDefaultPosition);
+    wxString path;
+    if (dialog->ShowModal() == wxID_OK)
+    {
+        path = dialog->GetPath();
+    }
+    dialog->Destroy();
+    if (path == wxEmptyString) return;
+
+    auto editor = editor_;
+    auto name = wxFileName(path).GetFullName();
+    SetStatusText(_T("Comparing with ") + name + "...");
+    editor->CompareAsync(path, [=](const wxString& status) {
+        if (editor == editor_) SetStatusText(name + ": " + status);
+    });
+}
+
+void MainFrame::OnGotoLayer(wxCommandEvent& WXUNUSED(event))
+{
+    auto layers = editor_->GetLayers();
+    if (!layers || !layers->size())
+    {
+        SetStatusText(_T("Program has no layers"));
+        return;
+    }
+
+    wxString prompt;
+    prompt << "Layer, 1 to " << layers->size();
+    auto value = wxGetTextFromUser(prompt, _T("Go to Layer"), "1", this);
+    unsigned long number;
+    if (!value.ToULong(&number) || number < 1 || number > layers->size()) return;
+
+    auto layer = (unsigned) number - 1;
+    editor_->GotoLayer(layer);
+    SetStatusText(wxString::Format(
+        "Layer %u at Z%g: %.0f mm filament, %.0f mm travel, %.0f s; %.2f m filament and %.0f min up to here",
+        layer + 1, layers->z(layer), layers->extruded(layer), layers->travel(layer),
+        layers->time(layer), layers->extruded_through(layer) / 1000, layers->time_through(layer) / 60));
+}
+
+void MainFrame::OnDialect(wxCommandEvent& event)
+{
+    // menu ids follow the order of Dialect::Kind
+    editor_->SetDialect((Dialect::Kind)(event.GetId() - ID_DIALECT_RS274));
+}
+
+void MainFrame::OnReformat(wxCommandEvent& event)
+{
+    Serializer::Options options;
+    if (event.GetId() == ID_RENUMBER)
+    {
+        options.numbering = Serializer::Renumber;
+    }
+
+    // the serializer writes words, not macro statements
+    auto program = editor_->GetProgram();
+    if (program && !program->macros().empty())
+    {
+        SetStatusText(_T("Programs with macros cannot be reformatted"));
+        return;
+    }
+
+    wxStopWatch watch;
+    wxString msg;
+    if (editor_->Reformat(options))
+    {
+        msg << "Reformatted in " << watch.Time() << " ms";
+    }
+    else
+    {
+        msg << "Program must compile before it can be reformatted";
+    }
+    SetStatusText(msg);
+}
+
+void MainFrame::OnTransform(wxCommandEvent& event)
+{
+    const wxString axes[] = { "X", "Y", "Z" };
+    std::optional<Transform> transform;
+    double amount;
+
+    switch (event.GetId())
+    {
+    case ID_TRANSFORM_OFFSET:
+    {
+        auto axis = wxGetSingleChoiceIndex(_T("Axis to offset"), _T("Offset Axis"),
+                                           WXSIZEOF(axes), axes, this);
+        if (axis == -1) return;
+        auto value = wxGetTextFromUser(_T("Offset"), _T("Offset Axis"), "0", this);
+        if (!value.ToDouble(&amount)) return;
+        transform = Transform::offset(TokenType_FromChar(axes[axis][0]), amount);
+        break;
+    }
+    case ID_TRANSFORM_SCALE:
+    {
+        auto value = wxGetTextFromUser(_T("Feed percentage"), _T("Scale Feeds"), "100", this);
+        if (!value.ToDouble(&amount)) return;
+        transform = Transform::scale(Token::F, amount / 100);
+        break;
+    }
+    case ID_TRANSFORM_MIRROR:
+    {
+        auto axis = wxGetSingleChoiceIndex(_T("Axis to mirror"), _T("Mirror Axis"),
+                                           WXSIZEOF(axes), axes, this);
+        if (axis == -1) return;
+        transform = Transform::mirror(TokenType_FromChar(axes[axis][0]));
+        break;
+    }
+    case ID_TRANSFORM_METRIC:
+        transform = Transform::to_metric();
+        break;
+    case ID_TRANSFORM_IMPERIAL:
+        transform = Transform::to_imperial();
+        break;
+    }
+
+    wxStopWatch watch;
+    auto count = editor_->ApplyTransform(*transform);
+    wxString msg;
+    if (count < 0)
+    {
+        msg << "Program must compile before it can be transformed";
+    }
+    else
+    {
+        msg << count << " values changed in " << watch.Time() << " ms";
+    }
+    SetStatusText(msg);
+}
+
+void MainFrame::OnOptimizeRapids(wxCommandEvent& WXUNUSED(event))
+{
+    if (!editor_->IsProgramCurrent())
+    {
+        SetStatusText(_T("Program must compile before it can be optimized"));
+        return;
+    }
+    if (!editor_->GetProgram()->macros().empty())
+    {
+        SetStatusText(_T("Programs with macros cannot be reordered"));
+        return;
+    }
+    auto value = wxGetTextFromUser(_T("Rapid rate (mm/min)"), _T("Optimize Rapids"), "5000", this);
+    double rate;
+    if (!value.ToDouble(&rate) || rate <= 0) return;
+
+    wxBusyCursor busy;
+    wxStopWatch watch;
+    auto program = editor_->GetProgram()->program();
+    RapidReorder reorder(program);
+    if (reorder.after() >= reorder.before())
+    {
+        SetStatusText(_T("No operations to reorder"));
+        return;
+    }
+    editor_->ReplaceProgram(reorder.apply());
+
+    unsigned operations = 0;
+    for (auto& group : reorder.groups()) operations += group.op_count;
+    SetStatusText(wxString::Format(
+        "%u operations in %zu groups reordered in %ld ms: rapids %.0f -> %.0f mm, %.1f -> %.1f s",
+        operations, reorder.groups().size(), watch.Time(),
+        reorder.before(), reorder.after(),
+        reorder.before() / rate * 60, reorder.after() / rate * 60));
+}
+
+void MainFrame::OnFitArcs(wxCommandEvent& WXUNUSED(event))
+{
+    if (!editor_->IsProgramCurrent())
+    {
+        SetStatusText(_T("Program must compile before arcs can be fitted"));
+        return;
+    }
+    if (!editor_->GetProgram()->macros().empty())
+    {
+        SetStatusText(_T("Programs with macros cannot be rewritten"));
+        return;
+    }
+    ArcFitter::Options options;
+    auto value = wxGetTextFromUser(_T("Tolerance (mm)"), _T("Fit Arcs"),
+                                   wxString::Format("%g", options.tolerance), this);
+    double tolerance;
+    if (!value.ToDouble(&tolerance) || tolerance <= 0) return;
+    options.tolerance = tolerance;
+    options.chord_tolerance = std::max<float>(options.chord_tolerance, tolerance);
+
+    wxBusyCursor busy;
+    wxStopWatch watch;
+    auto program = editor_->GetProgram()->program();
+    ArcFitter fitter(program, options);
+    if (fitter.arcs().empty())
+    {
+        SetStatusText(_T("No moves found on arcs"));
+        return;
+    }
+    editor_->ReplaceProgram(fitter.apply());
+    SetStatusText(wxString::Format("%zu arcs fitted in %ld ms: %zu -> %zu blocks",
+                                   fitter.arcs().size(), watch.Time(),
+                                   fitter.blocks_before(), fitter.blocks_after()));
+}
+
+void MainFrame::OnSend(wxCommandEvent& event)
+{
+    if (!editor_->IsProgramCurrent())
+    {
+        SetStatusText(_T("Program must compile before it can be sent"));
+        return;
+    }
+    if (!editor_->GetProgram()->macros().empty())
+    {
+        SetStatusText(_T("Programs with macros cannot be sent yet"));
+        return;
+    }
+    StopSending();
+
+    auto dialect = editor_->GetDialect();
+    try {
+        if (event.GetId() == ID_SEND_SIMULATOR)
+        {
+            simulator_.reset(new ControllerSimulator(ControllerSimulator::options_for(dialect)));
+            channel_ = simulator_->connect();
+        }
+        else
+        {
+            // the port and its rate are the same for every program
+            auto config = wxConfigBase::Get();
+            wxDialog dialog(this, wxID_ANY, _T("Send to Controller"));
+            auto device = new wxTextCtrl(&dialog, wxID_ANY, config->Read(_T("Machine/Port")),
+                                         wxDefaultPosition, wxSize(240, -1));
+            const wxString rates[] = {
+                "9600", "19200", "38400", "57600", "115200", "230400", "250000" };
+            // Marlin boards mostly run at 250000
+            auto baud = new wxComboBox(
+                &dialog, wxID_ANY,
+                config->Read(_T("Machine/Baud"), dialect == Dialect::Marlin ? "250000" : "115200"),
+                wxDefaultPosition, wxDefaultSize, WXSIZEOF(rates), rates);
+
+            auto grid = new wxFlexGridSizer(2, 8, 8);
+            grid->Add(new wxStaticText(&dialog, wxID_ANY, _T("Serial port, e.g. COM3 or /dev/ttyUSB0")),
+                      0, wxALIGN_CENTER_VERTICAL);
+            grid->Add(device, 1, wxEXPAND);
+            grid->Add(new wxStaticText(&dialog, wxID_ANY, _T("Baud rate")), 0, wxALIGN_CENTER_VERTICAL);
+            grid->Add(baud, 1, wxEXPAND);
+            auto sizer = new wxBoxSizer(wxVERTICAL);
+            sizer->Add(grid, 1, wxALL|wxEXPAND, 16);
+            sizer->Add(dialog.CreateStdDialogButtonSizer(wxOK|wxCANCEL), 0, wxLEFT|wxRIGHT|wxBOTTOM|wxEXPAND, 16);
+            dialog.SetSizerAndFit(sizer);
+            if (dialog.ShowModal() != wxID_OK || device->GetValue() == wxEmptyString) return;
+
+            unsigned long rate;
+            if (!baud->GetValue().ToULong(&rate) || rate == 0)
+            {
+                SetStatusText(_T("Baud rate must be a number"));
+                return;
+            }
+            config->Write(_T("Machine/Port"), device->GetValue());
+            config->Write(_T("Machine/Baud"), baud->GetValue());
+            channel_.reset(new SerialChannel(device->GetValue().ToStdString(), (unsigned) rate));
+        }
+    }
+    catch (ChannelException& e)
+    {
+        simulator_.reset();
+        wxMessageBox(e.what(), _T("Could not connect"), wxOK|wxICON_ERROR, this);
+        return;
+    }
+
+    // later edits make new versions, this one stays as it is
+    auto program = editor_->GetProgram();
+    sender_.reset(new Sender(*channel_, Sender::options_for(dialect)));
+    auto sender = sender_.get();
+    std::weak_ptr<bool> alive = alive_;
+    send_thread_ = std::thread([=]() {
+        sender->run(program->program(), [=](const Sender::Progress& progress) {
+            if (!wxTheApp) return;
+            wxTheApp->CallAfter([=]() {
+                if (alive.expired()) return;
+                wxString msg;
+                msg << "Sent " << progress.acknowledged << "/" << progress.total << " blocks, "
+                    << wxString::Format("%.0f", progress.blocks_per_second) << " blocks/s";
+                if (progress.errors > 0) msg << ", " << progress.errors << " errors";
+                if (progress.error != "") msg << ": " << progress.error;
+                else if (progress.done) msg << ", done";
+                SetStatusText(msg);
+            });
+        });
+    });
+}
+
+void MainFrame::OnStopSending(wxCommandEvent& WXUNUSED(event))
+{
+    StopSending();
+}
+
+void MainFrame::StopSending()
+{
+    if (sender_) sender_->cancel();
+    if (send_thread_.joinable()) send_thread_.join();
+    sender_.reset();
+    channel_.reset();
+    simulator_.reset();
+}
+
+void MainFrame::OnMinify(wxCommandEvent& WXUNUSED(event))
+{
+    // files too large to open are streamed from disk to disk
+    wxString from, to;
+    auto dialog = new wxFileDialog(
+        this, _T("Minify"), wxEmptyString, wxEmptyString,
+        _("G-code files (*.gcode, *.gcode.gz)|*.gcode;*.txt;*.gz|All files (*.*)|*"),
+        wxFD_OPEN, wxDefaultPosition);
+    if (dialog->ShowModal() == wxID_OK) from = dialog->GetPath();
+    dialog->Destroy();
+    if (from == wxEmptyString) return;
+
+    wxFileName name(from);
+    if (name.GetExt().Lower() == "gz") name.ClearExt();
+    dialog = new wxFileDialog(
+        this, _T("Save Minified As"), name.GetPath(), name.GetName() + ".min.gcode",
+        _("G-code files (*.gcode)|*.gcode|All files (*.*)|*"),
+        wxFD_SAVE | wxFD_OVERWRITE_PROMPT, wxDefaultPosition);
+    if (dialog->ShowModal() == wxID_OK) to = dialog->GetPath();
+    dialog->Destroy();
+    if (to == wxEmptyString) return;
+
+    const wxString choices[] = { _T("Keep block numbers, for M97/M99 P, M98 H and G70-G73 P/Q"), _T("Keep comments") };
+    wxMultiChoiceDialog choose(this, _T("Words that can go are always removed"),
+                               _T("Minify for Streaming"), WXSIZEOF(choices), choices);
+    if (choose.ShowModal() != wxID_OK) return;
+    Minifier::Options options;
+    for (auto i : choose.GetSelections())
+    {
+        if (i == 0) options.numbers = true;
+        if (i == 1) options.comments = true;
+    }
+
+    auto dialect = editor_->GetDialect();
+    auto label = wxFileName(from).GetFullName();
+    SetStatusText(_T("Minifying ") + label + "...");
+    std::weak_ptr<bool> alive = alive_;
+    WorkPool::shared().submit([=]() {
+        wxStopWatch watch;
+        std::string error;
+        Minifier::Stats stats;
+        wxFFile out(to, "wb");
+        if (!out.IsOpened())
+        {
+            error = "Cannot write the file";
+        }
+        else
+        {
+            Minifier minifier(dialect, [&](const char* data, size_t length) {
+                if (out.Write(data, length) != length) throw MinifyException("Cannot write the file");
+            }, options);
+            // a file the minifier refuses ends up as the error, and the
+            // rest of the input is skipped
+            auto write = [&](const char* data, size_t length) {
+                if (!error.empty()) return;
+                try {
+                    minifier.write(data, length);
+                }
+                catch (MinifyException& e)
+                {
+                    error = e.what();
+                }
+            };
+            if (IsGzipFile(from))
+            {
+                auto read = ReadGzipFile(from, write);
+                if (error.empty()) error = read;
+            }
+            else
+            {
+                wxFFile in(from, "rb");
+                std::vector<char> buffer(1 << 20);
+                size_t length;
+                if (!in.IsOpened()) error = "Cannot read the file";
+                while (error.empty() && (length = in.Read(buffer.data(), buffer.size())) > 0)
+                {
+                    write(buffer.data(), length);
+                }
+                if (error.empty() && in.Error()) error = "Cannot read the file";
+            }
+            if (error.empty())
+            {
+                try {
+                    minifier.finish();
+                }
+                catch (MinifyException& e)
+                {
+                    error = e.what();
+                }
+            }
+            stats = minifier.stats();
+            out.Close();
+            if (!error.empty()) wxRemoveFile(to);
+        }
+        auto time = watch.Time();
+        if (!wxTheApp) return;
+        wxTheApp->CallAfter([=]() {
+            if (alive.expired()) return;
+            wxString msg;
+            msg << label << ": ";
+            if (!error.empty())
+            {
+                msg << wxString::FromUTF8(error.c_str());
+                SetStatusText(msg);
+                return;
+            }
+            msg << wxString::Format("%zu -> %zu bytes (%.0f%% less), %zu -> %zu blocks in %ld ms",
+                                    stats.bytes_in, stats.bytes_out,
+                                    stats.bytes_in ? 100.0 - 100.0 * stats.bytes_out / stats.bytes_in : 0.0,
+                                    stats.blocks_in, stats.blocks_out, time);
+            if (stats.fallbacks > 0) msg << ", " << stats.fallbacks << " blocks kept whole";
+            SetStatusText(msg);
+        });
+    }, WorkPool::Foreground);
+}
+
+void MainFrame::OnMemoryPanel(wxCommandEvent& WXUNUSED(event))
+{
+    if (!memory_panel_)
+    {
+        memory_panel_ = new MemoryPanel(this, [this]() { return GetMemoryRows(); });
+    }
+    if (memory_panel_->IsShown())
+    {
+        memory_panel_->Hide();
+        return;
+    }
+    memory_panel_->Reload();
+    memory_panel_->Show();
+}
+
+std::vector<MemoryPanel::Row> MainFrame::GetMemoryRows()
+{
+    std::vector<MemoryPanel::Row> rows;
+    for (size_t i = 0; i < notebook_->GetPageCount(); ++i)
+    {
+        auto editor = (Editor*) notebook_->GetPage(i);
+        auto label = notebook_->GetPageText(i);
+        auto usage = editor->GetMemoryUsage();
+        rows.push_back({ label, _T("Text and styles"), usage.text, 0 });
+        rows.push_back({ label, _T("Program"), usage.program, 0 });
+        rows.push_back({ label, _T("Word index"), usage.index, 0 });
+        rows.push_back({ label, _T("Toolpath"), usage.toolpath, 0 });
+        rows.push_back({ label, _T("Analyses"), usage.analyses, 0 });
+        // the views only show the selected document
+        if (editor == editor_)
+        {
+            rows.push_back({ label, _T("Preview"), preview_->GetMemoryUsage(), 0 });
+            rows.push_back({ label, _T("Speed list"), sidebar_->GetMemoryUsage(), 0 });
+        }
+    }
+    for (unsigned k = 0; k < Footprint::TRANSIENTS; ++k)
+    {
+        auto kind = (Footprint::Transient) k;
+        auto total = Footprint::total(kind);
+        rows.push_back({ _T("All"), Footprint::name(kind), total.current, total.peak });
+    }
+    return rows;
+}
+
+void MainFrame::OnCheckCollisions(wxCommandEvent& WXUNUSED(event))
+{
+    if (!editor_->IsProgramCurrent())
+    {
+        SetStatusText(_T("Program must compile before it can be checked"));
+        return;
+    }
+
+    // the machine is the same for every program, kept between sessions
+    auto config = wxConfigBase::Get();
+    auto text = config->Read(_T("Machine/Setup"),
+        _T("; corners of the travel and the G54 origin in machine coordinates,\n"
+           "; corners of each fixture in program coordinates, all in mm\n"
+           "travel -500 -300 -400 500 300 0\n"
+           "origin -250 -150 -300\n"
+           "tool 0\n"));
+    wxTextEntryDialog dialog(
+        this, _T("Machine travel, work origin, tool radius and fixtures"), _T("Check Collisions"),
+        text, wxTextEntryDialogStyle | wxTE_MULTILINE);
+    dialog.SetSize(wxSize(480, 360));
+    if (dialog.ShowModal() != wxID_OK) return;
+    text = dialog.GetValue();
+
+    CollisionCheck::Setup setup;
+    std::string error;
+    if (!setup.parse(text.ToStdString(), &error))
+    {
+        SetStatusText(error);
+        return;
+    }
+    config->Write(_T("Machine/Setup"), text);
+
+    auto editor = editor_;
+    SetStatusText(_T("Checking collisions..."));
+    editor->CheckCollisionsAsync(setup, [=](const wxString& status) {
+        if (editor == editor_) SetStatusText(status);
+    });
+}
+
 void MainFrame::OnExit(wxCommandEvent& event)
 {
     // show warning dialog on the app close callback
@@ -192,7 +971,8 @@ bool MainFrame::QueryCanDiscard()
     auto dret = dialog->ShowModal();
     if (dret == wxID_YES)
     {
-        ret = DoSave();
+        // the document may be discarded right after, so wait for the write
+        ret = DoSave(false, true);
     }
     else if (dret == wxID_NO)
     {
@@ -206,9 +986,27 @@ bool MainFrame::QueryCanDiscard()
     return ret;
 }
 
+void MainFrame::UpdateTabLabel(Editor* editor)
+{
+    auto index = notebook_->FindPage(editor);
+    if (index == wxNOT_FOUND) return;
+
+    wxString label;
+    if (editor->GetModify()) {
+        label << "*";
+    }
+    if (editor->GetPath() != wxEmptyString) {
+        label << wxFileName(editor->GetPath()).GetFullName();
+    } else {
+        label << _T("Untitled");
+    }
+    notebook_->SetPageText(index, label);
+}
+
 void MainFrame::UpdateTitle()
 {
-    auto path = path_.get();
+    UpdateTabLabel(editor_);
+    auto path = editor_->GetPath();
 
     wxString basename;
     if (editor_->GetModify()) {
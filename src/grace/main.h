@@ -4,13 +4,22 @@
 
 #pragma once
 
+#include <memory>
+#include <thread>
+
 #include <wx/wx.h>
 
 #include <wx/app.h>
+#include <wx/notebook.h>
 
 #include "editor.h"
-#include "property.h"
+#include "memorypanel.h"
+#include "preview.h"
 #include "sidebar.h"
+#include "gproc/arcfit.h"
+#include "gproc/reorder.h"
+#include "gproc/sender.h"
+#include "gproc/simulator.h"
 
 class App : public wxApp
 {
@@ -22,35 +31,91 @@ public:
 
 DECLARE_APP(App);
 
+enum {
+    ID_FIND_NEXT = wxID_HIGHEST + 1,
+    ID_FIND_PREV,
+    ID_COMPARE,
+    ID_GOTO_LAYER,
+    ID_TRANSFORM_OFFSET,
+    ID_TRANSFORM_SCALE,
+    ID_TRANSFORM_MIRROR,
+    ID_TRANSFORM_METRIC,
+    ID_TRANSFORM_IMPERIAL,
+    ID_REFORMAT,
+    ID_RENUMBER,
+    ID_OPTIMIZE_RAPIDS,
+    ID_FIT_ARCS,
+    ID_DIALECT_RS274,
+    ID_DIALECT_FANUC,
+    ID_DIALECT_HAAS,
+    ID_DIALECT_LINUXCNC,
+    ID_DIALECT_MARLIN,
+    ID_SEND_CONTROLLER,
+    ID_SEND_SIMULATOR,
+    ID_SEND_STOP,
+    ID_MINIFY,
+    ID_CHECK_COLLISIONS,
+    ID_MEMORY_PANEL,
+};
+
 class MainFrame : public wxFrame {
     friend class App;
 public:
     MainFrame(const wxString& title);
     ~MainFrame();
-    bool DoSave(bool forceSaveAs = false);
+    Editor* AddEditor();
+    bool DoSave(bool forceSaveAs = false, bool wait = false);
     void OnClose(wxCloseEvent& event);
+    void OnCloseTab(wxCommandEvent& WXUNUSED(event));
     void OnNew(wxCommandEvent& WXUNUSED(event));
     void OnOpen(wxCommandEvent& WXUNUSED(event));
+    void OnPageChanged(wxBookCtrlEvent& event);
     void OnSave(wxCommandEvent& WXUNUSED(event));
     void OnSaveAs(wxCommandEvent& WXUNUSED(event));
     void OnStatusChanged(wxCommandEvent& event);
+    void OnFindWords(wxCommandEvent& WXUNUSED(event));
+    void OnFindNext(wxCommandEvent& event);
+    void OnCompare(wxCommandEvent& WXUNUSED(event));
+    void OnGotoLayer(wxCommandEvent& WXUNUSED(event));
+    void OnDialect(wxCommandEvent& event);
+    void OnReformat(wxCommandEvent& event);
+    void OnTransform(wxCommandEvent& event);
+    void OnOptimizeRapids(wxCommandEvent& WXUNUSED(event));
+    void OnFitArcs(wxCommandEvent& WXUNUSED(event));
+    void OnSend(wxCommandEvent& event);
+    void OnStopSending(wxCommandEvent& WXUNUSED(event));
+    void OnMinify(wxCommandEvent& WXUNUSED(event));
+    void OnCheckCollisions(wxCommandEvent& WXUNUSED(event));
+    void OnMemoryPanel(wxCommandEvent& WXUNUSED(event));
     void OnExit(wxCommandEvent& WXUNUSED(event));
     void OnAbout(wxCommandEvent& WXUNUSED(event));
     bool QueryCanDiscard();
+    // reopens the documents of a session that did not exit cleanly
+    void RecoverJournals();
+    void SelectEditor(Editor* editor);
     void UpdateTitle();
+    void UpdateTabLabel(Editor* editor);
+    void StopSending();
+    // what each document holds, for the memory panel
+    std::vector<MemoryPanel::Row> GetMemoryRows();
 
     wxString GetText() { return editor_->GetText(); }
+    Editor* GetEditor() { return editor_; }
 
 private:
+    wxNotebook* notebook_;
+    // editor of the selected tab
     Editor* editor_;
+    Preview* preview_;
+    Sidebar* sidebar_;
+    // made when first shown
+    MemoryPanel* memory_panel_;
 
-    property(wxString) {
-        wxString get() {
-            return value;
-        }
-        void set(MainFrame* self, wxString path) {
-            value = path;
-            self->UpdateTitle();
-        }
-    } path_;
+    // program being streamed to a controller, on a thread of its own
+    std::unique_ptr<ControllerSimulator> simulator_;
+    std::unique_ptr<Channel> channel_;
+    std::unique_ptr<Sender> sender_;
+    std::thread send_thread_;
+    // lets the sender thread find out whether the frame is gone
+    std::shared_ptr<bool> alive_;
 };
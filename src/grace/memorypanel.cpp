@@ -0,0 +1,72 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <wx/filename.h>
+
+#include "memorypanel.h"
+
+static wxString format_size(size_t bytes)
+{
+    return wxFileName::GetHumanReadableSize(wxULongLong(bytes), "0 B");
+}
+
+MemoryPanel::MemoryPanel(wxWindow* parent, Source source) :
+    wxFrame(parent, wxID_ANY, _T("Memory Usage"), wxDefaultPosition, wxSize(520, 420),
+            wxDEFAULT_FRAME_STYLE|wxFRAME_TOOL_WINDOW|wxFRAME_FLOAT_ON_PARENT),
+    source_(std::move(source)),
+    timer_(this)
+{
+    auto panel = new wxPanel(this);
+    list_ = new RowList(panel, {
+        { "Document", 160,
+          [](const Row& row) { return row.document; },
+          [](const Row& a, const Row& b) { return a.document < b.document; } },
+        { "Held by", 160,
+          [](const Row& row) { return row.holder; },
+          [](const Row& a, const Row& b) { return a.holder < b.holder; } },
+        { "Size", 90,
+          [](const Row& row) { return format_size(row.bytes); },
+          [](const Row& a, const Row& b) { return a.bytes < b.bytes; } },
+        { "Peak", -1,
+          [](const Row& row) { return row.peak ? format_size(row.peak) : wxString(); },
+          [](const Row& a, const Row& b) { return a.peak < b.peak; } },
+    });
+    total_ = new wxStaticText(panel, wxID_ANY, wxEmptyString);
+
+    auto sizer = new wxBoxSizer(wxVERTICAL);
+    sizer->Add(list_, 1, wxLEFT|wxRIGHT|wxTOP|wxEXPAND, 8);
+    sizer->Add(total_, 0, wxALL|wxEXPAND, 8);
+    panel->SetSizer(sizer);
+
+    Bind(wxEVT_CLOSE_WINDOW, &MemoryPanel::OnClose, this);
+    Bind(wxEVT_TIMER, &MemoryPanel::OnTimer, this);
+    timer_.Start(1000);
+    Reload();
+}
+
+void MemoryPanel::Reload()
+{
+    auto rows = source_();
+    size_t total = 0;
+    for (auto& row : rows) total += row.bytes;
+    total_->SetLabel(_T("Total ") + format_size(total));
+    list_->SetResults(std::move(rows));
+}
+
+void MemoryPanel::OnClose(wxCloseEvent& event)
+{
+    // kept around for the next time it is shown
+    if (event.CanVeto())
+    {
+        event.Veto();
+        Hide();
+        return;
+    }
+    event.Skip();
+}
+
+void MemoryPanel::OnTimer(wxTimerEvent& WXUNUSED(event))
+{
+    if (IsShown()) Reload();
+}
@@ -0,0 +1,48 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <wx/wx.h>
+
+#include <wx/timer.h>
+
+#include "resultlist.h"
+
+/* Floating window listing the memory held by each document, refreshed
+ * every second.
+ *
+ * The rows come from a function the owner provides, so the panel knows
+ * nothing about editors. Copies that come and go show their peak next to
+ * what they hold right now. Sorting by size shows where the memory goes.
+ */
+class MemoryPanel : public wxFrame {
+public:
+    struct Row {
+        wxString document;
+        wxString holder;
+        size_t bytes;
+        // highest it was, for transient copies
+        size_t peak;
+    };
+    using Source = std::function<std::vector<Row>()>;
+    //
+    MemoryPanel(wxWindow* parent, Source source);
+    // asks the source for the rows again
+    void Reload();
+
+private:
+    using RowList = ResultList<Row>;
+    //
+    void OnClose(wxCloseEvent& event);
+    void OnTimer(wxTimerEvent& event);
+
+    Source source_;
+    RowList* list_;
+    wxStaticText* total_;
+    wxTimer timer_;
+};
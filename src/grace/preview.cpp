@@ -0,0 +1,356 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <wx/dcbuffer.h>
+#include <wx/menu.h>
+
+#include "preview.h"
+#include "gproc/pool.h"
+
+enum {
+    ID_VIEW_TOP = wxID_HIGHEST + 100,
+    ID_VIEW_FRONT,
+    ID_VIEW_SIDE,
+    ID_VIEW_FIT,
+};
+
+// toolpath axes shown horizontally and vertically in each view
+static const unsigned VIEW_AXES[][2] = { {0, 1}, {0, 2}, {1, 2} };
+
+static const unsigned char MOTION_COLORS[][3] = {
+    {230, 150, 110},    // rapid
+    {40, 90, 190},      // feed
+    {30, 140, 80},      // arc
+};
+
+// how close to a segment the pointer must be, in pixels
+static const double PICK_RADIUS = 4;
+
+/* Draws a clipped one pixel line into an RGB buffer. */
+static void DrawLine(unsigned char* data, int width, int height,
+                     float x0, float y0, float x1, float y1, const unsigned char* color)
+{
+    // Liang-Barsky against the buffer
+    float t0 = 0, t1 = 1;
+    float dx = x1 - x0, dy = y1 - y0;
+    const float p[] = { -dx, dx, -dy, dy };
+    const float q[] = { x0, width - 1 - x0, y0, height - 1 - y0 };
+    for (int i = 0; i < 4; ++i)
+    {
+        if (p[i] == 0)
+        {
+            if (q[i] < 0) return;
+            continue;
+        }
+        float t = q[i] / p[i];
+        if (p[i] < 0) t0 = std::max(t0, t);
+        else t1 = std::min(t1, t);
+        if (t0 > t1) return;
+    }
+
+    int ax = std::lround(x0 + t0 * dx), ay = std::lround(y0 + t0 * dy);
+    int bx = std::lround(x0 + t1 * dx), by = std::lround(y0 + t1 * dy);
+    int sx = ax < bx ? 1 : -1, sy = ay < by ? 1 : -1;
+    int ex = std::abs(bx - ax), ey = -std::abs(by - ay);
+    int error = ex + ey;
+    for (;;)
+    {
+        std::memcpy(data + 3 * (ay * width + ax), color, 3);
+        if (ax == bx && ay == by) break;
+        int e2 = 2 * error;
+        if (e2 >= ey) error += ey, ax += sx;
+        if (e2 <= ex) error += ex, ay += sy;
+    }
+}
+
+Preview::Preview(wxWindow* parent)
+        : wxPanel(parent, wxID_ANY, wxDefaultPosition, wxSize(480, -1)),
+          editor_(nullptr), build_generation_(0),
+          alive_(std::make_shared<bool>(true)), fit_pending_(true),
+          view_(Top), center_u_(0), center_v_(0), scale_(1),
+          dirty_(true), dragged_(false)
+{
+    SetBackgroundStyle(wxBG_STYLE_PAINT);
+
+    Bind(wxEVT_PAINT, &Preview::OnPaint, this);
+    Bind(wxEVT_SIZE, &Preview::OnSize, this);
+    Bind(wxEVT_CONTEXT_MENU, &Preview::OnContextMenu, this);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, &Preview::OnView, this, ID_VIEW_TOP, ID_VIEW_FIT);
+    for (auto type : { wxEVT_LEFT_DOWN, wxEVT_LEFT_UP, wxEVT_LEFT_DCLICK,
+                       wxEVT_MOTION, wxEVT_MOUSEWHEEL, wxEVT_LEAVE_WINDOW })
+    {
+        Bind(type, &Preview::OnMouse, this);
+    }
+}
+
+void Preview::SetEditor(Editor* editor)
+{
+    if (editor != editor_)
+    {
+        editor_ = editor;
+        fit_pending_ = true;
+    }
+    auto toolpath = editor_->GetToolpath();
+    if (toolpath == toolpath_) return;
+    toolpath_ = toolpath;
+    Rebuild();
+}
+
+size_t Preview::GetMemoryUsage() const
+{
+    size_t bytes = lod_ ? lod_->memory_usage() : 0;
+    if (bitmap_.IsOk()) bytes += (size_t) bitmap_.GetWidth() * bitmap_.GetHeight() * 4;
+    return bytes;
+}
+
+void Preview::Rebuild()
+{
+    auto generation = ++build_generation_;
+    if (!toolpath_)
+    {
+        OnBuilt(generation, nullptr, nullptr);
+        return;
+    }
+
+    auto toolpath = toolpath_;
+    auto axes = VIEW_AXES[view_];
+    std::weak_ptr<bool> alive = alive_;
+    WorkPool::shared().submit([=]() {
+        std::shared_ptr<const ToolpathLod> lod =
+            std::make_shared<ToolpathLod>(*toolpath, axes[0], axes[1]);
+        if (!wxTheApp) return;
+        wxTheApp->CallAfter([=]() {
+            if (alive.expired()) return;
+            OnBuilt(generation, toolpath, lod);
+        });
+    }, WorkPool::Foreground);
+}
+
+void Preview::OnBuilt(unsigned generation, std::shared_ptr<const Toolpath> toolpath,
+                      std::shared_ptr<const ToolpathLod> lod)
+{
+    // a newer program or view is on its way
+    if (generation != build_generation_) return;
+
+    shown_ = toolpath;
+    lod_ = lod;
+    hover_.reset();
+    if (fit_pending_) Fit();
+    dirty_ = true;
+    Refresh();
+}
+
+void Preview::Fit()
+{
+    if (!shown_) return;
+    fit_pending_ = false;
+
+    auto axes = VIEW_AXES[view_];
+    auto size = GetClientSize();
+    double width = shown_->max(axes[0]) - shown_->min(axes[0]);
+    double height = shown_->max(axes[1]) - shown_->min(axes[1]);
+    center_u_ = (shown_->max(axes[0]) + shown_->min(axes[0])) / 2;
+    center_v_ = (shown_->max(axes[1]) + shown_->min(axes[1])) / 2;
+    // leave a margin around the path
+    scale_ = 0.9 * std::min(size.x / std::max(width, 1e-3), size.y / std::max(height, 1e-3));
+    scale_ = std::max(scale_, 1e-6);
+    dirty_ = true;
+}
+
+void Preview::Render()
+{
+    dirty_ = false;
+    auto size = GetClientSize();
+    if (size.x <= 0 || size.y <= 0) return;
+
+    wxImage image(size.x, size.y, false);
+    auto data = image.GetData();
+    std::memset(data, 255, 3 * size.x * size.y);
+
+    if (lod_)
+    {
+        // anything finer than half a pixel doesn't show
+        auto& level = lod_->level(0.5 / scale_);
+        auto u = level.u.data();
+        auto v = level.v.data();
+        auto motions = level.motions.data();
+        float cu = center_u_, cv = center_v_, scale = scale_;
+        float cx = size.x / 2.f, cy = size.y / 2.f;
+        float lo[2] = { cu - cx / scale, cv - cy / scale };
+        float hi[2] = { cu + cx / scale, cv + cy / scale };
+
+        for (size_t c = 0; c < level.chunks(); ++c)
+        {
+            // zoomed in, most of the level is off the screen
+            if (level.chunk_max[0][c] < lo[0] || level.chunk_min[0][c] > hi[0] ||
+                level.chunk_max[1][c] < lo[1] || level.chunk_min[1][c] > hi[1]) continue;
+            auto first = c * ToolpathLod::CHUNK;
+            auto end = std::min(first + ToolpathLod::CHUNK, level.size());
+            float x0 = cx + (u[first] - cu) * scale;
+            float y0 = cy - (v[first] - cv) * scale;
+            for (size_t i = first; i < end; ++i)
+            {
+                float x1 = cx + (u[i + 1] - cu) * scale;
+                float y1 = cy - (v[i + 1] - cv) * scale;
+                DrawLine(data, size.x, size.y, x0, y0, x1, y1, MOTION_COLORS[motions[i]]);
+                x0 = x1;
+                y0 = y1;
+            }
+        }
+    }
+    bitmap_ = wxBitmap(image);
+}
+
+std::optional<size_t> Preview::HitTest(const wxPoint& point)
+{
+    if (!lod_) return std::nullopt;
+    auto size = GetClientSize();
+    auto u = center_u_ + (point.x - size.x / 2.) / scale_;
+    auto v = center_v_ - (point.y - size.y / 2.) / scale_;
+    return lod_->pick(*shown_, u, v, PICK_RADIUS / scale_, 0.5 / scale_);
+}
+
+void Preview::SetHover(std::optional<size_t> segment)
+{
+    if (segment == hover_) return;
+    hover_ = segment;
+    Refresh();
+
+    auto frame = wxDynamicCast(wxGetTopLevelParent(this), wxFrame);
+    if (!frame || !editor_) return;
+    wxString msg;
+    if (hover_)
+    {
+        auto line = editor_->LineFromBlock(shown_->blocks()[*hover_]);
+        if (line >= 0) msg << "Line " << line + 1;
+    }
+    frame->SetStatusText(msg);
+}
+
+void Preview::OnMouse(wxMouseEvent& event)
+{
+    auto point = event.GetPosition();
+    auto type = event.GetEventType();
+
+    if (type == wxEVT_LEFT_DOWN)
+    {
+        drag_from_ = point;
+        dragged_ = false;
+        CaptureMouse();
+    }
+    else if (type == wxEVT_LEFT_UP)
+    {
+        if (HasCapture()) ReleaseMouse();
+        // a click rather than the end of a drag selects the block
+        if (!dragged_ && editor_)
+        {
+            auto segment = HitTest(point);
+            if (segment) editor_->GotoBlock(shown_->blocks()[*segment]);
+        }
+    }
+    else if (type == wxEVT_LEFT_DCLICK)
+    {
+        Fit();
+        Refresh();
+    }
+    else if (type == wxEVT_MOTION && event.LeftIsDown())
+    {
+        auto delta = point - drag_from_;
+        if (!dragged_ && std::abs(delta.x) + std::abs(delta.y) < 3) return;
+        dragged_ = true;
+        drag_from_ = point;
+        center_u_ -= delta.x / scale_;
+        center_v_ += delta.y / scale_;
+        dirty_ = true;
+        Refresh();
+    }
+    else if (type == wxEVT_MOTION)
+    {
+        SetHover(HitTest(point));
+    }
+    else if (type == wxEVT_MOUSEWHEEL)
+    {
+        // zoom about the pointer
+        auto size = GetClientSize();
+        auto factor = std::pow(1.25, (double)event.GetWheelRotation() / event.GetWheelDelta());
+        auto dx = point.x - size.x / 2., dy = point.y - size.y / 2.;
+        center_u_ += dx / scale_ - dx / (scale_ * factor);
+        center_v_ -= dy / scale_ - dy / (scale_ * factor);
+        scale_ *= factor;
+        dirty_ = true;
+        Refresh();
+    }
+    else if (type == wxEVT_LEAVE_WINDOW)
+    {
+        SetHover(std::nullopt);
+    }
+}
+
+void Preview::OnContextMenu(wxContextMenuEvent& WXUNUSED(event))
+{
+    wxMenu menu;
+    menu.AppendRadioItem(ID_VIEW_TOP, _T("&Top (XY)"));
+    menu.AppendRadioItem(ID_VIEW_FRONT, _T("&Front (XZ)"));
+    menu.AppendRadioItem(ID_VIEW_SIDE, _T("&Side (YZ)"));
+    menu.AppendSeparator();
+    menu.Append(ID_VIEW_FIT, _T("F&it"));
+    menu.Check(ID_VIEW_TOP + view_, true);
+    PopupMenu(&menu);
+}
+
+void Preview::OnView(wxCommandEvent& event)
+{
+    if (event.GetId() == ID_VIEW_FIT)
+    {
+        Fit();
+        Refresh();
+        return;
+    }
+    // menu ids follow the order of View
+    auto view = (View)(event.GetId() - ID_VIEW_TOP);
+    if (view == view_) return;
+    view_ = view;
+    fit_pending_ = true;
+    Rebuild();
+}
+
+void Preview::OnPaint(wxPaintEvent& WXUNUSED(event))
+{
+    wxAutoBufferedPaintDC dc(this);
+    if (dirty_) Render();
+    if (bitmap_.IsOk()) dc.DrawBitmap(bitmap_, 0, 0);
+    if (!hover_) return;
+
+    // the whole block under the pointer, over the level of detail
+    auto& blocks = shown_->blocks();
+    auto block = blocks[*hover_];
+    size_t first = *hover_, last = *hover_ + 1;
+    while (first > 0 && blocks[first - 1] == block) --first;
+    while (last < blocks.size() && blocks[last] == block) ++last;
+
+    auto axes = VIEW_AXES[view_];
+    auto& u = shown_->axis(axes[0]);
+    auto& v = shown_->axis(axes[1]);
+    auto size = GetClientSize();
+    auto toScreen = [&](size_t i) {
+        return wxPoint(std::lround(size.x / 2. + (u[i] - center_u_) * scale_),
+                       std::lround(size.y / 2. - (v[i] - center_v_) * scale_));
+    };
+    dc.SetPen(wxPen(wxColour(215, 58, 73), 3));
+    for (size_t i = first; i < last; ++i)
+    {
+        dc.DrawLine(toScreen(i), toScreen(i + 1));
+    }
+}
+
+void Preview::OnSize(wxSizeEvent& event)
+{
+    dirty_ = true;
+    Refresh();
+    event.Skip();
+}
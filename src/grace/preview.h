@@ -0,0 +1,72 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <memory>
+#include <optional>
+
+#include <wx/wx.h>
+
+#include <wx/panel.h>
+
+#include "editor.h"
+#include "gproc/toolpath.h"
+
+/* Orthographic view of the toolpath of the selected document.
+ *
+ * The path is drawn in software into a bitmap from the level of detail
+ * that fits the zoom, and only redrawn when the view or the program
+ * changes. Hovering a segment shows its line, clicking it selects the
+ * block in the editor. Drag to pan, wheel to zoom, double-click to fit.
+ */
+class Preview : public wxPanel {
+public:
+    Preview(wxWindow* parent);
+    // shows the last program of editor that compiled
+    void SetEditor(Editor* editor);
+    // heap bytes of the levels of detail and the bitmap drawn from them
+    size_t GetMemoryUsage() const;
+
+private:
+    enum View {
+        Top,
+        Front,
+        Side,
+    };
+    //
+    void Fit();
+    void Rebuild();
+    void OnBuilt(unsigned generation, std::shared_ptr<const Toolpath> toolpath,
+                 std::shared_ptr<const ToolpathLod> lod);
+    void Render();
+    std::optional<size_t> HitTest(const wxPoint& point);
+    void SetHover(std::optional<size_t> segment);
+    void OnContextMenu(wxContextMenuEvent& event);
+    void OnMouse(wxMouseEvent& event);
+    void OnPaint(wxPaintEvent& event);
+    void OnSize(wxSizeEvent& event);
+    void OnView(wxCommandEvent& event);
+
+    Editor* editor_;
+    // latest toolpath asked for, and the one the pyramid was built from
+    std::shared_ptr<const Toolpath> toolpath_;
+    std::shared_ptr<const Toolpath> shown_;
+    std::shared_ptr<const ToolpathLod> lod_;
+    unsigned build_generation_;
+    std::shared_ptr<bool> alive_;
+    bool fit_pending_;
+
+    View view_;
+    // world point at the center of the panel, and pixels per millimeter
+    double center_u_;
+    double center_v_;
+    double scale_;
+
+    wxBitmap bitmap_;
+    bool dirty_;
+    std::optional<size_t> hover_;
+    wxPoint drag_from_;
+    bool dragged_;
+};
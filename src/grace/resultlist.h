@@ -0,0 +1,111 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <wx/wx.h>
+
+#include <wx/listctrl.h>
+
+/* Report list over a vector of analysis results.
+ *
+ * The list is virtual: it owns the records and formats a cell only when
+ * it is painted, so setting a hundred thousand results costs no more than
+ * moving the vector in. Sorting and filtering permute an index into the
+ * records instead of touching the control. Clicking a sortable column
+ * header sorts by it, clicking it again reverses the order.
+ */
+template <typename T>
+class ResultList : public wxListView {
+public:
+    struct Column {
+        wxString title;
+        int width;
+        std::function<wxString(const T&)> format;
+        // orders rows by the column, empty when it can't be sorted
+        std::function<bool(const T&, const T&)> less;
+    };
+    using Filter = std::function<bool(const T&)>;
+    //
+    ResultList(wxWindow* parent, std::vector<Column> columns,
+               const wxSize& size = wxDefaultSize)
+            : wxListView(parent, wxID_ANY, wxDefaultPosition, size,
+                         wxLC_REPORT|wxLC_VIRTUAL),
+              columns_(std::move(columns)), sort_column_(-1), ascending_(true)
+    {
+        for (auto& column : columns_)
+        {
+            AppendColumn(column.title, wxLIST_FORMAT_LEFT, column.width);
+        }
+        Bind(wxEVT_LIST_COL_CLICK, &ResultList::OnColumnClick, this);
+    }
+    void SetResults(std::vector<T> results)
+    {
+        results_ = std::move(results);
+        UpdateRows();
+    }
+    void ClearResults() { SetResults({}); }
+    // shows only the results passing filter, an empty one shows all
+    void SetFilter(Filter filter)
+    {
+        filter_ = std::move(filter);
+        UpdateRows();
+    }
+    // result shown in a row of the list
+    const T& GetResult(long item) const { return results_[rows_[item]]; }
+    const std::vector<T>& GetResults() const { return results_; }
+    // heap bytes of the records and the rows shown
+    size_t GetMemoryUsage() const
+    {
+        return results_.capacity() * sizeof(T) + rows_.capacity() * sizeof(unsigned);
+    }
+
+protected:
+    wxString OnGetItemText(long item, long column) const wxOVERRIDE
+    {
+        return columns_[column].format(GetResult(item));
+    }
+
+private:
+    void OnColumnClick(wxListEvent& event)
+    {
+        auto column = event.GetColumn();
+        if (column < 0 || !columns_[column].less) return;
+        ascending_ = column == sort_column_ ? !ascending_ : true;
+        sort_column_ = column;
+        UpdateRows();
+    }
+    void UpdateRows()
+    {
+        rows_.clear();
+        rows_.reserve(results_.size());
+        for (unsigned i = 0; i < results_.size(); ++i)
+        {
+            if (!filter_ || filter_(results_[i])) rows_.push_back(i);
+        }
+        if (sort_column_ >= 0)
+        {
+            auto& less = columns_[sort_column_].less;
+            // ties keep the order of the results
+            std::stable_sort(rows_.begin(), rows_.end(), [&](unsigned a, unsigned b) {
+                return ascending_ ? less(results_[a], results_[b])
+                                  : less(results_[b], results_[a]);
+            });
+        }
+        SetItemCount(rows_.size());
+        Refresh();
+    }
+
+    std::vector<Column> columns_;
+    std::vector<T> results_;
+    // indices into results_ in display order
+    std::vector<unsigned> rows_;
+    Filter filter_;
+    int sort_column_;
+    bool ascending_;
+};
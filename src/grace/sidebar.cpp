@@ -11,17 +11,23 @@
 
 #include "main.h"
 #include "sidebar.h"
-#include "gproc/parser.h"
-#include "gproc/types.h"
 
 
-Sidebar::Sidebar(wxWindow* parent) : wxPanel(parent)
+static bool out_of_range(const SpeedVisitor::SpeedRecord& rec)
+{
+    return rec.value < rec.calculatedValueLo || rec.value > rec.calculatedValueHi;
+}
+
+
+Sidebar::Sidebar(wxWindow* parent) : wxPanel(parent), editor_(nullptr)
 {
     mspeeds_.emplace_back(15, 18);
     mspeeds_.emplace_back(30, 38);
     mspeeds_.emplace_back(21, 40);
     mspeeds_.emplace_back(75, 105);
 
+    diameters_ = { 1, 1.5, 2, 3, 4, 5, 6, 8, 10, 12, 16, 20, 25 };
+
     materials_box_ = new wxComboBox(
         this, wxID_ANY, wxEmptyString, wxDefaultPosition,
         wxDefaultSize, 0, NULL, wxCB_READONLY);
@@ -38,54 +44,125 @@ Sidebar::Sidebar(wxWindow* parent) : wxPanel(parent)
     machineBox->SetSelection(0);
     diameter_edit_ = new wxSpinCtrlDouble(this);
     diameter_edit_->SetValue(1.5);
-    speed_list_ = new wxListView(this, wxID_ANY);
-    speed_list_->AppendColumn("Value");
-    speed_list_->AppendColumn("Line");
-    speed_list_->AppendColumn("Status");
+    using Rec = SpeedVisitor::SpeedRecord;
+    speed_list_ = new SpeedList(this, {
+        { "Value", -1,
+          [](const Rec& rec) { return wxString() << (int)rec.value; },
+          [](const Rec& a, const Rec& b) { return a.value < b.value; } },
+        { "Line", -1,
+          [this](const Rec& rec) { return wxString() << editor_->LineFromBlock(rec.block) + 1; },
+          [](const Rec& a, const Rec& b) { return a.block < b.block; } },
+        { "Status", -1,
+          [](const Rec& rec) {
+              return wxString() << (int)rec.calculatedValueLo << wxString::FromUTF8("–")
+                                << (int)std::ceil(rec.calculatedValueHi);
+          },
+          // by how far the value is out of range
+          [](const Rec& a, const Rec& b) {
+              return std::max(a.calculatedValueLo - a.value, a.value - a.calculatedValueHi) <
+                     std::max(b.calculatedValueLo - b.value, b.value - b.calculatedValueHi);
+          } },
+    });
+    speed_list_->Bind(wxEVT_LIST_ITEM_ACTIVATED, &Sidebar::OnSpeedActivated, this);
+    out_of_range_box_ = new wxCheckBox(this, wxID_ANY, "Out of range only");
+    out_of_range_box_->Bind(wxEVT_CHECKBOX, &Sidebar::OnFilterSpeeds, this);
     auto button = new wxButton(this, wxID_ANY, "Calculate");
     button->Bind(wxEVT_BUTTON, &Sidebar::OnCalculateSpeeds, this);
+    auto sweepButton = new wxButton(this, wxID_ANY, "Sweep All");
+    sweepButton->Bind(wxEVT_BUTTON, &Sidebar::OnSweepSpeeds, this);
 
     auto sizer = new wxBoxSizer(wxVERTICAL);
     auto border = 16;
     sizer->Add(materials_box_, 0, wxALL|wxEXPAND, border);
     sizer->Add(machineBox, 0, wxLEFT|wxRIGHT|wxEXPAND, border);
     sizer->Add(diameter_edit_, 0, wxALL|wxEXPAND, border);
-    sizer->Add(speed_list_, 0, wxALL|wxEXPAND, border);
+    sizer->Add(speed_list_, 0, wxLEFT|wxRIGHT|wxTOP|wxEXPAND, border);
+    sizer->Add(out_of_range_box_, 0, wxALL|wxEXPAND, border);
     sizer->Add(button, 0, wxLEFT|wxRIGHT|wxEXPAND, border);
+    sizer->Add(sweepButton, 0, wxALL|wxEXPAND, border);
     sizer->AddStretchSpacer();
     SetSizerAndFit(sizer);
 }
 
+void Sidebar::SetEditor(Editor* editor)
+{
+    if (editor == editor_) return;
+    editor_ = editor;
+    speed_list_->ClearResults();
+}
+
 void Sidebar::OnCalculateSpeeds(wxCommandEvent& event)
 {
-    speed_list_->DeleteAllItems();
+    speed_list_->ClearResults();
 
-    auto text = ((MainFrame*) GetParent())->GetText();
-    Program program;
-    try {
-        Parser parser(text.ToStdWstring());
-        program = parser.parse();
-    }
-    catch (std::exception e) {
-        return;
-    }
+    auto editor = ((MainFrame*) GetParent())->GetEditor();
+    // S words were collected when the program compiled
+    auto speeds = editor->GetSpeeds();
+    if (!speeds) return;
+    editor_ = editor;
 
     auto spr = mspeeds_[materials_box_->GetSelection()];
+    // rows are formatted as they scroll into view
+    speed_list_->SetResults(speeds->records(
+        { spr.first, spr.second, (float)diameter_edit_->GetValue() }));
+}
 
-    auto visitor = SpeedVisitor(
-        { spr.first, spr.second, (float)diameter_edit_->GetValue() });
-    program.accept(&visitor);
-
-    unsigned index = 0;
-    for (SpeedVisitor::SpeedRecord rec : visitor.records()) {
-        //std::cout << rec.value << rec.calculatedValueLo <<
-        //    rec.calculatedValueHi << std::endl;
-        speed_list_->InsertItem(index, std::to_string((int)rec.value));
-        speed_list_->SetItem(index, 1, std::to_string(rec.line));
-        wxString msg;
-        msg << (int)rec.calculatedValueLo << wxString::FromUTF8("–")
-            << (int)std::ceil(rec.calculatedValueHi);
-        speed_list_->SetItem(index, 2, msg);
-        ++index;
+void Sidebar::OnFilterSpeeds(wxCommandEvent& event)
+{
+    if (event.IsChecked()) speed_list_->SetFilter(out_of_range);
+    else speed_list_->SetFilter(nullptr);
+}
+
+void Sidebar::OnSpeedActivated(wxListEvent& event)
+{
+    editor_->GotoBlock(speed_list_->GetResult(event.GetIndex()).block);
+    editor_->SetFocus();
+}
+
+void Sidebar::OnSweepSpeeds(wxCommandEvent& event)
+{
+    auto editor = ((MainFrame*) GetParent())->GetEditor();
+    auto speeds = editor->GetSpeeds();
+    if (!speeds) return;
+
+    std::vector<SpeedSweep::Material> materials;
+    for (auto& spr : mspeeds_)
+    {
+        materials.emplace_back(SpeedSweep::Material { spr.first, spr.second });
     }
+    // S words in subprograms count once per call
+    auto calls = editor->GetCallGraph();
+    auto results = SpeedSweep(*speeds, calls.get()).run(materials, diameters_);
+
+    auto dialog = new wxDialog(this, wxID_ANY, "Speed Sweep", wxDefaultPosition,
+                               wxSize(520, 600), wxDEFAULT_DIALOG_STYLE|wxRESIZE_BORDER);
+    using Result = SpeedSweep::Result;
+    auto list = new SweepList(dialog, {
+        { "Material", 220,
+          [this](const Result& result) { return materials_box_->GetString(result.material); },
+          [](const Result& a, const Result& b) { return a.material < b.material; } },
+        { wxString::FromUTF8("Ø"), -1,
+          [](const Result& result) { return wxString() << result.toolDiameter; },
+          [](const Result& a, const Result& b) { return a.toolDiameter < b.toolDiameter; } },
+        { "Status", 160,
+          [editor](const Result& result) {
+              if (!result.outOfRange) return wxString("OK");
+              return wxString() << result.outOfRange << " out of range, line "
+                                << editor->LineFromBlock(result.firstBlock) + 1;
+          },
+          [](const Result& a, const Result& b) { return a.outOfRange < b.outOfRange; } },
+    });
+    list->SetResults(std::move(results));
+    auto filter = new wxCheckBox(dialog, wxID_ANY, "Out of range only");
+    filter->Bind(wxEVT_CHECKBOX, [list](wxCommandEvent& event) {
+        if (event.IsChecked()) list->SetFilter([](const Result& result) { return result.outOfRange > 0; });
+        else list->SetFilter(nullptr);
+    });
+
+    auto sizer = new wxBoxSizer(wxVERTICAL);
+    sizer->Add(list, 1, wxLEFT|wxRIGHT|wxTOP|wxEXPAND, 16);
+    sizer->Add(filter, 0, wxALL|wxEXPAND, 16);
+    dialog->SetSizer(sizer);
+    dialog->ShowModal();
+    dialog->Destroy();
 }
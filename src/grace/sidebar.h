@@ -6,24 +6,45 @@
 
 #include <wx/wx.h>
 
+#include <wx/checkbox.h>
 #include <wx/combobox.h>
-#include <wx/listctrl.h>
 #include <wx/panel.h>
 #include <wx/spinctrl.h>
 #include <wx/window.h>
 
+#include "resultlist.h"
+#include "gproc/sweep.h"
+#include "gproc/types.h"
+
+class Editor;
+
 class Sidebar : public wxPanel {
     friend class MainFrame;
 public:
     Sidebar(wxWindow* parent);
+    // results belong to one document, they go when another is selected
+    void SetEditor(Editor* editor);
     void OnCalculateSpeeds(wxCommandEvent& event);
+    void OnSweepSpeeds(wxCommandEvent& event);
+    // heap bytes of the speeds listed
+    size_t GetMemoryUsage() const { return speed_list_->GetMemoryUsage(); }
 private:
+    using SpeedList = ResultList<SpeedVisitor::SpeedRecord>;
+    using SweepList = ResultList<SpeedSweep::Result>;
+    //
+    void OnFilterSpeeds(wxCommandEvent& event);
+    void OnSpeedActivated(wxListEvent& event);
+
     //const static wxString materials_[] = {
     //  wxT("a"), wxT("b"), wxT("c"), wxT("d")};
 
     wxComboBox* materials_box_;
     wxSpinCtrlDouble* diameter_edit_;
-    wxListView* speed_list_;
+    wxCheckBox* out_of_range_box_;
+    SpeedList* speed_list_;
+    Editor* editor_;
 
     std::vector<std::pair<float, float>> mspeeds_;
+    // tool diameters covered by the sweep, mm
+    std::vector<float> diameters_;
 };